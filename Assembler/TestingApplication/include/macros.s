@@ -0,0 +1,5 @@
+# Included by test_include.s; includes table.s from the same directory
+.macro load_answer reg
+    addi \reg, x0, 42   # comments and commas are cleaned once per file
+.endm
+.include "table.s"
@@ -0,0 +1,5 @@
+# Included by macros.s; words.bin is found next to this file
+.data
+words:
+    .incbin "words.bin"
+.text
@@ -0,0 +1,14 @@
+main:
+li a0,0
+li s0,10
+addi a1,x0,3
+loop:
+add a0,a0,s0
+addi s0,s0,-1
+bne s0,x0,loop
+.balign 16
+aligned:
+addi a0,a0,1
+.p2align 3
+done:
+j done
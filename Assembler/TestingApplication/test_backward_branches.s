@@ -0,0 +1,10 @@
+main:
+add x0,x0,x0
+loop:
+beq sp,x0,main
+bne sp,x0,loop
+blt sp,x0,main
+bge sp,x0,loop
+bltu sp,x0,main
+bgeu sp,x0,loop
+jal x0,main
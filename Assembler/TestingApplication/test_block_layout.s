@@ -0,0 +1,10 @@
+# options: --profile TestingApplication/profile_branches.txt --block-layout
+# The branch is taken 9 times out of 10: it is inverted so the taken path falls through
+main:
+    beqz a0, often
+    addi a1, a1, 1
+    j join
+often:
+    addi a2, a2, 1
+join:
+    ret
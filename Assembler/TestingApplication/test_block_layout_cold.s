@@ -0,0 +1,21 @@
+# options: --profile TestingApplication/profile_cold_block.txt --block-layout
+# rare runs 6 times out of 50 and sits between the hot block and its target cont: it
+# moves to the end with a "j cont", and the hot "j cont" becomes a fall-through
+main:
+    li s0, 50
+loop:
+    mv a0, s0
+    call classify
+    addi s0, s0, -1
+    bnez s0, loop
+done:
+    j done
+classify:
+    andi t0, a0, 7
+    beqz t0, rare
+    addi a1, a1, 1
+    j cont
+rare:
+    addi a2, a2, 1
+cont:
+    ret
@@ -0,0 +1,40 @@
+# options: --compress
+# One instruction per RV32C form, then the c.nop padding of an odd halfword and the
+# instructions that keep their 32-bit form
+main:
+    nop                     # c.nop
+    li a3, -5               # c.li
+    addi sp, sp, -64        # c.addi16sp
+    addi a4, a4, 7          # c.addi
+    mv a5, a4               # c.mv (addi rd, rs, 0)
+    addi s1, sp, 16         # c.addi4spn
+    slli s0, s0, 3          # c.slli
+    srli a0, a0, 2          # c.srli
+    srai a1, a1, 31         # c.srai
+    andi a1, a1, -4         # c.andi
+    add a0, x0, a1          # c.mv (add rd, x0, rs)
+    add a0, a0, a1          # c.add
+    add a2, a1, a2          # c.add (operands swapped)
+    sub s0, s0, s1          # c.sub
+    xor s1, s1, a0          # c.xor
+    or a0, a1, a0           # c.or (operands swapped)
+    and a1, a1, a2          # c.and
+    lui a2, 5               # c.lui
+    lw ra, 12(sp)           # c.lwsp
+    lw a0, 4(s0)            # c.lw
+    sw ra, 12(sp)           # c.swsp
+    sw a0, 8(s1)            # c.sw
+loop:
+    beqz s0, done           # c.beqz
+    bnez a0, loop           # c.bnez
+    jal ra, func            # c.jal
+    jalr ra, a0, 0          # c.jalr
+    j loop                  # c.j
+.balign 4
+func:
+    addi a0, a1, 100        # No form: rd differs from rs1 and the immediate is too wide
+    sub a0, a0, t0          # No form: t0 is not one of x8-x15
+    lw a0, 2(s0)            # No form: the offset is not a multiple of 4
+    ret                     # c.jr
+done:
+    jal x0, done            # c.j
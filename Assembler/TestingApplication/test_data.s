@@ -0,0 +1,16 @@
+# Data bytes, packed little-endian into words, and data alignment
+main:
+    la a0, table
+    lw a1, 0(a0)
+    ret
+.data
+table:
+    .word 0x11223344, -1, main
+    .half 0x5566, 010
+    .byte 1, 2, 3
+    .string "ab\n"
+    .balign 8
+aligned:
+    .ascii "xyz"
+    .space 5
+    .word aligned
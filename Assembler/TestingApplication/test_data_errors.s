@@ -0,0 +1,14 @@
+# Data that cannot be assembled: each line below fails the run
+main:
+    nop
+.data
+ok: .byte 255, -128, 0x7f
+    .half 65535, -32768
+t: .half 1, foo
+    .byte 300, -1
+    .byte -129
+    .half 65536
+    .word 0x100000000
+    .space
+long: .word 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79
+    .word 1, 2, 3
@@ -0,0 +1,11 @@
+# A branch, j or jal x0 beyond +-1 MiB has no register to hold the upper part of an
+# auipc+jalr without clobbering t1, which still holds 7 at far: each one is an error
+main:
+    addi t1, x0, 7
+    beq x0, x0, far
+    j far
+    jal x0, far
+    tail far                # Only tail may use t1
+    .space 0x110000
+far:
+    add a1, t1, x0
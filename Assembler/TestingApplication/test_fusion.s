@@ -0,0 +1,10 @@
+# options: --fusion TestingApplication/fusion_pairs.txt
+# srli moves up next to its slli, the second lw next to the first
+main:
+    slli a1, a1, 16
+    addi a2, a2, 1
+    srli a1, a1, 16
+    lw t1, 0(s0)
+    addi a3, a3, 1
+    lw t2, 4(s0)
+    ret
@@ -0,0 +1,10 @@
+# A region of a binary file and the whole file, after a byte that misaligns the first
+main:
+    la a0, blob
+    ret
+.data
+    .byte 0xAA
+blob:
+    .incbin "TestingApplication/incbin_blob.bin", 2, 5
+    .balign 4
+    .incbin "TestingApplication/incbin_blob.bin"
@@ -0,0 +1,7 @@
+# A nested .include whose .incbin is found next to the including file
+.include "include/macros.s"
+main:
+    load_answer a0
+    la a1, words
+    lw a2, 4(a1)
+    ret
@@ -0,0 +1,17 @@
+li a0,0
+li a1,2047
+li a2,-2048
+li a3,2048
+li a4,0x12345000
+li a5,0x12345678
+li s0,0x7FFFF800
+li s1,-1
+li t0,0xFFFFF800
+li t1,0x80000000
+li t2,0xFFFFFFFF
+li ra,-2049
+li sp,305419896
+li s2,-0x1000
+li s3,-0x7FF
+li s4,0x80000000
+li s5,010
@@ -0,0 +1,10 @@
+# A load-use stall, a block ending with a branch and one ending with a return
+main:
+    lw t0, 0(a0)
+    addi t1, t0, 1
+    li t2, 0x12345678
+    add t3, t2, t1
+loop:
+    addi t3, t3, -1
+    bnez t3, loop
+    ret
@@ -0,0 +1,10 @@
+# options: --literal-pool
+# Both loads of 0x12345678 share one entry of the pool placed after the first return;
+# 0x7FF fits addi and stays inline, as does 0xCAFEBABE with no jump or return after it
+main:
+    li a0, 0x12345678
+    li a1, 0x7FF
+    li a2, 0x12345678
+    ret
+tail:
+    li a3, 0xCAFEBABE
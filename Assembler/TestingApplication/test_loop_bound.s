@@ -0,0 +1,11 @@
+# options: --wcet
+li s0,8
+.loop_bound 8
+outer: li s1,4
+inner: lw t0,0(a0)
+add t1,t0,t1
+addi s1,s1,-1
+bne s1,x0,inner # loop_bound 4
+addi s0,s0,-1
+bne s0,x0,outer
+done: j done
@@ -0,0 +1,24 @@
+# A macro with a default and a named argument, .rept, .irp and .if/.elseif/.else
+.macro bump reg, by=1
+    addi \reg, \reg, \by
+.endm
+.macro clear reg
+    .if \reg == 0
+    addi a0, x0, 0
+    .elseif \reg > 5
+    addi a\reg, x0, -1
+    .else
+    addi a\reg, x0, \reg
+    .endif
+.endm
+main:
+    bump a0
+    bump a1, by=4
+    bump by=-2, reg=a2
+    .rept 3
+    bump t0, 8
+    .endr
+    .irp r, 0, 3, 6
+    clear \r
+    .endr
+    ret
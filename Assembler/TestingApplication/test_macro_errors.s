@@ -0,0 +1,22 @@
+# Preprocessor errors: each one fails the run
+.macro forever
+    forever
+.endm
+.macro pair a, b
+    add \a, \a, \b
+.endm
+.macro
+.endm
+.macro wide text
+    .word \text, \text, \text, \text, \text, \text, \text, \text, \text, \text, \text, \text
+.endm
+main:
+    forever
+    pair a0, a1, a2
+    .if 1 +
+    .endif
+    .else
+    .endif
+    .endm
+    wide 0x000000000000000000000000000000000000000001
+    ret
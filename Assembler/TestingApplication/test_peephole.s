@@ -0,0 +1,17 @@
+# options: --peephole
+# mv a0,a0 and addi a1,a1,0 go, the canonical nop stays, the branch to "hop" is
+# threaded to "done" and both jumps to the next instruction go
+main:
+    mv a0, a0
+    addi a1, a1, 0
+    nop
+    beq a0, a1, hop
+    j next
+next:
+    addi a2, a2, 1
+    ret
+hop:
+    j done
+done:
+    addi a3, a3, 1
+    ret
@@ -0,0 +1,18 @@
+# options: --profile TestingApplication/profile_calls.txt
+# hot follows main, then warm; cold, never called, goes to the end
+main:
+    call hot
+    call warm
+    bnez a0, done
+    call cold
+done:
+    ret
+cold:
+    addi a0, a0, 3
+    ret
+warm:
+    addi a0, a0, 2
+    ret
+hot:
+    addi a0, a0, 1
+    ret
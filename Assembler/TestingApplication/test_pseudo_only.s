@@ -0,0 +1,22 @@
+main:
+nop
+mv a0,a1
+not a2,a3
+neg a4,a5
+seqz s0,s1
+snez t0,t1
+la a0,data
+beqz a0,main
+bnez a1,data
+bgt a0,a1,main
+ble a2,a3,data
+bgtu a4,a5,main
+bleu s0,s1,data
+call func
+tail func
+j main
+func:
+jr t0
+ret
+data:
+addi x0,x0,0
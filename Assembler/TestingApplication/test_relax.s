@@ -0,0 +1,17 @@
+# Branches beyond +-4 KiB become the inverted branch over a jal (beq -> bne, blt -> bge).
+# ahead starts 4096 bytes past skip, 2 bytes out of reach. Once first has grown, the
+# .balign padding in front of ahead shrinks from 4 to 0 bytes, and skip would reach it
+# in its 4-byte form again. Forms never shrink, so skip stays relaxed, ahead moves to
+# 4112 and the layout settles instead of oscillating.
+main:
+first:
+    beq a0, a1, ahead
+    addi a2, a2, 1
+skip:
+    blt a2, a3, ahead
+    .space 4088
+.balign 8
+ahead:
+    beq a0, a1, ahead       # Backward, in reach
+    bge a2, a3, first       # Backward, beyond +-4 KiB
+    ret
@@ -0,0 +1,13 @@
+# Jumps beyond +-1 MiB become auipc+jalr: jal and call load the upper part of the offset
+# into their link register, tail into t1. hex_relax_far.dump holds only the code in front
+# of the 1 MiB filler, the lines the output is compared on.
+main:
+    jal ra, far             # auipc ra + jalr ra
+    call far                # auipc ra + jalr ra
+    jal s0, far             # auipc s0 + jalr s0
+    tail far                # auipc t1 + jalr x0
+    j near                  # In reach: keeps its form
+near:
+    .space 0x100000
+far:
+    ret
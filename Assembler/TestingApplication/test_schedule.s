@@ -0,0 +1,11 @@
+# options: --schedule
+# The second load moves up between the first load and its use: 2 -> 0 stall cycles
+main:
+    lw t0, 0(a0)
+    addi t1, t0, 1
+    lw t4, 8(a0)
+    add t5, t4, t1
+    addi t2, a1, 2
+    addi t3, a2, 3
+    sw t5, 4(a0)
+    ret
@@ -0,0 +1,12 @@
+# .sdata starts word-aligned after the single byte of .data, so gp and x stay aligned
+main:
+    la gp, __global_pointer$
+    lw a0, x
+    sw a0, y, t0
+    ret
+.data
+    .byte 1
+.sdata
+x:  .word 5
+.sbss
+y:  .zero 4
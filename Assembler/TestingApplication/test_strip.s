@@ -0,0 +1,14 @@
+# options: --strip-unreachable
+# dead, after the jump and never named, goes; handler stays as its address is taken
+main:
+    la t0, handler
+    jalr ra, t0, 0
+    j done
+dead:
+    addi a0, a0, 9
+    addi a1, a1, 9
+handler:
+    addi a0, a0, 1
+    ret
+done:
+    ret
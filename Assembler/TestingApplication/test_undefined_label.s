@@ -0,0 +1,7 @@
+# A branch or jump to a label that is never defined is an error, reported with its line
+main:
+    beq a0, a1, nowhere
+    jal ra, missing
+    j gone
+    bnez a0, main           # Defined: no error
+    ret
@@ -0,0 +1,12 @@
+# la, call, tail and the loads and stores of a symbol naming a label that is never
+# defined are errors, reported with their line
+main:
+    la a0, nolabel
+    lw a1, nolabel
+    sw a1, nowhere, t0
+    lbu a2, table           # Defined: no error
+    lw a3, 4(a0)            # offset(register): no label
+    call missing
+    tail gone
+table:
+    .byte 1
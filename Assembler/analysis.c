@@ -0,0 +1,809 @@
+/*
+ * RISC-V Simulator Analysis Modes
+ *
+ * This file contains the optional analyses that observe the retired-instruction
+ * stream of the simulator. Each analysis has an init function called after the
+ * program is loaded, a record function called for every retired instruction and a
+ * report function called when the simulation stops.
+ */
+
+#include "simulator.h"
+
+/*
+ * Data cache model shared by the analyses: a set-associative cache with LRU
+ * replacement. Only hits and misses are tracked, no data is stored.
+ */
+static unsigned int cache_line_size = 64;   // Bytes per cache line
+static unsigned int cache_sets = 64;        // Number of sets
+static unsigned int cache_ways = 4;         // Lines per set
+static unsigned int cache_miss_latency = 20; // Cycles needed to service a miss
+static unsigned int *cache_tags = NULL;     // Tag of every line (sets * ways)
+static unsigned long long *cache_stamps = NULL; // Last use time of every line, 0 = invalid
+static unsigned long long cache_clock = 0;  // Incremented on every access
+static unsigned long long cache_accesses = 0;
+static unsigned long long cache_misses = 0;
+
+/*
+ * Looks up an address in the cache model and fills the line on a miss.
+ *
+ * @param address: The byte address being accessed.
+ * @return: true on a hit, false on a miss.
+ */
+static bool cache_access(unsigned int address) {
+    unsigned int line = address / cache_line_size;
+    unsigned int set = line % cache_sets;
+    unsigned int *tags = &cache_tags[set * cache_ways];
+    unsigned long long *stamps = &cache_stamps[set * cache_ways];
+    unsigned int victim = 0;
+
+    cache_clock++;
+    cache_accesses++;
+    for (unsigned int way = 0; way < cache_ways; way++) {
+        if (stamps[way] != 0 && tags[way] == line) {
+            stamps[way] = cache_clock;  // Hit: refresh the LRU stamp
+            return true;
+        }
+        if (stamps[way] < stamps[victim]) {
+            victim = way;  // Remember the least recently used (or an invalid) way
+        }
+    }
+    cache_misses++;
+    tags[victim] = line;
+    stamps[victim] = cache_clock;
+    return false;
+}
+
+// Structure holding the access history of one load or store instruction
+typedef struct {
+    unsigned int instruction;          // Instruction word, expanded if compressed (0 if never executed)
+    unsigned long long accesses;       // Number of executions
+    unsigned long long misses;         // Cache misses caused by this site
+    unsigned long long stride_hits;    // Accesses whose stride matched the previous one
+    unsigned long long covered_misses; // Misses taken while the stride was confirmed
+    unsigned long long interval_sum;   // Instructions retired between successive accesses
+    unsigned long long last_instret;   // cpu.instret at the previous access
+    unsigned int last_address;         // Effective address of the previous access
+    int stride;                        // Last observed stride in bytes
+    int confidence;                    // Number of consecutive repeats of the stride
+} StrideSite;
+
+static StrideSite *stride_sites = NULL;  // One entry per 2-byte instruction slot of the program
+static unsigned int stride_site_count = 0;
+
+#define STRIDE_CONFIRMED 2      // Repeats needed before a stride is considered stable
+#define STRIDE_MIN_ACCESSES 8   // Sites executed fewer times are not reported
+
+/*
+ * Sets the parameters of the data cache model used by the stride analysis.
+ * Must be called before stride_init.
+ */
+void stride_configure(unsigned int line_size, unsigned int sets, unsigned int ways, unsigned int miss_latency) {
+    cache_line_size = line_size;
+    cache_sets = sets;
+    cache_ways = ways;
+    cache_miss_latency = miss_latency;
+}
+
+// Allocates the site table and the cache model for the loaded program
+void stride_init(void) {
+    stride_site_count = program_size / 2;
+    stride_sites = calloc(stride_site_count + 1, sizeof(StrideSite));
+    cache_tags = calloc(cache_sets * cache_ways, sizeof(unsigned int));
+    cache_stamps = calloc(cache_sets * cache_ways, sizeof(unsigned long long));
+    if (!stride_sites || !cache_tags || !cache_stamps) {
+        perror("Error allocating stride analysis tables");
+        exit(1);
+    }
+}
+
+/*
+ * Updates the stride history of the load/store site that retired.
+ *
+ * @param retired: The retired instruction (ignored unless it accessed memory).
+ */
+void stride_record(const Retired *retired) {
+    if (!retired->is_load && !retired->is_store) return;
+    if (retired->pc / 2 >= stride_site_count) return;
+
+    StrideSite *site = &stride_sites[retired->pc / 2];
+    unsigned int address = retired->mem_address;
+
+    if (site->accesses > 0) {
+        int delta = (int)(address - site->last_address);
+        site->interval_sum += cpu.instret - site->last_instret;
+        if (delta == site->stride) {
+            site->stride_hits++;
+            if (site->confidence < STRIDE_CONFIRMED) site->confidence++;
+        } else {
+            site->stride = delta;
+            site->confidence = 0;
+        }
+    }
+    if (!cache_access(address)) {
+        site->misses++;
+        // A prefetcher trained on a confirmed non-zero stride would have fetched this line
+        if (site->confidence >= STRIDE_CONFIRMED && site->stride != 0) {
+            site->covered_misses++;
+        }
+    }
+    site->instruction = retired->decoded;
+    site->accesses++;
+    site->last_address = address;
+    site->last_instret = cpu.instret;
+}
+
+// Returns the mnemonic of a load or store instruction word
+static const char *memory_mnemonic(unsigned int instruction) {
+    static const char *loads[8] = { "lb", "lh", "lw", "?", "lbu", "lhu", "?", "?" };
+    static const char *stores[8] = { "sb", "sh", "sw", "?", "?", "?", "?", "?" };
+    unsigned int funct3 = (instruction >> 12) & 0x7;
+    return ((instruction & 0x7F) == 0b0100011) ? stores[funct3] : loads[funct3];
+}
+
+// Orders candidate sites by the number of misses a prefetch would save, largest first
+static int compare_sites(const void *left, const void *right) {
+    const StrideSite *a = *(const StrideSite * const *)left;
+    const StrideSite *b = *(const StrideSite * const *)right;
+    if (a->covered_misses != b->covered_misses) return (a->covered_misses < b->covered_misses) ? 1 : -1;
+    return (a < b) ? -1 : (a > b);
+}
+
+/*
+ * Prints the prefetch candidates: sites with a regular non-zero stride, the
+ * prefetch distance needed to hide the miss latency and the misses it would save.
+ *
+ * @param output_file: The file the report is written to.
+ */
+void stride_report(FILE *output_file) {
+    StrideSite **candidates = malloc((stride_site_count + 1) * sizeof(StrideSite *));
+    unsigned int candidate_count = 0;
+    unsigned long long saved_misses = 0;
+
+    for (unsigned int i = 0; i < stride_site_count; i++) {
+        StrideSite *site = &stride_sites[i];
+        if (site->accesses < STRIDE_MIN_ACCESSES || site->stride == 0) continue;
+        // At least half of the accesses must follow the stride to be worth a prefetch
+        if (2 * site->stride_hits < site->accesses - 1) continue;
+        candidates[candidate_count++] = site;
+        saved_misses += site->covered_misses;
+    }
+    qsort(candidates, candidate_count, sizeof(StrideSite *), compare_sites);
+
+    fprintf(output_file, "Stride analysis: %llu accesses, %llu misses (%.2f%%), %u-byte lines, %u sets x %u ways, %u-cycle miss latency\n",
+            cache_accesses, cache_misses, cache_accesses ? 100.0 * cache_misses / cache_accesses : 0.0,
+            cache_line_size, cache_sets, cache_ways, cache_miss_latency);
+    fprintf(output_file, "%-16s %-4s %8s %9s %10s %9s %12s %8s %10s\n",
+            "site", "op", "stride", "regular", "accesses", "interval", "distance", "misses", "saved");
+    for (unsigned int i = 0; i < candidate_count; i++) {
+        StrideSite *site = candidates[i];
+        unsigned int pc = (unsigned int)(site - stride_sites) * 2;
+        double interval = (double)site->interval_sum / (site->accesses - 1);
+        // Iterations ahead needed so the prefetched line arrives before the access
+        unsigned int iterations = (unsigned int)((cache_miss_latency + interval - 1) / interval);
+        if (iterations == 0) iterations = 1;
+        fprintf(output_file, "%-16s %-4s %8d %8.1f%% %10llu %9.1f %4u (%+5d) %8llu %10llu\n",
+                format_address(pc), memory_mnemonic(site->instruction), site->stride,
+                100.0 * site->stride_hits / (site->accesses - 1), site->accesses, interval,
+                iterations, (int)iterations * site->stride, site->misses, site->covered_misses);
+    }
+    fprintf(output_file, "%u prefetch candidates, projected miss savings: %llu of %llu misses\n",
+            candidate_count, saved_misses, cache_misses);
+    free(candidates);
+}
+
+/*
+ * Reuse-distance profiling. The reuse distance of an access is the number of
+ * distinct cache lines touched since the previous access to the same line, so a
+ * fully associative LRU cache of C lines hits exactly the accesses with a distance
+ * below C, whatever the cache size. The last access time of every line is kept in
+ * a treap ordered by time and augmented with subtree sizes (an order-statistic
+ * tree): the distance is the number of nodes with a later time, found in O(log n).
+ */
+#define REUSE_BUCKETS 33  // Bucket 0 holds distance 0, bucket k holds [2^(k-1), 2^k)
+
+typedef struct {
+    unsigned long long time;  // Last access time of a line (the key)
+    unsigned int priority;    // Random heap priority keeping the tree balanced
+    unsigned int size;        // Number of nodes in this subtree
+    int left, right;          // Children (0 is the empty tree)
+} TreapNode;
+
+// Structure holding one line of the last-access hash table
+typedef struct {
+    unsigned int line;          // Cache line number (address / line size)
+    unsigned int window;        // Last working-set window the line was counted in, plus one
+    unsigned long long time;    // Last access time, 0 marks an empty slot
+} LineEntry;
+
+// Structure holding the reuse-distance histogram of the whole program or of one label region
+typedef struct {
+    unsigned long long buckets[REUSE_BUCKETS];
+    unsigned long long cold;      // First accesses to a line (infinite distance)
+    unsigned long long accesses;
+} ReuseHistogram;
+
+static unsigned int reuse_line_size = 64;         // Granularity of the profile in bytes
+static unsigned long long reuse_window = 100000;  // Working-set window in retired instructions
+static unsigned long long reuse_clock = 0;        // Time of the latest access
+
+static TreapNode *treap_nodes = NULL;   // Node pool, node 0 is the empty tree
+static int treap_capacity = 0;
+static int treap_free = 0;              // Head of the list of released nodes
+static int treap_used = 1;              // Nodes handed out from the pool so far
+static int treap_root = 0;
+static unsigned int treap_seed = 2463534242u;
+
+static LineEntry *line_table = NULL;    // Open-addressing hash table of accessed lines
+static unsigned int line_capacity = 0;  // Always a power of two
+static unsigned int line_count = 0;
+
+static ReuseHistogram reuse_total;                 // Histogram of all accesses
+static ReuseHistogram *reuse_regions = NULL;       // Histogram of each label region (index 0: no label)
+
+static unsigned int *window_lines = NULL;          // Distinct lines touched in each finished window
+static unsigned int window_count = 0;
+static unsigned int window_capacity = 0;
+static unsigned int window_current = 0;            // Index of the window being filled
+static unsigned int window_distinct = 0;           // Distinct lines touched so far in that window
+
+// Returns a pseudo-random treap priority (xorshift32)
+static unsigned int treap_random(void) {
+    treap_seed ^= treap_seed << 13;
+    treap_seed ^= treap_seed >> 17;
+    treap_seed ^= treap_seed << 5;
+    return treap_seed;
+}
+
+// Recomputes the subtree size of a node from its children
+static void treap_update(int node) {
+    treap_nodes[node].size = 1 + treap_nodes[treap_nodes[node].left].size + treap_nodes[treap_nodes[node].right].size;
+}
+
+// Joins two treaps where every key of 'left' is smaller than every key of 'right'
+static int treap_merge(int left, int right) {
+    if (left == 0) return right;
+    if (right == 0) return left;
+    if (treap_nodes[left].priority > treap_nodes[right].priority) {
+        treap_nodes[left].right = treap_merge(treap_nodes[left].right, right);
+        treap_update(left);
+        return left;
+    }
+    treap_nodes[right].left = treap_merge(left, treap_nodes[right].left);
+    treap_update(right);
+    return right;
+}
+
+// Splits a treap into keys below 'time' (*left) and keys at or above it (*right)
+static void treap_split(int node, unsigned long long time, int *left, int *right) {
+    if (node == 0) {
+        *left = *right = 0;
+    } else if (treap_nodes[node].time < time) {
+        treap_split(treap_nodes[node].right, time, &treap_nodes[node].right, right);
+        treap_update(node);
+        *left = node;
+    } else {
+        treap_split(treap_nodes[node].left, time, left, &treap_nodes[node].left);
+        treap_update(node);
+        *right = node;
+    }
+}
+
+// Inserts a time that is later than every time already in the tree
+static void treap_insert_latest(unsigned long long time) {
+    int node = treap_free;
+    if (node != 0) {
+        treap_free = treap_nodes[node].left;
+    } else {
+        if (treap_used >= treap_capacity) {
+            treap_capacity = treap_capacity ? 2 * treap_capacity : 1024;
+            treap_nodes = realloc(treap_nodes, treap_capacity * sizeof(TreapNode));
+            if (!treap_nodes) {
+                perror("Error allocating reuse-distance tree");
+                exit(1);
+            }
+            memset(&treap_nodes[0], 0, sizeof(TreapNode));
+        }
+        node = treap_used++;
+    }
+    treap_nodes[node].time = time;
+    treap_nodes[node].priority = treap_random();
+    treap_nodes[node].size = 1;
+    treap_nodes[node].left = treap_nodes[node].right = 0;
+    treap_root = treap_merge(treap_root, node);
+}
+
+// Removes a time from the tree and returns its node to the free list
+static void treap_remove(unsigned long long time) {
+    int before, rest, match, after;
+    treap_split(treap_root, time, &before, &rest);
+    treap_split(rest, time + 1, &match, &after);
+    if (match != 0) {
+        treap_nodes[match].left = treap_free;
+        treap_free = match;
+    }
+    treap_root = treap_merge(before, after);
+}
+
+// Counts the times in the tree that are later than 'time'
+static unsigned long long treap_count_after(unsigned long long time) {
+    unsigned long long count = 0;
+    int node = treap_root;
+    while (node != 0) {
+        if (treap_nodes[node].time > time) {
+            count += 1 + treap_nodes[treap_nodes[node].right].size;
+            node = treap_nodes[node].left;
+        } else {
+            node = treap_nodes[node].right;
+        }
+    }
+    return count;
+}
+
+// Finds the hash table slot of a line, or the empty slot where it would go
+static LineEntry *line_lookup(unsigned int line) {
+    unsigned int index = (line * 2654435761u) & (line_capacity - 1);
+    while (line_table[index].time != 0 && line_table[index].line != line) {
+        index = (index + 1) & (line_capacity - 1);
+    }
+    return &line_table[index];
+}
+
+// Doubles the hash table and re-inserts every line
+static void line_grow(void) {
+    LineEntry *old_table = line_table;
+    unsigned int old_capacity = line_capacity;
+    line_capacity = old_capacity ? 2 * old_capacity : 4096;
+    line_table = calloc(line_capacity, sizeof(LineEntry));
+    if (!line_table) {
+        perror("Error allocating reuse-distance table");
+        exit(1);
+    }
+    for (unsigned int i = 0; i < old_capacity; i++) {
+        if (old_table[i].time != 0) *line_lookup(old_table[i].line) = old_table[i];
+    }
+    free(old_table);
+}
+
+// Returns the histogram bucket of a finite reuse distance
+static int reuse_bucket(unsigned long long distance) {
+    int bucket = 0;
+    while (distance != 0 && bucket < REUSE_BUCKETS - 1) {
+        distance >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// Closes working-set windows up to the one containing the current instruction
+static void window_advance(void) {
+    unsigned int window = (unsigned int)(cpu.instret / reuse_window);
+    while (window_current < window) {
+        if (window_count == window_capacity) {
+            window_capacity = window_capacity ? 2 * window_capacity : 256;
+            window_lines = realloc(window_lines, window_capacity * sizeof(unsigned int));
+            if (!window_lines) {
+                perror("Error allocating working-set windows");
+                exit(1);
+            }
+        }
+        window_lines[window_count++] = window_distinct;
+        window_distinct = 0;
+        window_current++;
+    }
+}
+
+/*
+ * Sets the granularity of the reuse-distance profile and the length of the
+ * working-set windows. Must be called before reuse_init.
+ */
+void reuse_configure(unsigned int line_size, unsigned long long window) {
+    reuse_line_size = line_size;
+    reuse_window = window;
+}
+
+// Allocates the per-region histograms and the line table
+void reuse_init(void) {
+    reuse_regions = calloc(symbol_count + 1, sizeof(ReuseHistogram));
+    if (!reuse_regions) {
+        perror("Error allocating reuse-distance histograms");
+        exit(1);
+    }
+    line_grow();
+}
+
+/*
+ * Computes the reuse distance of a data access and updates the histograms and
+ * the working set of the current window.
+ *
+ * @param retired: The retired instruction (ignored unless it accessed memory).
+ */
+void reuse_record(const Retired *retired) {
+    if (!retired->is_load && !retired->is_store) return;
+
+    unsigned int line = retired->mem_address / reuse_line_size;
+    ReuseHistogram *region = &reuse_regions[find_symbol(retired->pc) + 1];
+    LineEntry *entry = line_lookup(line);
+
+    window_advance();
+    reuse_clock++;
+    reuse_total.accesses++;
+    region->accesses++;
+    if (entry->time == 0) {
+        // First access to the line: cold, the distance is infinite
+        reuse_total.cold++;
+        region->cold++;
+        entry->line = line;
+        line_count++;
+    } else {
+        int bucket = reuse_bucket(treap_count_after(entry->time));
+        reuse_total.buckets[bucket]++;
+        region->buckets[bucket]++;
+        treap_remove(entry->time);
+    }
+    entry->time = reuse_clock;
+    treap_insert_latest(reuse_clock);
+    if (entry->window != window_current + 1) {
+        entry->window = window_current + 1;
+        window_distinct++;
+    }
+    if (2 * line_count > line_capacity) line_grow();
+}
+
+// Returns the largest distance of a bucket (the histogram resolution)
+static unsigned long long bucket_limit(int bucket) {
+    return bucket == 0 ? 0 : (1ULL << bucket) - 1;
+}
+
+// Returns the distance below which the given fraction of the reuses of a histogram fall
+static unsigned long long reuse_percentile(const ReuseHistogram *histogram, double fraction) {
+    unsigned long long reuses = histogram->accesses - histogram->cold;
+    unsigned long long seen = 0;
+    for (int bucket = 0; bucket < REUSE_BUCKETS; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen > 0 && seen >= fraction * reuses) return bucket_limit(bucket);
+    }
+    return 0;
+}
+
+/*
+ * Prints the global reuse-distance histogram with the hit rate of a fully
+ * associative LRU cache of each size, the per-region distance percentiles and the
+ * working set of every window.
+ *
+ * @param output_file: The file the report is written to.
+ */
+void reuse_report(FILE *output_file) {
+    unsigned long long cumulative = 0;
+    int last_bucket = 0;
+
+    for (int bucket = 0; bucket < REUSE_BUCKETS; bucket++) {
+        if (reuse_total.buckets[bucket] != 0) last_bucket = bucket;
+    }
+    fprintf(output_file, "Reuse distance: %llu accesses, %u distinct %u-byte lines (%llu bytes)\n",
+            reuse_total.accesses, line_count, reuse_line_size, (unsigned long long)line_count * reuse_line_size);
+    fprintf(output_file, "%-24s %12s %8s %12s %14s\n", "distance (lines)", "accesses", "percent", "LRU hits", "cache bytes");
+    for (int bucket = 0; bucket <= last_bucket && reuse_total.accesses != 0; bucket++) {
+        char range[48];
+        if (bucket <= 1) {
+            snprintf(range, sizeof(range), "%llu", bucket_limit(bucket));
+        } else {
+            snprintf(range, sizeof(range), "%llu-%llu", bucket_limit(bucket - 1) + 1, bucket_limit(bucket));
+        }
+        cumulative += reuse_total.buckets[bucket];
+        // Every access counted so far hits in a fully associative LRU cache one line larger than the range
+        fprintf(output_file, "%-24s %12llu %7.2f%% %11.2f%% %14llu\n", range, reuse_total.buckets[bucket],
+                100.0 * reuse_total.buckets[bucket] / reuse_total.accesses, 100.0 * cumulative / reuse_total.accesses,
+                (bucket_limit(bucket) + 1) * reuse_line_size);
+    }
+    fprintf(output_file, "%-24s %12llu %7.2f%%\n", "cold", reuse_total.cold,
+            reuse_total.accesses ? 100.0 * reuse_total.cold / reuse_total.accesses : 0.0);
+
+    fprintf(output_file, "\nReuse distance by label region (percentiles in lines):\n");
+    fprintf(output_file, "%-24s %12s %10s %10s %10s %10s\n", "region", "accesses", "cold", "p50", "p90", "p99");
+    for (int i = 0; i <= symbol_count; i++) {
+        ReuseHistogram *region = &reuse_regions[i];
+        if (region->accesses == 0) continue;
+        fprintf(output_file, "%-24s %12llu %10llu %10llu %10llu %10llu\n", i == 0 ? "(no label)" : symbols[i - 1].name,
+                region->accesses, region->cold, reuse_percentile(region, 0.5),
+                reuse_percentile(region, 0.9), reuse_percentile(region, 0.99));
+    }
+
+    // Close the window that was being filled when the simulation stopped
+    unsigned int total_windows = window_count + (window_distinct != 0);
+    unsigned int smallest = 0, largest = 0;
+    unsigned long long sum = 0;
+    for (unsigned int i = 0; i < total_windows; i++) {
+        unsigned int lines = (i < window_count) ? window_lines[i] : window_distinct;
+        if (i == 0 || lines < smallest) smallest = lines;
+        if (lines > largest) largest = lines;
+        sum += lines;
+    }
+    fprintf(output_file, "\nWorking set per %llu-instruction window: min %u, avg %.1f, max %u lines (max %llu bytes)\n",
+            reuse_window, smallest, total_windows ? (double)sum / total_windows : 0.0, largest,
+            (unsigned long long)largest * reuse_line_size);
+    for (unsigned int i = 0; i < total_windows; i++) {
+        unsigned int lines = (i < window_count) ? window_lines[i] : window_distinct;
+        fprintf(output_file, "  [%llu, %llu) %u lines %llu bytes\n", i * reuse_window, (i + 1) * reuse_window,
+                lines, (unsigned long long)lines * reuse_line_size);
+    }
+}
+
+/*
+ * Roofline report. Every retired instruction adds to counters kept per
+ * instruction address. Taken backward branches and jumps define loops from their
+ * target (the loop head label) to the branch itself. When the simulation stops, the
+ * counters of each innermost loop are summed to get its arithmetic intensity, which
+ * is placed against the configured peak compute rate and memory bandwidth.
+ */
+
+// Structure holding the counters of one instruction address
+typedef struct {
+    unsigned long long executions;    // Times the instruction retired
+    unsigned long long bytes_loaded;  // Bytes read by the instruction
+    unsigned long long bytes_stored;  // Bytes written by the instruction
+} RooflineCounter;
+
+// Structure describing one loop found from a backward branch
+typedef struct {
+    unsigned int head;             // Target of the backward branch (first instruction of the loop)
+    unsigned int tail;             // Address of the backward branch
+} Loop;
+
+static RooflineCounter *roofline_counters = NULL;  // One entry per 2-byte instruction slot of the program
+static unsigned int roofline_counter_count = 0;
+static bool *roofline_arithmetic = NULL;           // True for instructions counted as compute
+static Loop *loops = NULL;
+static int loop_count = 0;
+static int loop_capacity = 0;
+static double peak_ops = 1.0;        // Arithmetic instructions per cycle the machine can retire
+static double peak_bandwidth = 4.0;  // Bytes per cycle the memory system can deliver
+
+// Sets the machine peaks the loops are compared against. Must be called before roofline_init.
+void roofline_configure(double ops_per_cycle, double bytes_per_cycle) {
+    peak_ops = ops_per_cycle;
+    peak_bandwidth = bytes_per_cycle;
+}
+
+// Allocates the per-instruction counters for the loaded program
+void roofline_init(void) {
+    roofline_counter_count = program_size / 2;
+    roofline_counters = calloc(roofline_counter_count + 1, sizeof(RooflineCounter));
+    roofline_arithmetic = calloc(roofline_counter_count + 1, sizeof(bool));
+    if (!roofline_counters || !roofline_arithmetic) {
+        perror("Error allocating roofline counters");
+        exit(1);
+    }
+}
+
+/*
+ * Counts a retired instruction and records the loop it closes, if any.
+ *
+ * @param retired: The retired instruction.
+ */
+void roofline_record(const Retired *retired) {
+    unsigned int index = retired->pc / 2;
+    unsigned int opcode = retired->decoded & 0x7F;
+    if (index >= roofline_counter_count) return;
+
+    RooflineCounter *counter = &roofline_counters[index];
+    counter->executions++;
+    if (retired->is_load) counter->bytes_loaded += retired->mem_size;
+    if (retired->is_store) counter->bytes_stored += retired->mem_size;
+    // Register-register and register-immediate ALU operations are the compute work
+    roofline_arithmetic[index] = (opcode == 0b0110011 || opcode == 0b0010011);
+
+    // A taken branch or jump to an earlier address closes a loop (a jump to itself ends the program)
+    bool transfers = (opcode == 0b1100011 || opcode == 0b1101111);
+    if (transfers && retired->next_pc < retired->pc) {
+        for (int i = 0; i < loop_count; i++) {
+            if (loops[i].head == retired->next_pc && loops[i].tail == retired->pc) return;
+        }
+        if (loop_count == loop_capacity) {
+            loop_capacity = loop_capacity ? 2 * loop_capacity : 16;
+            loops = realloc(loops, loop_capacity * sizeof(Loop));
+            if (!loops) {
+                perror("Error allocating loop table");
+                exit(1);
+            }
+        }
+        loops[loop_count].head = retired->next_pc;
+        loops[loop_count].tail = retired->pc;
+        loop_count++;
+    }
+}
+
+// Returns true if another detected loop lies inside loop 'outer'
+static bool contains_loop(int outer) {
+    for (int i = 0; i < loop_count; i++) {
+        if (i != outer && loops[i].head >= loops[outer].head && loops[i].tail <= loops[outer].tail) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Prints, for every innermost loop, its instruction and arithmetic counts, the
+ * bytes it moved, its arithmetic intensity and where it sits on the roofline.
+ *
+ * @param output_file: The file the report is written to.
+ */
+void roofline_report(FILE *output_file) {
+    double ridge = peak_ops / peak_bandwidth;
+
+    fprintf(output_file, "Roofline: peak %.2f ops/cycle, %.2f bytes/cycle, ridge point %.3f ops/byte\n",
+            peak_ops, peak_bandwidth, ridge);
+    fprintf(output_file, "%-20s %10s %12s %12s %12s %12s %10s %12s %8s\n", "loop", "iterations", "instructions",
+            "arithmetic", "loaded", "stored", "ops/byte", "ops/cycle", "bound");
+    for (int i = 0; i < loop_count; i++) {
+        if (contains_loop(i)) continue;  // Only innermost loops are reported
+
+        unsigned long long instructions = 0, arithmetic = 0, loaded = 0, stored = 0;
+        for (unsigned int pc = loops[i].head; pc <= loops[i].tail; pc += 2) {
+            RooflineCounter *counter = &roofline_counters[pc / 2];
+            instructions += counter->executions;
+            if (roofline_arithmetic[pc / 2]) arithmetic += counter->executions;
+            loaded += counter->bytes_loaded;
+            stored += counter->bytes_stored;
+        }
+
+        unsigned long long bytes = loaded + stored;
+        char intensity[32];
+        double attainable;
+        if (bytes == 0) {
+            snprintf(intensity, sizeof(intensity), "inf");
+            attainable = peak_ops;
+        } else {
+            double ops_per_byte = (double)arithmetic / bytes;
+            snprintf(intensity, sizeof(intensity), "%.3f", ops_per_byte);
+            attainable = ops_per_byte * peak_bandwidth;
+            if (attainable > peak_ops) attainable = peak_ops;
+        }
+        bool memory_bound = (bytes != 0 && (double)arithmetic / bytes < ridge);
+        fprintf(output_file, "%-20s %10llu %12llu %12llu %12llu %12llu %10s %12.3f %8s\n",
+                format_address(loops[i].head), roofline_counters[loops[i].tail / 2].executions, instructions, arithmetic,
+                loaded, stored, intensity, attainable, memory_bound ? "memory" : "compute");
+    }
+}
+
+/*
+ * Execution profile for the profile-guided layout of the assembler (--profile). It
+ * counts the instructions retired in every label region of the symbol map, and the
+ * calls (jal or jalr writing a link register) from one region to another, and how
+ * often every conditional branch was taken or fell through. A branch is named by its
+ * region and its position among the conditional branches of the region, with its
+ * target as a label (or label+offset), so the assembler can find it in the source.
+ * The profile is a text file read back by the assembler:
+ *   <label> <instructions>
+ *   call <caller label> <callee label> <count>
+ *   branch <label> <n> <target> <taken> <not taken>
+ */
+
+// Structure holding the number of calls between two label regions
+typedef struct {
+    int caller;                 // Symbol index of the calling region (0: no label)
+    int callee;                 // Symbol index of the called region
+    unsigned long long count;
+} ProfileCall;
+
+// Structure holding the outcomes of the conditional branch at one address
+typedef struct {
+    unsigned long long taken;
+    unsigned long long fall;
+    unsigned int target;        // Address reached when the branch is taken
+} ProfileBranch;
+
+static unsigned long long *profile_regions = NULL;  // Instructions of each label region (index 0: no label)
+static ProfileBranch *profile_branches = NULL;      // One entry per 2-byte instruction slot of the program
+static unsigned int profile_branch_count = 0;
+static ProfileCall *profile_calls = NULL;
+static int profile_call_count = 0;
+static int profile_call_capacity = 0;
+static int profile_last_call = 0;  // Entry hit by the previous call, checked first
+
+// Allocates the counters of every label region
+void profile_init(void) {
+    profile_regions = calloc(symbol_count + 1, sizeof(unsigned long long));
+    profile_branch_count = program_size / 2;
+    profile_branches = calloc(profile_branch_count + 1, sizeof(ProfileBranch));
+    if (!profile_regions || !profile_branches) {
+        perror("Error allocating execution profile");
+        exit(1);
+    }
+}
+
+/*
+ * Counts a retired instruction in its label region, and the branch outcome or the
+ * call it makes, if any.
+ *
+ * @param retired: The retired instruction.
+ */
+void profile_record(const Retired *retired) {
+    int region = find_symbol(retired->pc) + 1;
+    profile_regions[region]++;
+
+    unsigned int opcode = retired->decoded & 0x7F;
+    unsigned int decoded = retired->decoded;
+    if (opcode == 0b1100011 && retired->pc / 2 < profile_branch_count) {
+        ProfileBranch *branch = &profile_branches[retired->pc / 2];
+        unsigned int offset = ((decoded >> 31) & 1) << 12 | ((decoded >> 7) & 1) << 11 |
+                              ((decoded >> 25) & 0x3F) << 5 | ((decoded >> 8) & 0xF) << 1;
+        branch->target = retired->pc + ((offset ^ 0x1000) - 0x1000);  // Sign-extended 13-bit offset
+        if (retired->next_pc == branch->target) {
+            branch->taken++;
+        } else {
+            branch->fall++;
+        }
+        return;
+    }
+    if ((opcode != 0b1101111 && opcode != 0b1100111) || retired->rd == 0) return;
+    int callee = find_symbol(retired->next_pc) + 1;
+    if (profile_last_call < profile_call_count && profile_calls[profile_last_call].caller == region &&
+        profile_calls[profile_last_call].callee == callee) {
+        profile_calls[profile_last_call].count++;
+        return;
+    }
+    for (int i = 0; i < profile_call_count; i++) {
+        if (profile_calls[i].caller == region && profile_calls[i].callee == callee) {
+            profile_calls[i].count++;
+            profile_last_call = i;
+            return;
+        }
+    }
+    if (profile_call_count == profile_call_capacity) {
+        profile_call_capacity = profile_call_capacity ? 2 * profile_call_capacity : 64;
+        profile_calls = realloc(profile_calls, profile_call_capacity * sizeof(ProfileCall));
+        if (!profile_calls) {
+            perror("Error allocating execution profile");
+            exit(1);
+        }
+    }
+    profile_calls[profile_call_count].caller = region;
+    profile_calls[profile_call_count].callee = callee;
+    profile_calls[profile_call_count].count = 1;
+    profile_last_call = profile_call_count++;
+}
+
+// Returns true if the instruction at an address is a conditional branch (beq ... bgeu, c.beqz, c.bnez)
+static bool is_conditional_branch(unsigned int address) {
+    unsigned int parcel = memory_load(address, 2);
+    if ((parcel & 0x3) == 0x3) return (memory_load(address, 4) & 0x7F) == 0b1100011;
+    return (parcel & 0x3) == 0x1 && ((parcel >> 13) & 0x7) >= 0b110;
+}
+
+/*
+ * Writes the profile in the format read by the assembler. Instructions and calls
+ * outside every label region are left out, the assembler could not place them.
+ *
+ * @param profile_file: The file the profile is written to.
+ */
+void profile_report(FILE *profile_file) {
+    fprintf(profile_file, "# Execution profile: instructions per label region, then calls between regions\n");
+    for (int i = 1; i <= symbol_count; i++) {
+        if (profile_regions[i] != 0) fprintf(profile_file, "%s %llu\n", symbols[i - 1].name, profile_regions[i]);
+    }
+    for (int i = 0; i < profile_call_count; i++) {
+        ProfileCall *call = &profile_calls[i];
+        if (call->caller == 0 || call->callee == 0) continue;
+        fprintf(profile_file, "call %s %s %llu\n", symbols[call->caller - 1].name, symbols[call->callee - 1].name,
+                call->count);
+    }
+
+    // Branches are numbered within their region, which runs up to the next label at a higher address
+    for (int i = 0; i < symbol_count; i++) {
+        if (i + 1 < symbol_count && symbols[i + 1].address == symbols[i].address) continue;  // The last alias names it
+        unsigned int end = (i + 1 < symbol_count) ? symbols[i + 1].address : program_size;
+        if (end > program_size) end = program_size;
+        int n = 0;
+        for (unsigned int pc = symbols[i].address; pc < end; pc += ((memory_load(pc, 2) & 0x3) == 0x3) ? 4 : 2) {
+            if (!is_conditional_branch(pc)) continue;
+            ProfileBranch *branch = &profile_branches[pc / 2];
+            if (branch->taken + branch->fall != 0) {
+                // format_address reuses its buffer, so the region name is printed first
+                fprintf(profile_file, "branch %s %d ", symbols[i].name, n);
+                fprintf(profile_file, "%s %llu %llu\n", format_address(branch->target), branch->taken, branch->fall);
+            }
+            n++;
+        }
+    }
+}
@@ -10,40 +10,122 @@
  * first to handle labels and second to generate the final machine code.
  */
 
+#define _POSIX_C_SOURCE 200809L  // Needed for shm_open, ftruncate and mmap with -std=c99
+
 #include "assembler.h"
+#include "image_shm.h"
+#include <errno.h>     // errno for out-of-range constants
+#include <fcntl.h>     // O_CREAT and friends for shm_open
+#include <sys/mman.h>  // shm_open and mmap
+#include <unistd.h>    // ftruncate and close
 
 // Global label table to store labels and their corresponding memory addresses
-Label labelTable[MAX_INSTRUCTIONS];
+Label *labelTable = NULL;
 int labelCount = 0;  // Keeps track of the number of labels
+static int label_capacity = 0;
+
+// Open-addressing hash of label names to label indices (-1 marks an empty slot)
+static int *label_hash = NULL;
+static unsigned int label_hash_size = 0;  // Always a power of two
+
+// FNV-1a hash of a label name
+static unsigned int hash_label(const char *label) {
+    unsigned int hash = 2166136261u;
+    while (*label) {
+        hash = (hash ^ (unsigned char)*label++) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns the hash slot holding the label, or the empty slot where it belongs
+static unsigned int find_label_slot(const char *label) {
+    unsigned int slot = hash_label(label) & (label_hash_size - 1);
+    while (label_hash[slot] >= 0 && strcmp(labelTable[label_hash[slot]].label, label) != 0) {
+        slot = (slot + 1) & (label_hash_size - 1);
+    }
+    return slot;
+}
 
 /*
- * Adds a label to the label table with its corresponding address.
+ * Adds a label to the label table, bound to the instruction that follows it.
  * This function is called during the first pass when a label is encountered.
+ * The byte address is filled in by layout_program once all sizes are known.
  * 
  * @param label: The label name to be added.
- * @param address: The memory address associated with the label.
+ * @param statement: The index of the instruction the label marks.
  */
-void add_label(const char *label, int address) {
+void add_label(const char *label, int statement) {
+    if (labelCount == label_capacity) {
+        label_capacity = label_capacity ? 2 * label_capacity : 64;
+        labelTable = realloc(labelTable, label_capacity * sizeof(Label));
+        if (!labelTable) {
+            perror("Error allocating label table");
+            exit(1);
+        }
+    }
+    // Keep the hash at most half full, rebuilding it when it grows
+    if (2 * (unsigned int)(labelCount + 1) > label_hash_size) {
+        label_hash_size = label_hash_size ? 2 * label_hash_size : 128;
+        label_hash = realloc(label_hash, label_hash_size * sizeof(int));
+        if (!label_hash) {
+            perror("Error allocating label table");
+            exit(1);
+        }
+        memset(label_hash, -1, label_hash_size * sizeof(int));
+        for (int i = 0; i < labelCount; i++) {
+            unsigned int slot = find_label_slot(labelTable[i].label);
+            if (label_hash[slot] < 0) label_hash[slot] = i;
+        }
+    }
     strcpy(labelTable[labelCount].label, label);  // Copy the label name to the label table
-    labelTable[labelCount].address = address;     // Store the corresponding address
+    labelTable[labelCount].statement = statement; // Remember the instruction it marks
+    labelTable[labelCount].offset = 0;
+    labelTable[labelCount].address = 4 * statement; // Address before any layout
+    unsigned int slot = find_label_slot(label);
+    if (label_hash[slot] < 0) label_hash[slot] = labelCount;  // The first definition wins
     labelCount++;  // Increment the label count after adding a new label
 }
 
+/*
+ * Removes labels from the label table, keeping the others in order, and rebuilds the
+ * hash. Label indices held elsewhere (statement targets) must be resolved afterwards.
+ *
+ * @param removed: One flag per label, true for the labels to remove.
+ * @return: The number of labels removed.
+ */
+int remove_labels(const bool *removed) {
+    int kept = 0;
+    for (int i = 0; i < labelCount; i++) {
+        if (!removed[i]) labelTable[kept++] = labelTable[i];
+    }
+    int count = labelCount - kept;
+    labelCount = kept;
+    if (label_hash) {
+        memset(label_hash, -1, label_hash_size * sizeof(int));
+        for (int i = 0; i < labelCount; i++) {
+            unsigned int slot = find_label_slot(labelTable[i].label);
+            if (label_hash[slot] < 0) label_hash[slot] = i;
+        }
+    }
+    return count;
+}
+
+// Returns the index of a label in the label table, or -1 if the label is not found
+int find_label(const char *label) {
+    if (labelCount == 0) return -1;
+    return label_hash[find_label_slot(label)];
+}
+
 /*
  * Searches for a label in the label table and returns its address.
  * This function is used to resolve label references during the second pass.
  *
  * @param label: The label name to search for.
- * @return: The memory address of the label, or -1 if the label is not found.
+ * @return: The byte address of the label, or -1 if the label is not found.
  */
 int find_label_address(const char *label) {
-    for (int i = 0; i < labelCount; i++) {
-        if (strcmp(labelTable[i].label, label) == 0) {
-            return labelTable[i].address;  // Return the address if the label matches
-            
-        }
-    }
-    return -1;  // Label not found, return -1
+    int index = find_label(label);
+    return (index >= 0) ? labelTable[index].address : -1;
 }
 
 /*
@@ -64,6 +146,51 @@ void remove_colon(char *str) {
 // Variables to track the number of instructions processed in two passes
 int instruction_count =  0;   // Instruction count for the first pass
 int instruction_count2 = 0;   // Instruction count for the second pass
+int current_address = 0;      // Byte address of the instruction being assembled
+int source_line = 0;          // Line number of the source line read by the first pass
+int error_count = 0;          // Errors found in the source; the run fails if there are any
+
+// Instructions recorded during the first pass, in program order
+Statement *statements = NULL;
+static int statement_capacity = 0;
+static int pending_alignment = 0;  // Alignment requested for the next instruction by a directive
+static int pending_loop_bound = 0; // Loop bound annotated for the next instruction
+int current_section = SECTION_TEXT;  // Section the next statement goes to
+
+/*
+ * Records an instruction found during the first pass.
+ *
+ * @param instruction: The instruction text (label and comment already removed).
+ * @param size: The size of the encoded instruction in bytes.
+ * @param kind: KIND_BRANCH or KIND_JUMP for instructions with a label operand, KIND_DATA for data,
+ *              KIND_OTHER otherwise.
+ */
+void add_statement(const char *instruction, int size, int kind) {
+    if (instruction_count == statement_capacity) {
+        statement_capacity = statement_capacity ? 2 * statement_capacity : 256;
+        statements = realloc(statements, statement_capacity * sizeof(Statement));
+        if (!statements) {
+            perror("Error allocating instruction list");
+            exit(1);
+        }
+    }
+    strcpy(statements[instruction_count].text, instruction);
+    statements[instruction_count].size = size;
+    statements[instruction_count].address = 0;
+    statements[instruction_count].kind = kind;
+    statements[instruction_count].form = FORM_NORMAL;
+    statements[instruction_count].target = -1;  // Resolved once every label is known
+    statements[instruction_count].align = pending_alignment;
+    statements[instruction_count].padding = 0;
+    statements[instruction_count].line = source_line;
+    statements[instruction_count].loop_bound = pending_loop_bound;
+    statements[instruction_count].section = current_section;
+    statements[instruction_count].data = -1;
+    statements[instruction_count].blob = -1;
+    pending_alignment = 0;
+    pending_loop_bound = 0;
+    instruction_count++;
+}
 
 /*
  * Converts a register name (e.g., "x1", "a0") into the corresponding register number.
@@ -147,21 +274,34 @@ int get_register_number(const char *reg) {
     return -1;  // Return -1 if the register is invalid
 }
 
+// Returns the first occurrence of c outside of a string literal ("..."), NULL if there is none
+static char *find_unquoted(const char *str, char c) {
+    bool quoted = false;
+    for (; *str; str++) {
+        if (quoted && *str == '\\' && str[1] != '\0') {
+            str++;  // Escaped character
+        } else if (*str == '"') {
+            quoted = !quoted;
+        } else if (!quoted && *str == c) {
+            return (char *)str;
+        }
+    }
+    return NULL;
+}
+
 /*
  * Replaces commas in the given instruction string with spaces.
  * This function simplifies tokenizing assembly instructions by ensuring that 
  * registers and arguments are separated by spaces instead of commas.
+ * Commas inside string literals are kept.
  *
  * @param str: The instruction string to modify.
  */
 void replaceCommas(char *str) {
-    int i = 0;
-    // Loop through the string and replace commas with spaces
-    while (str[i] != '\0') {
-        if (str[i] == ',') {
-            str[i] = ' ';  // Replace comma with a space
-        }
-        i++;
+    char *comma;
+    // Replace every comma outside of string literals with a space
+    while ((comma = find_unquoted(str, ',')) != NULL) {
+        *comma = ' ';  // Replace comma with a space
     }
 }
 void removeBracket(char *str) {
@@ -212,9 +352,55 @@ void separate_rs1(char *str) {
         i++;
     }
 }
+/*
+ * Looks for a loop bound in the comment of a source line ("# loop_bound 16",
+ * "# loop_bound: 16" or "# loop_bound=16"). The bound is recorded on the next
+ * instruction, like the .loop_bound directive. Must be called before removeComment.
+ *
+ * @param line: The source line, comment included.
+ */
+long int loop_bound_annotation(const char *line) {
+    const char *comment = find_unquoted(line, '#');
+    const char *annotation = comment ? strstr(comment, "loop_bound") : NULL;
+    if (!annotation) return 0;
+    annotation += strlen("loop_bound");
+    while (*annotation == ' ' || *annotation == '\t' || *annotation == ':' || *annotation == '=') annotation++;
+    long int bound = strtol(annotation, NULL, 0);
+    return (bound > 0) ? bound : -1;
+}
+
+void read_annotations(const char *line) {
+    long int bound = loop_bound_annotation(line);
+    if (bound > 0) {
+        pending_loop_bound = bound;
+    } else if (bound < 0) {
+        fprintf(stderr, "Invalid loop bound ignored on line %d\n", source_line);
+    }
+}
+
+/*
+ * Reads the next source line like fgets. A line that does not fit in the buffer
+ * is cut short and the rest of it skipped, so it never reads as two lines.
+ *
+ * @param line: Buffer for the line, newline included.
+ * @param size: Size of the buffer.
+ * @param file: The source file.
+ * @param complete: Set to false if the line was cut short.
+ * @return false at the end of the file.
+ */
+bool read_line(char *line, int size, FILE *file, bool *complete) {
+    if (!fgets(line, size, file)) return false;
+    *complete = true;
+    if (strchr(line, '\n') == NULL) {
+        int c;
+        while ((c = fgetc(file)) != EOF && c != '\n') *complete = false;
+    }
+    return true;
+}
+
 void removeComment(char* str) {
-    // Find the position of '#' in the string
-    char* comment = strchr(str, '#');
+    // Find the position of '#' in the string (outside of string literals)
+    char* comment = find_unquoted(str, '#');
     
     if (comment != NULL) {
         // Replace the '#' and everything after it with a null terminator
@@ -223,8 +409,8 @@ void removeComment(char* str) {
 }
 
 void splitString(char* str, char* before, char* after) {
-    // Find the position of ':' in the string
-    char* colonPos = strchr(str, ':');
+    // Find the position of ':' in the string (outside of string literals)
+    char* colonPos = find_unquoted(str, ':');
 
     if (colonPos != NULL) {
         // Copy the part before the ':'
@@ -240,14 +426,78 @@ void splitString(char* str, char* before, char* after) {
     }
 }
 
+// Structure describing the expansion of a pseudo-instruction into base instructions
+typedef struct {
+    const char *name;          // Mnemonic
+    int operands;              // Number of operands
+    int kind;                  // KIND_* of the recorded instruction
+    const char *expansion[2];  // Base instructions: $1..$3 stand for the operands, %pcrel_hi($n) and
+                               // %pcrel_lo($n) for the parts of the pc-relative offset of label $n
+    bool symbol;               // The last operand must be a label, not offset(register)
+} PseudoInstruction;
+
+// Pseudo-instructions, expanded by assemble_sequence; pass 1 takes the size from the expansion
+static const PseudoInstruction pseudo_instructions[] = {
+    { "nop",  0, KIND_OTHER,    { "addi x0 x0 0" }, false },
+    { "mv",   2, KIND_OTHER,    { "addi $1 $2 0" }, false },
+    { "not",  2, KIND_OTHER,    { "xori $1 $2 -1" }, false },
+    { "neg",  2, KIND_OTHER,    { "sub $1 x0 $2" }, false },
+    { "seqz", 2, KIND_OTHER,    { "sltiu $1 $2 1" }, false },
+    { "snez", 2, KIND_OTHER,    { "sltu $1 x0 $2" }, false },
+    { "li",   2, KIND_CONSTANT, { NULL }, false },  // Shortest lui/addi sequence, see materialize_constant
+    { "la",   2, KIND_OTHER,    { "auipc $1 %pcrel_hi($2)", "addi $1 $1 %pcrel_lo($2)" }, false },
+    { "lb",   2, KIND_OTHER,    { "auipc $1 %pcrel_hi($2)", "lb $1 %pcrel_lo($2)($1)" }, true },  // lb rd, symbol
+    { "lbu",  2, KIND_OTHER,    { "auipc $1 %pcrel_hi($2)", "lbu $1 %pcrel_lo($2)($1)" }, true },
+    { "lh",   2, KIND_OTHER,    { "auipc $1 %pcrel_hi($2)", "lh $1 %pcrel_lo($2)($1)" }, true },
+    { "lhu",  2, KIND_OTHER,    { "auipc $1 %pcrel_hi($2)", "lhu $1 %pcrel_lo($2)($1)" }, true },
+    { "lw",   2, KIND_OTHER,    { "auipc $1 %pcrel_hi($2)", "lw $1 %pcrel_lo($2)($1)" }, true },
+    { "sb",   3, KIND_OTHER,    { "auipc $3 %pcrel_hi($2)", "sb $1 %pcrel_lo($2)($3)" }, false },  // sb rs, symbol, rt
+    { "sh",   3, KIND_OTHER,    { "auipc $3 %pcrel_hi($2)", "sh $1 %pcrel_lo($2)($3)" }, false },
+    { "sw",   3, KIND_OTHER,    { "auipc $3 %pcrel_hi($2)", "sw $1 %pcrel_lo($2)($3)" }, false },
+    { "beqz", 2, KIND_BRANCH,   { "beq $1 x0 $2" }, false },
+    { "bnez", 2, KIND_BRANCH,   { "bne $1 x0 $2" }, false },
+    { "bgt",  3, KIND_BRANCH,   { "blt $2 $1 $3" }, false },
+    { "ble",  3, KIND_BRANCH,   { "bge $2 $1 $3" }, false },
+    { "bgtu", 3, KIND_BRANCH,   { "bltu $2 $1 $3" }, false },
+    { "bleu", 3, KIND_BRANCH,   { "bgeu $2 $1 $3" }, false },
+    { "j",    1, KIND_JUMP,     { "jal x0 $1" }, false },
+    { "jr",   1, KIND_OTHER,    { "jalr x0 $1 0" }, false },
+    { "ret",  0, KIND_OTHER,    { "jalr x0 ra 0" }, false },
+    { "call", 1, KIND_JUMP,     { "jal ra $1" }, false },  // auipc ra + jalr ra once relaxed out of range
+    { "tail", 1, KIND_JUMP,     { "jal x0 $1" }, false },  // auipc t1 + jalr x0 once relaxed out of range
+};
+
+// Returns the pseudo-instruction with the given mnemonic, operand count and last operand, NULL if there is none
+static const PseudoInstruction *find_pseudo(const char *name, int operands, const char *last) {
+    for (size_t p = 0; p < sizeof(pseudo_instructions) / sizeof(pseudo_instructions[0]); p++) {
+        const PseudoInstruction *pseudo = &pseudo_instructions[p];
+        if (pseudo->operands == operands && strcmp(pseudo->name, name) == 0 && (!pseudo->symbol || !strchr(last, '('))) {
+            return pseudo;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Returns the size in bytes of a pseudo-instruction's expansion. Only li depends on
+ * its operand, the constant.
+ */
+static int pseudo_size(const PseudoInstruction *pseudo, const char *value) {
+    if (pseudo->kind == KIND_CONSTANT) {
+        unsigned int codes[2];
+        return 4 * materialize_constant(0, convertToDecimal(value), codes);
+    }
+    return pseudo->expansion[1] ? 8 : 4;
+}
+
 /**
  * Perform the first pass of instruction parsing and label handling.
  * 
  * This function parses the input instruction to check for supported opcodes, 
- * counts instructions, and adds labels for future reference. It assumes the input
+ * records instructions, and adds labels for future reference. It assumes the input
  * instruction follows a specific format, typically used in assembly language.
- * During the first pass, labels are recorded, and instruction counts are incremented 
- * based on the opcode type (R-type, I-type, etc.).
+ * During the first pass, labels are bound to the next instruction, and every
+ * instruction is stored with its size based on the opcode type (R-type, I-type, etc.).
  *
  * param: instruction A string representing the current assembly instruction.
  */
@@ -255,43 +505,92 @@ void splitString(char* str, char* before, char* after) {
 
 void first_pass(char *instruction) {
     // Variables to store different parts of the instruction
-    char opcode[20], rd[20], rs1[20], rs2[20],  label[30], label2[30], temp_inst[50];
+    // Every part fits the line it comes from (data directives make for long operands)
+    char opcode[MAX_LINE_LENGTH], rd[MAX_LINE_LENGTH], rs1[MAX_LINE_LENGTH], rs2[MAX_LINE_LENGTH];
+    char label[MAX_LINE_LENGTH], label2[MAX_LINE_LENGTH], temp_inst[MAX_LINE_LENGTH];
     int count;
+    int size = 0;  // Size in bytes of the instruction, 0 if the line holds none
+    int kind = KIND_OTHER;  // Whether the instruction branches or jumps to a label
 
     // Parse the instruction, assuming a fixed format like "opcode rd, rs1, rs2"
     count = sscanf(instruction, "%s %s %s %s", opcode, rd, rs1, rs2);
     splitString(instruction, label, temp_inst);
-    if (temp_inst[0] != '\0'){
+    // Lines from included files and expansions have no newline, so a label may stand alone
+    if (temp_inst[0] != '\0' || find_unquoted(instruction, ':') != NULL){
         strcpy(instruction, temp_inst);
         count = sscanf(instruction, "%s %s %s %s", opcode, rd, rs1, rs2);
         remove_colon(label);  // Remove the colon from the label
         sscanf(label, "%s", label2);
         //printf("%s\n", label2);
 
-        add_label(label2, instruction_count + 1);  // Add label to the table
+        add_label(label2, instruction_count);  // The label marks the next instruction
+    }
+
+    // Alignment directives pad the next instruction to a power-of-two boundary:
+    // .align and .p2align take the exponent, .balign the number of bytes
+    if (count >= 2 && (strcmp(opcode, ".align") == 0 || strcmp(opcode, ".p2align") == 0 || strcmp(opcode, ".balign") == 0)) {
+        long int value = convertToDecimal(rd);
+        long int alignment = (strcmp(opcode, ".balign") == 0) ? value : ((value >= 0 && value < 31) ? 1L << value : 0);
+        if (alignment <= 0 || (alignment & (alignment - 1)) != 0 || alignment > (1L << 30)) {
+            fprintf(stderr, "Invalid alignment ignored: %s %s\n", opcode, rd);
+        } else if (alignment > pending_alignment) {
+            pending_alignment = alignment;
+        }
+        return;
+    }
+    // .loop_bound n: the loop headed (or closed) by the next instruction runs at most n times
+    if (count >= 2 && strcmp(opcode, ".loop_bound") == 0) {
+        long int bound = convertToDecimal(rd);
+        if (bound > 0) {
+            pending_loop_bound = bound;
+        } else {
+            fprintf(stderr, "Invalid loop bound ignored: %s %s\n", opcode, rd);
+        }
+        return;
+    }
+    // Sections and data
+    if (data_directive(instruction)) return;
+
+    // Pseudo-instructions take the size and kind of their expansion
+    const char *last = (count == 2) ? rd : (count == 3) ? rs1 : rs2;  // Last operand
+    const PseudoInstruction *pseudo = (count >= 1) ? find_pseudo(opcode, count - 1, last) : NULL;
+    long int constant;
+    if (pseudo && pseudo->kind == KIND_CONSTANT && !parse_constant(rs1, &constant)) {
+        fprintf(stderr, "Invalid constant %s at line %d: not a 32-bit integer\n", rs1, source_line);
+        error_count++;
+        return;
+    }
+    if (pseudo) {
+        add_statement(instruction, pseudo_size(pseudo, rs1), pseudo->kind);
+        return;
     }
 
     
     // Check if it's an R-type instruction (with 4 fields parsed)
     if (count == 4) {
-        // Handle specific R-type opcodes and increment the instruction count
+        // Handle specific R-type opcodes and record their size
         if (strcmp(opcode, "add") == 0 || strcmp(opcode, "sub") == 0 || strcmp(opcode, "or") == 0 ||
             strcmp(opcode, "and") == 0 || strcmp(opcode, "xor") == 0 || strcmp(opcode, "sll") == 0 ||
             strcmp(opcode, "srl") == 0 || strcmp(opcode, "sra") == 0 || strcmp(opcode, "slt") == 0 ||
             strcmp(opcode, "sltu") == 0 ) {
-            instruction_count++;  // Increment count for R-type instructions
+            size = 4;  // R-type instructions take one word
         }
         // Handle I-type instructions like "addi" or shifts with immediate values
         else if (strcmp(opcode, "addi") == 0 || strcmp(opcode, "slli") == 0 || strcmp(opcode, "slti") == 0 ||
                  strcmp(opcode, "sltiu") == 0 || strcmp(opcode, "xori") == 0 || strcmp(opcode, "srli") == 0 ||
                  strcmp(opcode, "srai") == 0 || strcmp(opcode, "ori") == 0 || strcmp(opcode, "andi") == 0) {
-            instruction_count++;
+            size = 4;
+        }
+        // Handle special instructions like JALR
+        else if (strcmp(opcode, "jalr") == 0) {
+            size = 4;
         }
-        // Handle special instructions like JALR, branch instructions, etc.
-        else if (strcmp(opcode, "jalr") == 0 || strcmp(opcode, "beq") == 0 || strcmp(opcode, "bne") == 0 ||
+        // Branch instructions may be relaxed when their label is out of range
+        else if (strcmp(opcode, "beq") == 0 || strcmp(opcode, "bne") == 0 ||
                  strcmp(opcode, "blt") == 0 || strcmp(opcode, "bge") == 0 || strcmp(opcode, "bltu") == 0 ||
-                 strcmp(opcode, "bgeu") == 0 || strcmp(opcode, "bgt") == 0 || strcmp(opcode, "ble") == 0) {
-            instruction_count++;
+                 strcmp(opcode, "bgeu") == 0) {
+            size = 4;
+            kind = KIND_BRANCH;
         }
     }
     // Check if it's a memory instruction with 3 fields parsed (e.g., "lw x1, 0(x2)")
@@ -299,46 +598,80 @@ void first_pass(char *instruction) {
         if (strcmp(opcode, "lb") == 0 || strcmp(opcode, "lh") == 0 || strcmp(opcode, "lw") == 0 ||
             strcmp(opcode, "lbu") == 0 || strcmp(opcode, "lhu") == 0 || strcmp(opcode, "sb") == 0 ||
             strcmp(opcode, "sh") == 0 || strcmp(opcode, "sw") == 0) {
-            instruction_count++;  // Increment count for memory operations
+            size = 4;  // Memory operations take one word
         }
         // Handle special instructions like "auipc" or "lui"
-        else if (strcmp(opcode, "auipc") == 0 || strcmp(opcode, "lui") == 0 || strcmp(opcode, "jal") == 0) {
-            instruction_count++;
+        else if (strcmp(opcode, "auipc") == 0 || strcmp(opcode, "lui") == 0) {
+            size = 4;
         }
-        else if (strcmp(opcode, "mv") == 0 || strcmp(opcode, "li") == 0) {
-            instruction_count++;
+        else if (strcmp(opcode, "jal") == 0) {
+            size = 4;
+            kind = KIND_JUMP;
         }
     }
-    //Pseudo Instructions like j and jr
-    else if (count == 2){
-        if (strcmp(opcode, "j") == 0 || strcmp(opcode, "jr") == 0){
-            instruction_count++;
-        }
-    }
-    //Pseudo Instructions like ret
-    else if (count == 1){
-        if (strcmp(opcode, "ret") ==  0){
-            instruction_count++;
-        }
+
+    // Record the instruction so the layout and the second pass can work on it
+    if (size != 0) {
+        add_statement(instruction, size, kind);
     }
-    
 }
 
 long int convertToDecimal(const char *str) {
-    // Check if the string starts with "0x" for hexadecimal numbers
-    if (strncmp(str, "0x", 2) == 0) {
-        // Convert hexadecimal string to decimal
-        return strtol(str, NULL, 16);
-    } else {
-        // Convert decimal string to decimal
-        return strtol(str, NULL, 10);
-    }
+    // Decimal, "0x" hexadecimal or "0" octal, with an optional sign (as the data directives read them)
+    return strtol(str, NULL, 0);
 }
 
+/*
+ * Reads a 32-bit constant operand, signed or unsigned.
+ *
+ * @param str: The operand.
+ * @param value: Receives the value.
+ * @return: true if the whole operand is a number between -0x80000000 and 0xFFFFFFFF.
+ */
+bool parse_constant(const char *str, long int *value) {
+    char *end;
+    errno = 0;
+    long long int number = strtoll(str, &end, 0);
+    if (end == str || *end != '\0' || errno != 0 || number < -0x80000000LL || number > 0xFFFFFFFFLL) return false;
+    *value = (long int)number;
+    return true;
+}
 
-// Function to assemble an RISC-V instruction and convert it into machine code
-unsigned int assemble_instruction(char *instruction) {
-    char opcode[20], rd[20], rs1[20], rs2[20],  label[30], temp_inst[50]; // Buffers to hold parts of the instruction
+
+/*
+ * Finds the shortest sequence loading a 32-bit constant into a register:
+ *   - addi rd, x0, value   when the value fits a signed 12-bit immediate,
+ *   - lui rd, upper        when the low 12 bits are zero,
+ *   - lui rd, upper + addi rd, rd, lower otherwise.
+ * addi sign-extends its immediate, so when bit 11 of the value is set the lower part
+ * is negative and the upper part is rounded up by one to make up for it.
+ *
+ * @param rd: The destination register number.
+ * @param value: The constant (only the low 32 bits are used).
+ * @param codes: Receives the machine code of the sequence (one or two words).
+ * @return: The number of instructions in the sequence.
+ */
+int materialize_constant(unsigned int rd, int value, unsigned int *codes) {
+    unsigned int upper = ((unsigned int)value + 0x800) & 0xFFFFF000;
+    int lower = (int)((unsigned int)value - upper);  // Always within -2048 .. 2047
+
+    if (upper == 0) {
+        codes[0] = (((unsigned int)lower & 0xFFF) << 20) | (rd << 7) | 0b0010011;  // addi rd, x0, lower
+        return 1;
+    }
+    codes[0] = upper | (rd << 7) | 0b0110111;  // lui rd, upper
+    if (lower == 0) {
+        return 1;
+    }
+    codes[1] = (((unsigned int)lower & 0xFFF) << 20) | (rd << 15) | (rd << 7) | 0b0010011;  // addi rd, rd, lower
+    return 2;
+}
+
+// Function to assemble a base RISC-V instruction and convert it into machine code
+static unsigned int assemble_base(char *instruction) {
+    // Buffers to hold parts of the instruction, each as long as the line it comes from
+    char opcode[MAX_LINE_LENGTH], rd[MAX_LINE_LENGTH], rs1[MAX_LINE_LENGTH], rs2[MAX_LINE_LENGTH];
+    char label[MAX_LINE_LENGTH], temp_inst[MAX_LINE_LENGTH];
     unsigned int machine_code = 0; // Store the final machine code (32 bits)
     int count, address;
     unsigned char rd_num, rs1_num, rs2_num; // Register numbers for rd, rs1, rs2
@@ -595,9 +928,8 @@ unsigned int assemble_instruction(char *instruction) {
             rs2_num = get_register_number(rs1);
             address = find_label_address(rs2);
             //printf("%s\n", rs2);
-            imm = address - instruction_count2;
+            imm = address - current_address;
             //printf("%d %d %d\n", rs1_num, rs2_num, imm);
-            imm = imm << 2;
             machine_code |= 0b1100011;
             machine_code |= ((imm  & 0x800) >> 4);
             machine_code |= ((imm  & 0x1E) << 7);
@@ -605,15 +937,14 @@ unsigned int assemble_instruction(char *instruction) {
             machine_code |= ((rs1_num  & 0x1F) << 15);
             machine_code |= ((rs2_num  & 0x1F) << 20);
             machine_code |= ((imm  & 0x7E0) << 20);
-            machine_code |= ((imm  & 0x1000) << 20);
+            machine_code |= ((imm  & 0x1000) << 19);
         }
         else if (strcmp(opcode, "bne") == 0){
             instruction_count2++;
             rs1_num = get_register_number(rd);
             rs2_num = get_register_number(rs1);
             address = find_label_address(rs2);
-            imm = address - instruction_count2;
-            imm = imm << 2;
+            imm = address - current_address;
             machine_code |= 0b1100011;
             machine_code |= ((imm  & 0x800) >> 4);
             machine_code |= ((imm  & 0x1E) << 7);
@@ -621,15 +952,14 @@ unsigned int assemble_instruction(char *instruction) {
             machine_code |= ((rs1_num  & 0x1F) << 15);
             machine_code |= ((rs2_num  & 0x1F) << 20);
             machine_code |= ((imm  & 0x7E0) << 20);
-            machine_code |= ((imm  & 0x1000) << 20);
+            machine_code |= ((imm  & 0x1000) << 19);
         }
         else if (strcmp(opcode, "blt") == 0){
             instruction_count2++;
             rs1_num = get_register_number(rd);
             rs2_num = get_register_number(rs1);
             address = find_label_address(rs2);
-            imm = address - instruction_count2;
-            imm = imm << 2;
+            imm = address - current_address;
             machine_code |= 0b1100011;
             machine_code |= ((imm  & 0x800) >> 4);
             machine_code |= ((imm  & 0x1E) << 7);
@@ -639,29 +969,12 @@ unsigned int assemble_instruction(char *instruction) {
             machine_code |= ((imm  & 0x7E0) << 20);
             machine_code |= ((imm  & 0x1000) << 19);
         }
-        else if (strcmp(opcode, "bgt") == 0){
-            instruction_count2++;
-            rs2_num = get_register_number(rd);
-            rs1_num = get_register_number(rs1);
-            address = find_label_address(rs2);
-            imm = address - instruction_count2;
-            imm = imm << 2;
-            machine_code |= 0b1100011;
-            machine_code |= ((imm  & 0x800) >> 4);
-            machine_code |= ((imm  & 0x1E) << 7);
-            machine_code |= (0b100  << 12); //funct3
-            machine_code |= ((rs1_num  & 0x1F) << 15);
-            machine_code |= ((rs2_num  & 0x1F) << 20);
-            machine_code |= ((imm  & 0x7E0) << 20);
-            machine_code |= ((imm  & 0x1000) << 20);
-        }
         else if (strcmp(opcode, "bge") == 0){
             instruction_count2++;
             rs1_num = get_register_number(rd);
             rs2_num = get_register_number(rs1);
             address = find_label_address(rs2);
-            imm = address - instruction_count2;
-            imm = imm << 2;
+            imm = address - current_address;
             machine_code |= 0b1100011;
             machine_code |= ((imm  & 0x800) >> 4);
             machine_code |= ((imm  & 0x1E) << 7);
@@ -669,31 +982,14 @@ unsigned int assemble_instruction(char *instruction) {
             machine_code |= ((rs1_num  & 0x1F) << 15);
             machine_code |= ((rs2_num  & 0x1F) << 20);
             machine_code |= ((imm  & 0x7E0) << 20);
-            machine_code |= ((imm  & 0x1000) << 20);
-        }
-        else if (strcmp(opcode, "ble") == 0){
-            instruction_count2++;
-            rs2_num = get_register_number(rd);
-            rs1_num = get_register_number(rs1);
-            address = find_label_address(rs2);
-            imm = address - instruction_count2;
-            imm = imm << 2;
-            machine_code |= 0b1100011;
-            machine_code |= ((imm  & 0x800) >> 4);
-            machine_code |= ((imm  & 0x1E) << 7);
-            machine_code |= (0b101  << 12); //funct3
-            machine_code |= ((rs1_num  & 0x1F) << 15);
-            machine_code |= ((rs2_num  & 0x1F) << 20);
-            machine_code |= ((imm  & 0x7E0) << 20);
-            machine_code |= ((imm  & 0x1000) << 20);
+            machine_code |= ((imm  & 0x1000) << 19);
         }
         else if (strcmp(opcode, "bltu") == 0){
             instruction_count2++;
             rs1_num = get_register_number(rd);
             rs2_num = get_register_number(rs1);
             address = find_label_address(rs2);
-            imm = address - instruction_count2;
-            imm = imm << 2;
+            imm = address - current_address;
             machine_code |= 0b1100011;
             machine_code |= ((imm  & 0x800) >> 4);
             machine_code |= ((imm  & 0x1E) << 7);
@@ -701,15 +997,14 @@ unsigned int assemble_instruction(char *instruction) {
             machine_code |= ((rs1_num  & 0x1F) << 15);
             machine_code |= ((rs2_num  & 0x1F) << 20);
             machine_code |= ((imm  & 0x7E0) << 20);
-            machine_code |= ((imm  & 0x1000) << 20);
+            machine_code |= ((imm  & 0x1000) << 19);
         }
         else if (strcmp(opcode, "bgeu") == 0){
             instruction_count2++;
             rs1_num = get_register_number(rd);
             rs2_num = get_register_number(rs1);
             address = find_label_address(rs2);
-            imm = address - instruction_count2;
-            imm = imm << 2;
+            imm = address - current_address;
             machine_code |= 0b1100011;
             machine_code |= ((imm  & 0x800) >> 4);
             machine_code |= ((imm  & 0x1E) << 7);
@@ -717,14 +1012,14 @@ unsigned int assemble_instruction(char *instruction) {
             machine_code |= ((rs1_num  & 0x1F) << 15);
             machine_code |= ((rs2_num  & 0x1F) << 20);
             machine_code |= ((imm  & 0x7E0) << 20);
-            machine_code |= ((imm  & 0x1000) << 20);
+            machine_code |= ((imm  & 0x1000) << 19);
         }
         
     }
     else if (count == 3){
         if (strcmp(opcode, "lb") == 0){
             instruction_count2++;
-            char temp[20];
+            char temp[MAX_LINE_LENGTH];
             sscanf(rs1, "%s(%s)", temp, rs1);
             separateImmediate(temp);
             separate_rs1(rs1);
@@ -741,7 +1036,7 @@ unsigned int assemble_instruction(char *instruction) {
         }
         else if (strcmp(opcode, "lh") == 0){
             instruction_count2++;
-            char temp[20];
+            char temp[MAX_LINE_LENGTH];
             sscanf(rs1, "%s(%s)", temp, rs1);
             separateImmediate(temp);
             separate_rs1(rs1);
@@ -758,7 +1053,7 @@ unsigned int assemble_instruction(char *instruction) {
         }
         else if (strcmp(opcode, "lw") == 0){
             instruction_count2++;
-            char temp[20];
+            char temp[MAX_LINE_LENGTH];
             sscanf(rs1, "%s(%s)", temp, rs1);
             separateImmediate(temp);
             separate_rs1(rs1);
@@ -775,7 +1070,7 @@ unsigned int assemble_instruction(char *instruction) {
         }
         else if (strcmp(opcode, "lbu") == 0){
             instruction_count2++;
-            char temp[20];
+            char temp[MAX_LINE_LENGTH];
             sscanf(rs1, "%s(%s)", temp, rs1);
             separateImmediate(temp);
             separate_rs1(rs1);
@@ -792,7 +1087,7 @@ unsigned int assemble_instruction(char *instruction) {
         }
         else if (strcmp(opcode, "lhu") == 0){
             instruction_count2++;
-            char temp[20];
+            char temp[MAX_LINE_LENGTH];
             sscanf(rs1, "%s(%s)", temp, rs1);
             separateImmediate(temp);
             separate_rs1(rs1);
@@ -809,7 +1104,7 @@ unsigned int assemble_instruction(char *instruction) {
         }
         else if (strcmp(opcode, "sb") == 0){
             instruction_count2++;
-            char temp[20];
+            char temp[MAX_LINE_LENGTH];
             sscanf(rs1, "%s(%s)", temp, rs1);
             separateImmediate(temp);
             separate_rs1(rs1);
@@ -827,7 +1122,7 @@ unsigned int assemble_instruction(char *instruction) {
         }
          else if (strcmp(opcode, "sh") == 0){
             instruction_count2++;
-            char temp[20];
+            char temp[MAX_LINE_LENGTH];
             sscanf(rs1, "%s(%s)", temp, rs1);
             separateImmediate(temp);
             separate_rs1(rs1);
@@ -845,7 +1140,7 @@ unsigned int assemble_instruction(char *instruction) {
         }
          else if (strcmp(opcode, "sw") == 0){
             instruction_count2++;
-            char temp[20];
+            char temp[MAX_LINE_LENGTH];
             sscanf(rs1, "%s(%s)", temp, rs1);
             separateImmediate(temp);
             separate_rs1(rs1);
@@ -880,8 +1175,7 @@ unsigned int assemble_instruction(char *instruction) {
         else if (strcmp(opcode, "jal") == 0){
             instruction_count2++;
             address = find_label_address(rs1);
-            imm = address - instruction_count2;
-            imm = imm << 2;
+            imm = address - current_address;
             rd_num = get_register_number(rd);
             machine_code |= 0b1101111;
             machine_code |= ((rd_num  & 0x1F) << 7);
@@ -890,91 +1184,687 @@ unsigned int assemble_instruction(char *instruction) {
             machine_code |= ((imm & 0x7FE) << 20);
             machine_code |= ((imm & 0x100000) << 11);
         }
-        else if (strcmp(opcode, "li") == 0){
-            instruction_count2++;
-            rd_num = get_register_number(rd);
-            rs1_num = get_register_number("x0");
-            imm = convertToDecimal(rs1);
-            machine_code |= 0b0010011;
-            machine_code |= ((rd_num  & 0x1F) << 7);
-            machine_code |= (0b000  << 12); //funct3
-            machine_code |= ((rs1_num  & 0x1F) << 15);
-            machine_code |= ((imm  & 0xFFF) << 20);
-        } 
-        else if (strcmp(opcode, "mv") == 0) {
-            instruction_count2++; // Update instruction counter
-            rd_num = get_register_number(rd); // Get register number for rd
-            rs1_num = get_register_number(rs1); // Get register number for rs1
-            rs2_num = get_register_number("x0"); // Get register number for rs2
-            machine_code |= 0b0010011; // Set opcode for R-type
-            machine_code |= ((rd_num  & 0x1F) << 7); // Set rd field
-            machine_code |= (0b000 << 12); // Set funct3 (0 for add)
-            machine_code |= ((rs1_num & 0x1F) << 15); // Set rs1 field
-            machine_code |= ((rs2_num & 0x1F) << 20); // Set rs2 field
-            machine_code |= (0b0000000 << 25); // Set funct7 (0 for add)
+    }
+
+    return machine_code;
+}
+
+// Writes a base instruction of a pseudo-instruction's expansion with its operands filled in
+static void fill_template(const char *template, char operands[][MAX_LINE_LENGTH], int address, char *text) {
+    char *out = text;
+    while (*template && out < text + MAX_LINE_LENGTH - 16) {
+        int n;
+        if (template[0] == '$' && template[1] >= '1' && template[1] <= '3') {
+            out += snprintf(out, text + MAX_LINE_LENGTH - out, "%s", operands[template[1] - '1']);
+            template += 2;
+        } else if (template[0] == '%' &&
+                   (sscanf(template, "%%pcrel_hi($%d)", &n) == 1 || sscanf(template, "%%pcrel_lo($%d)", &n) == 1)) {
+            // auipc adds the upper part to its own address; addi sign-extends the lower part
+            int offset = find_label_address(operands[n - 1]) - address;
+            int upper = (int)(((unsigned int)offset + 0x800) & 0xFFFFF000);
+            int value = (template[7] == 'h') ? (upper >> 12) : (offset - upper);
+            out += snprintf(out, text + MAX_LINE_LENGTH - out, "%d", value);
+            template = strchr(template, ')') + 1;
+        } else {
+            *out++ = *template++;
         }
+    }
+    *out = '\0';
+}
 
-        
+/*
+ * Assembles an instruction into machine code, expanding a pseudo-instruction into
+ * its base instructions (li into the sequence chosen by materialize_constant).
+ *
+ * @param instruction: The instruction text (label and comment already removed).
+ * @param codes: Receives the machine code words (at most 2).
+ * @return: The number of machine code words.
+ */
+int assemble_sequence(char *instruction, unsigned int *codes) {
+    char operands[4][MAX_LINE_LENGTH];
+    int count = sscanf(instruction, "%s %s %s %s", operands[0], operands[1], operands[2], operands[3]);
+    const PseudoInstruction *pseudo = (count >= 1) ? find_pseudo(operands[0], count - 1, operands[count - 1]) : NULL;
+    if (!pseudo) {
+        codes[0] = assemble_base(instruction);
+        return 1;
     }
-    else if (count == 2){
-        if (strcmp(opcode, "j") == 0){
-            instruction_count2++;
-            address = find_label_address(rd);
-            imm = address - instruction_count2;
-            imm = imm << 2;
-            rd_num = get_register_number("x0");
-            machine_code |= 0b1101111;
-            machine_code |= ((rd_num  & 0x1F) << 7);
-            machine_code |= (imm & 0xFF000);
-            machine_code |= ((imm & 0x800) << 9);
-            machine_code |= ((imm & 0x7FE) << 20);
-            machine_code |= ((imm & 0x100000) << 11);
+    if (pseudo->kind == KIND_CONSTANT) {
+        return materialize_constant(get_register_number(operands[1]), convertToDecimal(operands[2]), codes);
+    }
+    // Each base instruction is assembled at its own address, the offsets stay relative to the first
+    int address = current_address, n = 0;
+    for (; n < 2 && pseudo->expansion[n]; n++) {
+        char text[MAX_LINE_LENGTH];
+        fill_template(pseudo->expansion[n], operands + 1, address, text);
+        codes[n] = assemble_base(text);
+        current_address += 4;
+    }
+    current_address = address;
+    return n;
+}
+
+// Assembles an instruction; returns the first machine code word of a pseudo-instruction's expansion
+unsigned int assemble_instruction(char *instruction) {
+    unsigned int codes[2];
+    assemble_sequence(instruction, codes);
+    return codes[0];
+}
+
+/*
+ * Reports the instructions whose label operand names no label, once the first pass
+ * has seen every label, and counts them as errors. The label is the last operand of
+ * a branch or jump (call and tail included), and the operand of %pcrel_hi in the
+ * expansion of la and of the loads and stores of a symbol.
+ *
+ * @return: The number of undefined labels.
+ */
+int check_code_labels(void) {
+    int undefined = 0;
+    for (int i = 0; i < instruction_count; i++) {
+        if (statements[i].kind == KIND_DATA) continue;
+        char operands[4][MAX_LINE_LENGTH];
+        int count = sscanf(statements[i].text, "%s %s %s %s", operands[0], operands[1], operands[2], operands[3]);
+        const char *label = NULL;
+        if (statements[i].kind == KIND_BRANCH || statements[i].kind == KIND_JUMP) {
+            label = operands[count - 1];
+        } else if (count >= 1) {
+            const PseudoInstruction *pseudo = find_pseudo(operands[0], count - 1, operands[count - 1]);
+            const char *pcrel = (pseudo && pseudo->expansion[0]) ? strstr(pseudo->expansion[0], "%pcrel_hi($") : NULL;
+            if (pcrel) label = operands[pcrel[strlen("%pcrel_hi($")] - '0'];
         }
-        else if (strcmp(opcode, "jr") == 0){
-            instruction_count2++;
-            rs1_num = get_register_number(rd);
-            rd_num = get_register_number("x0");
-            imm = 0;
-            machine_code |= 0b1100111;
-            machine_code |= ((rd_num  & 0x1F) << 7);
-            machine_code |= (0b000  << 12); //funct3
-            machine_code |= ((rs1_num  & 0x1F) << 15);
-            machine_code |= ((imm  & 0xFFF) << 20);
+        if (label && find_label(label) < 0) {
+            fprintf(stderr, "Undefined label %s at line %d\n", label, statements[i].line);
+            undefined++;
         }
     }
-    else if (count == 1){
-        if (strcmp(opcode, "ret") == 0){
-            instruction_count2++;
-            rs1_num = get_register_number("ra");
-            rd_num = get_register_number("x0");
-            imm = 0;
-            machine_code |= 0b1100111;
-            machine_code |= ((rd_num  & 0x1F) << 7);
-            machine_code |= (0b000  << 12); //funct3
-            machine_code |= ((rs1_num  & 0x1F) << 15);
-            machine_code |= ((imm  & 0xFFF) << 20);
-            
+    error_count += undefined;
+    return undefined;
+}
+
+/*
+ * Assigns a byte address to every recorded instruction from the instruction
+ * sizes, padding in front of the aligned ones, then gives every label the address
+ * of the instruction it marks (or the end of the program for a label after the
+ * last instruction).
+ */
+void layout_program(void) {
+    int address = 0;
+    for (int i = 0; i < instruction_count; i++) {
+        int align = statements[i].align;
+        statements[i].padding = (align > 1) ? (-address & (align - 1)) : 0;
+        address += statements[i].padding;
+        statements[i].address = address;
+        address += statements[i].size;
+    }
+    for (int i = 0; i < labelCount; i++) {
+        int statement = labelTable[i].statement;
+        labelTable[i].address = ((statement < instruction_count) ? statements[statement].address : address) +
+                                labelTable[i].offset;
+    }
+}
+
+// Returns the immediate bits of a B-type (branch) instruction for a byte offset
+static unsigned int branch_immediate(int imm) {
+    return ((imm & 0x800) >> 4) | ((imm & 0x1E) << 7) | ((imm & 0x7E0) << 20) | ((imm & 0x1000) << 19);
+}
+
+// Returns a jal instruction with the given destination register and byte offset
+static unsigned int encode_jal(unsigned int rd, int imm) {
+    return (imm & 0xFF000) | ((imm & 0x800) << 9) | ((imm & 0x7FE) << 20) | ((imm & 0x100000) << 11) |
+           (rd << 7) | 0b1101111;
+}
+
+/*
+ * Writes the auipc+jalr pair that jumps to pc + offset (pc being the address of the
+ * auipc) and links in rd. The upper part is loaded into rd, which the jalr overwrites
+ * anyway, or into t1 (x6) for tail, the only jump without a link register that may
+ * use it (see far_form_allowed).
+ */
+static void encode_far_jump(unsigned int rd, int offset, unsigned int *codes) {
+    unsigned int temp = rd ? rd : 6;
+    unsigned int upper = (unsigned int)(offset + 0x800) & 0xFFFFF000;  // Rounded so the low part fits 12 signed bits
+    int lower = offset - (int)upper;
+    codes[0] = upper | (temp << 7) | 0b0010111;                                     // auipc temp, upper
+    codes[1] = (((unsigned int)lower & 0xFFF) << 20) | (temp << 15) | (rd << 7) | 0b1100111;  // jalr rd, lower(temp)
+}
+
+/*
+ * Assembles a recorded instruction at the address assigned by the layout, in the
+ * form chosen by relax_program. A relaxed branch is emitted with the inverted
+ * condition, skipping over a jal to the original target. Data statements are
+ * written by encode_data instead.
+ *
+ * @param index: The index of the instruction in the statement list.
+ * @param codes: Receives the machine code (up to 2 words, or one 16-bit code).
+ * @return: The number of machine codes written.
+ */
+int encode_statement(int index, unsigned int *codes) {
+    Statement *statement = &statements[index];
+    char text[MAX_LINE_LENGTH];
+    strcpy(text, statement->text);  // assemble_instruction modifies its argument
+    current_address = statement->address;
+    unsigned int machine_code = assemble_instruction(text);
+
+    if (statement->form == FORM_COMPRESSED) {
+        codes[0] = compress_instruction(machine_code);
+        return 1;
+    }
+    if (statement->form == FORM_NORMAL) {
+        strcpy(text, statement->text);
+        return assemble_sequence(text, codes);  // A pseudo-instruction may expand to several words
+    }
+    int target = labelTable[statement->target].address;
+    if (statement->kind == KIND_JUMP) {
+        encode_far_jump((machine_code >> 7) & 0x1F, target - statement->address, codes);
+        return 2;
+    }
+    // Flipping the low funct3 bit inverts the condition (beq/bne, blt/bge, bltu/bgeu)
+    unsigned int inverted = ((machine_code & 0x01FFF07F) ^ (1 << 12));
+    codes[0] = inverted | branch_immediate(8);
+    codes[1] = encode_jal(0, target - (statement->address + 4));
+    return 2;
+}
+
+/*
+ * Describes the registers and memory accesses of a recorded instruction, for the
+ * passes that reorder or analyze instructions. The instruction is assembled at its
+ * current address and the fields are read back from the machine code.
+ *
+ * @param index: The index of the instruction in the statement list.
+ * @param info: Receives the description.
+ */
+void describe_statement(int index, StatementInfo *info) {
+    memset(info, 0, sizeof(*info));
+    if (statements[index].kind == KIND_DATA) {
+        info->is_pinned = true;  // Data is never executed, nor moved
+        return;
+    }
+    char text[MAX_LINE_LENGTH];
+    strcpy(text, statements[index].text);
+    current_address = statements[index].address;
+    unsigned int codes[2];
+    int count = assemble_sequence(text, codes);
+    unsigned int code = codes[0];
+    instruction_count2 = 0;
+
+    unsigned int opcode = code & 0x7F;
+    unsigned int rd = (code >> 7) & 0x1F;
+    unsigned int rs1 = (code >> 15) & 0x1F;
+    unsigned int rs2 = (code >> 20) & 0x1F;
+    info->code = code;
+    switch (opcode) {
+    case 0b0110011: info->rd = rd; info->rs1 = rs1; info->rs2 = rs2; break;                 // R-type
+    case 0b0010011: info->rd = rd; info->rs1 = rs1; break;                                  // I-type arithmetic
+    case 0b0000011: info->rd = rd; info->rs1 = rs1; info->is_load = true; break;            // Loads
+    case 0b0100011: info->rs1 = rs1; info->rs2 = rs2; info->is_store = true; break;         // Stores
+    case 0b0110111: info->rd = rd; break;                                                   // lui
+    case 0b0010111: info->rd = rd; info->is_pinned = true; break;                           // auipc (pc-relative)
+    case 0b1100011: info->rs1 = rs1; info->rs2 = rs2; info->is_control = true; break;       // Branches
+    case 0b1101111: info->rd = rd; info->is_control = true; break;                          // jal
+    case 0b1100111: info->rd = rd; info->rs1 = rs1; info->is_control = true; break;         // jalr
+    default: info->is_pinned = true; break;                                                 // Unknown: keep in place
+    }
+    if (statements[index].kind == KIND_CONSTANT) info->rs1 = 0;  // li reads no register even as lui+addi
+    if (count == 2 && (codes[1] & 0x7F) == 0b0000011) info->is_load = true;  // auipc+lw of lw rd, symbol
+    if (count == 2 && (codes[1] & 0x7F) == 0b0100011) {
+        info->rs2 = (codes[1] >> 20) & 0x1F;  // auipc+sw of sw rs, symbol, rt: the auipc writes rt
+        info->is_store = true;
+    }
+}
+
+// Returns the compressed register number (0-7) of x8-x15, or -1 for any other register
+static int compressed_register(unsigned int reg) {
+    return (reg >= 8 && reg <= 15) ? (int)(reg - 8) : -1;
+}
+
+// Sign-extends the low 'bits' bits of a value
+static int sign_extend(unsigned int value, int bits) {
+    unsigned int mask = 1u << (bits - 1);
+    value &= (1u << bits) - 1;
+    return (int)((value ^ mask) - mask);
+}
+
+// Returns true if value fits in a signed immediate of the given width
+static bool fits_signed(int value, int bits) {
+    return value >= -(1 << (bits - 1)) && value < (1 << (bits - 1));
+}
+
+// Encodes the 11-bit jump offset of c.j / c.jal: imm[11|4|9:8|10|6|7|3:1|5]
+static unsigned int compressed_jump_offset(int imm) {
+    return (((imm >> 11) & 0x1) << 12) | (((imm >> 4) & 0x1) << 11) | (((imm >> 8) & 0x3) << 9) |
+           (((imm >> 10) & 0x1) << 8) | (((imm >> 6) & 0x1) << 7) | (((imm >> 7) & 0x1) << 6) |
+           (((imm >> 1) & 0x7) << 3) | (((imm >> 5) & 0x1) << 2);
+}
+
+/*
+ * Finds the RV32C form of a 32-bit instruction. The checks follow the RV32C
+ * encoding constraints (register ranges, immediate widths and alignment).
+ *
+ * @param code: The 32-bit machine code.
+ * @return: The 16-bit compressed machine code, or 0 if the instruction has no compressed form.
+ */
+unsigned int compress_instruction(unsigned int code) {
+    unsigned int opcode = code & 0x7F;
+    unsigned int rd = (code >> 7) & 0x1F;
+    unsigned int funct3 = (code >> 12) & 0x7;
+    unsigned int rs1 = (code >> 15) & 0x1F;
+    unsigned int rs2 = (code >> 20) & 0x1F;
+    unsigned int funct7 = code >> 25;
+    int i_imm = sign_extend(code >> 20, 12);
+    int rd_c = compressed_register(rd), rs1_c = compressed_register(rs1), rs2_c = compressed_register(rs2);
+
+    if (opcode == 0b0010011 && funct3 == 0b000) {            // addi
+        if (rd == 0 && rs1 == 0 && i_imm == 0)
+            return 0x0001;                                    // c.nop
+        if (rd != 0 && rs1 == 0 && fits_signed(i_imm, 6))    // c.li
+            return (0b010 << 13) | (((i_imm >> 5) & 1) << 12) | (rd << 7) | ((i_imm & 0x1F) << 2) | 0b01;
+        if (rd != 0 && rs1 == rd && i_imm != 0 && rd == 2 && (i_imm & 0xF) == 0 && fits_signed(i_imm, 10))
+            return (0b011 << 13) | (((i_imm >> 9) & 1) << 12) | (2 << 7) | (((i_imm >> 4) & 1) << 6) |
+                   (((i_imm >> 6) & 1) << 5) | (((i_imm >> 7) & 3) << 3) | (((i_imm >> 5) & 1) << 2) | 0b01;  // c.addi16sp
+        if (rd != 0 && rs1 == rd && i_imm != 0 && fits_signed(i_imm, 6))  // c.addi
+            return (((i_imm >> 5) & 1) << 12) | (rd << 7) | ((i_imm & 0x1F) << 2) | 0b01;
+        if (rd != 0 && rs1 != 0 && i_imm == 0)               // c.mv
+            return (0b100 << 13) | (rd << 7) | (rs1 << 2) | 0b10;
+        if (rd_c >= 0 && rs1 == 2 && i_imm > 0 && i_imm < 1024 && (i_imm & 0x3) == 0)  // c.addi4spn
+            return (((i_imm >> 4) & 0x3) << 11) | (((i_imm >> 6) & 0xF) << 7) | (((i_imm >> 2) & 1) << 6) |
+                   (((i_imm >> 3) & 1) << 5) | (rd_c << 2) | 0b00;
+        return 0;
+    }
+    if (opcode == 0b0010011 && funct3 == 0b001 && funct7 == 0 && rd != 0 && rs1 == rd && rs2 != 0)
+        return (rd << 7) | (rs2 << 2) | 0b10;                 // c.slli
+    if (opcode == 0b0010011 && funct3 == 0b101 && rd_c >= 0 && rs1 == rd && rs2 != 0) {
+        if (funct7 == 0b0000000)                              // c.srli
+            return (0b100 << 13) | (0b00 << 10) | (rd_c << 7) | (rs2 << 2) | 0b01;
+        if (funct7 == 0b0100000)                              // c.srai
+            return (0b100 << 13) | (0b01 << 10) | (rd_c << 7) | (rs2 << 2) | 0b01;
+        return 0;
+    }
+    if (opcode == 0b0010011 && funct3 == 0b111 && rd_c >= 0 && rs1 == rd && fits_signed(i_imm, 6))
+        return (0b100 << 13) | (((i_imm >> 5) & 1) << 12) | (0b10 << 10) | (rd_c << 7) | ((i_imm & 0x1F) << 2) | 0b01;  // c.andi
+
+    if (opcode == 0b0110011 && funct7 == 0b0000000 && funct3 == 0b000 && rd != 0) {  // add
+        if (rs1 == 0 && rs2 != 0)                             // c.mv rd, rs2
+            return (0b100 << 13) | (rd << 7) | (rs2 << 2) | 0b10;
+        if (rs2 == 0 && rs1 != 0)                             // c.mv rd, rs1
+            return (0b100 << 13) | (rd << 7) | (rs1 << 2) | 0b10;
+        if (rs1 == rd && rs2 != 0)                            // c.add rd, rs2
+            return (0b100 << 13) | (1 << 12) | (rd << 7) | (rs2 << 2) | 0b10;
+        if (rs2 == rd && rs1 != 0)                            // c.add rd, rs1 (addition commutes)
+            return (0b100 << 13) | (1 << 12) | (rd << 7) | (rs1 << 2) | 0b10;
+        return 0;
+    }
+    if (opcode == 0b0110011 && rd_c >= 0 && rs1_c >= 0 && rs2_c >= 0) {
+        // c.sub / c.xor / c.or / c.and: rd' = rd' op rs2'
+        int operation = -1;
+        if (funct7 == 0b0100000 && funct3 == 0b000) operation = 0b00;
+        if (funct7 == 0b0000000 && funct3 == 0b100) operation = 0b01;
+        if (funct7 == 0b0000000 && funct3 == 0b110) operation = 0b10;
+        if (funct7 == 0b0000000 && funct3 == 0b111) operation = 0b11;
+        int other = -1;
+        if (rs1 == rd) other = rs2_c;
+        else if (rs2 == rd && operation != 0b00) other = rs1_c;  // xor, or and and commute
+        if (operation >= 0 && other >= 0)
+            return (0b100 << 13) | (0b011 << 10) | (rd_c << 7) | (operation << 5) | (other << 2) | 0b01;
+        return 0;
+    }
+    if (opcode == 0b0110111 && rd != 0 && rd != 2) {          // lui
+        int imm = sign_extend(code >> 12, 20);
+        if (imm != 0 && fits_signed(imm, 6))                  // c.lui
+            return (0b011 << 13) | (((imm >> 5) & 1) << 12) | (rd << 7) | ((imm & 0x1F) << 2) | 0b01;
+        return 0;
+    }
+    if (opcode == 0b0000011 && funct3 == 0b010) {             // lw
+        if (rs1 == 2 && rd != 0 && i_imm >= 0 && i_imm < 256 && (i_imm & 0x3) == 0)  // c.lwsp
+            return (0b010 << 13) | (((i_imm >> 5) & 1) << 12) | (rd << 7) | (((i_imm >> 2) & 0x7) << 4) |
+                   (((i_imm >> 6) & 0x3) << 2) | 0b10;
+        if (rd_c >= 0 && rs1_c >= 0 && i_imm >= 0 && i_imm < 128 && (i_imm & 0x3) == 0)  // c.lw
+            return (0b010 << 13) | (((i_imm >> 3) & 0x7) << 10) | (rs1_c << 7) | (((i_imm >> 2) & 1) << 6) |
+                   (((i_imm >> 6) & 1) << 5) | (rd_c << 2) | 0b00;
+        return 0;
+    }
+    if (opcode == 0b0100011 && funct3 == 0b010) {             // sw
+        int imm = sign_extend(((code >> 25) << 5) | rd, 12);
+        if (rs1 == 2 && imm >= 0 && imm < 256 && (imm & 0x3) == 0)  // c.swsp
+            return (0b110 << 13) | (((imm >> 2) & 0xF) << 9) | (((imm >> 6) & 0x3) << 7) | (rs2 << 2) | 0b10;
+        if (rs1_c >= 0 && rs2_c >= 0 && imm >= 0 && imm < 128 && (imm & 0x3) == 0)  // c.sw
+            return (0b110 << 13) | (((imm >> 3) & 0x7) << 10) | (rs1_c << 7) | (((imm >> 2) & 1) << 6) |
+                   (((imm >> 6) & 1) << 5) | (rs2_c << 2) | 0b00;
+        return 0;
+    }
+    if (opcode == 0b1101111 && (rd == 0 || rd == 1)) {        // jal
+        int imm = sign_extend(((code >> 31) << 20) | (((code >> 12) & 0xFF) << 12) |
+                              (((code >> 20) & 0x1) << 11) | (((code >> 21) & 0x3FF) << 1), 21);
+        if (fits_signed(imm, 12))                             // c.j / c.jal
+            return ((rd == 0 ? 0b101 : 0b001) << 13) | compressed_jump_offset(imm) | 0b01;
+        return 0;
+    }
+    if (opcode == 0b1100111 && funct3 == 0b000 && i_imm == 0 && rs1 != 0 && (rd == 0 || rd == 1))
+        return (0b100 << 13) | (rd << 12) | (rs1 << 7) | 0b10;  // c.jr / c.jalr
+    if (opcode == 0b1100011 && (funct3 == 0b000 || funct3 == 0b001) && rs1_c >= 0 && rs2 == 0) {  // beq/bne rs1', x0
+        int imm = sign_extend(((code >> 31) << 12) | (((code >> 7) & 0x1) << 11) |
+                              (((code >> 25) & 0x3F) << 5) | (((code >> 8) & 0xF) << 1), 13);
+        if (fits_signed(imm, 9))                              // c.beqz / c.bnez
+            return ((funct3 == 0b000 ? 0b110 : 0b111) << 13) | (((imm >> 8) & 1) << 12) | (((imm >> 3) & 0x3) << 10) |
+                   (rs1_c << 7) | (((imm >> 6) & 0x3) << 5) | (((imm >> 1) & 0x3) << 3) | (((imm >> 5) & 1) << 2) | 0b01;
+        return 0;
+    }
+    return 0;
+}
+
+// Returns the size in bytes of an instruction of the given kind in the given form
+static int form_size(int kind, int form) {
+    switch (form) {
+    case FORM_COMPRESSED: return 2;
+    case FORM_NORMAL: return 4;
+    default: return 8;
+    }
+}
+
+// Returns true if a branch or jump in the given form reaches a target 'offset' bytes away
+static bool form_reaches(int kind, int form, int offset) {
+    switch (form) {
+    case FORM_COMPRESSED: return fits_signed(offset, (kind == KIND_BRANCH) ? 9 : 12);   // +-256 B / +-2 KiB
+    case FORM_NORMAL: return fits_signed(offset, (kind == KIND_BRANCH) ? 13 : 21);      // +-4 KiB / +-1 MiB
+    case FORM_LONG: return kind == KIND_BRANCH && fits_signed(offset - 4, 21);          // jal after the branch
+    default: return true;                                                               // auipc+jalr
+    }
+}
+
+/*
+ * Returns true if a jump may take the auipc+jalr form. The auipc needs a register for
+ * the upper part of the offset: jal uses its link register, which the jalr overwrites
+ * anyway, and tail uses t1, which the calling convention leaves free at a tail call.
+ * A branch, j or jal x0 has no such register, and taking one would clobber a value
+ * the program may still use.
+ */
+static bool far_form_allowed(const Statement *statement) {
+    char operands[3][MAX_LINE_LENGTH];
+    int count = sscanf(statement->text, "%s %s %s", operands[0], operands[1], operands[2]);
+    if (statement->kind != KIND_JUMP) return false;
+    if (strcmp(operands[0], "call") == 0 || strcmp(operands[0], "tail") == 0) return true;
+    return count == 3 && strcmp(operands[0], "jal") == 0 && get_register_number(operands[1]) > 0;
+}
+
+// Fenwick tree over the instruction sizes, so addresses stay cheap to query while sizes change
+static int *size_tree = NULL;
+
+// Adds delta to the size of instruction 'index'
+static void size_tree_add(int index, int delta) {
+    for (int i = index + 1; i <= instruction_count; i += i & -i) {
+        size_tree[i] += delta;
+    }
+}
+
+// Returns the address of instruction 'index' (the total size for index == instruction_count)
+static int size_tree_address(int index) {
+    int address = (index < instruction_count) ? statements[index].padding : 0;
+    for (int i = index; i > 0; i -= i & -i) {
+        address += size_tree[i];
+    }
+    return address;
+}
+
+// Fills the tree from the sizes and the alignment padding in front of each instruction
+static void size_tree_build(void) {
+    for (int i = 1; i <= instruction_count; i++) {
+        size_tree[i] = statements[i - 1].padding + statements[i - 1].size;
+    }
+    for (int i = 1; i <= instruction_count; i++) {
+        int parent = i + (i & -i);
+        if (parent <= instruction_count) size_tree[parent] += size_tree[i];
+    }
+}
+
+/*
+ * Aligns the head of every loop, i.e. the instruction targeted by a backward branch
+ * or jump, so a loop iteration starts at the beginning of a fetch block. The jump of
+ * a "done: j done" ending is not a loop worth aligning and is skipped.
+ *
+ * @param alignment: The boundary in bytes (a power of two).
+ * @return: The number of loop heads aligned.
+ */
+int align_loop_heads(int alignment) {
+    int aligned = 0;
+    for (int i = 0; i < instruction_count; i++) {
+        if (statements[i].kind != KIND_BRANCH && statements[i].kind != KIND_JUMP) continue;
+        char operands[4][MAX_LINE_LENGTH];
+        int count = sscanf(statements[i].text, "%s %s %s %s", operands[0], operands[1], operands[2], operands[3]);
+        int label = find_label(operands[count - 1]);
+        if (label < 0) continue;
+        int head = labelTable[label].statement;
+        if (head >= i || head >= instruction_count) continue;  // Forward, or a jump to itself
+        if (statements[head].align < alignment) {
+            if (statements[head].align <= 1) aligned++;
+            statements[head].align = alignment;
         }
     }
+    return aligned;
+}
 
-    return machine_code;
+/*
+ * Chooses the form of every instruction. Branches and jumps start in their shortest
+ * form (compressed when allowed and the registers fit, 32-bit otherwise) and only the
+ * ones whose target is out of reach grow:
+ *   - a branch beyond +-4 KiB becomes the inverted branch over a jal,
+ *   - a jal with a link register, call or tail beyond +-1 MiB becomes auipc+jalr.
+ * A branch, j or jal x0 beyond +-1 MiB is an error: its auipc+jalr form would need a
+ * scratch register (see far_form_allowed).
+ * Growing an instruction moves every address after it, so the branches spanning it
+ * are put back on the worklist; the others keep their form. Sizes only grow, so the
+ * worklist empties after at most three growths per instruction, and because every
+ * instruction starts short none is ever left longer than it needs to be.
+ * Alignment padding can shrink when the code before it grows, so a program with
+ * aligned instructions is laid out again once the worklist is empty, and the branches
+ * that no longer reach go back on it. A branch is never shortened again, which can
+ * leave one a form longer than the final layout strictly needs.
+ *
+ * @param compress: true to use 16-bit RV32C forms wherever possible.
+ */
+void relax_program(bool compress) {
+    int *relaxable = malloc((instruction_count + 1) * sizeof(int));  // Branches and jumps with a known target
+    int *worklist = malloc((instruction_count + 1) * sizeof(int));
+    bool *queued = calloc(instruction_count + 1, sizeof(bool));
+    size_tree = calloc(instruction_count + 1, sizeof(int));
+    if (!relaxable || !worklist || !queued || !size_tree) {
+        perror("Error allocating relaxation worklist");
+        exit(1);
+    }
+
+    // Resolve the targets and pick the shortest form of every instruction
+    int relaxable_count = 0;
+    bool aligned = false;  // true if any instruction has to be aligned
+    for (int i = 0; i < instruction_count; i++) {
+        Statement *statement = &statements[i];
+        char text[MAX_LINE_LENGTH];
+        strcpy(text, statement->text);
+        bool branches = (statement->kind == KIND_BRANCH || statement->kind == KIND_JUMP);
+        if (branches) {
+            // The label is the last operand of a branch or jump
+            char operands[4][MAX_LINE_LENGTH];
+            int count = sscanf(text, "%s %s %s %s", operands[0], operands[1], operands[2], operands[3]);
+            statement->target = find_label(operands[count - 1]);
+            branches = (statement->target >= 0);  // check_code_labels has failed the run otherwise
+        }
+        statement->form = FORM_NORMAL;
+        if (compress && statement->size == 4 && statement->kind != KIND_DATA) {
+            // Check the register and immediate constraints with the target at offset 0
+            current_address = branches ? labelTable[statement->target].address : 0;
+            if (compress_instruction(assemble_instruction(text)) != 0) statement->form = FORM_COMPRESSED;
+        }
+        if (branches || statement->form == FORM_COMPRESSED) {
+            statement->size = form_size(statement->kind, statement->form);
+        }
+        if (statement->align > 1) aligned = true;
+        if (branches) {
+            relaxable[relaxable_count++] = i;
+            queued[i] = true;
+        }
+    }
+    instruction_count2 = 0;
+    layout_program();
+    size_tree_build();
+
+    // Circular worklist, holding every branch and jump at first
+    int head = 0, pending = relaxable_count;
+    for (int i = 0; i < relaxable_count; i++) {
+        worklist[i] = relaxable[i];
+    }
+    while (pending > 0) {
+        while (pending > 0) {
+            int index = worklist[head];
+            head = (head + 1) % (instruction_count + 1);
+            pending--;
+            queued[index] = false;
+
+            Statement *statement = &statements[index];
+            int target = labelTable[statement->target].statement;
+            int offset = size_tree_address(target) - size_tree_address(index);
+            int form = statement->form;
+            while (!form_reaches(statement->kind, form, offset)) {
+                form = (form == FORM_NORMAL && statement->kind == KIND_JUMP) ? FORM_FAR : form + 1;
+            }
+            if (form == statement->form) continue;
+            if (form == FORM_FAR && !far_form_allowed(statement)) {
+                fprintf(stderr, "Target beyond +-1 MiB at line %d: use tail or call\n", statement->line);
+                error_count++;  // Still sized as auipc+jalr, so the layout settles
+            }
+
+            int delta = form_size(statement->kind, form) - statement->size;
+            statement->form = form;
+            statement->size += delta;
+            size_tree_add(index, delta);
+
+            // Re-check every branch or jump whose span covers the instruction that grew
+            for (int i = 0; i < relaxable_count; i++) {
+                int other = relaxable[i];
+                int other_target = labelTable[statements[other].target].statement;
+                int low = (other < other_target) ? other : other_target;
+                int high = (other < other_target) ? other_target : other;
+                if (!queued[other] && index >= low && index < high) {
+                    worklist[(head + pending) % (instruction_count + 1)] = other;
+                    pending++;
+                    queued[other] = true;
+                }
+            }
+        }
+
+        // The tree keeps the alignment padding of the last layout; growth may have changed it,
+        // so lay the program out again and queue any branch that no longer reaches
+        if (!aligned) break;
+        layout_program();
+        for (int i = 0; i < relaxable_count; i++) {
+            Statement *statement = &statements[relaxable[i]];
+            int offset = labelTable[statement->target].address - statement->address;
+            if (!form_reaches(statement->kind, statement->form, offset)) {
+                worklist[(head + pending) % (instruction_count + 1)] = relaxable[i];
+                pending++;
+                queued[relaxable[i]] = true;
+            }
+        }
+        if (pending > 0) size_tree_build();
+    }
+
+    free(relaxable);
+    free(worklist);
+    free(queued);
+    free(size_tree);
+    size_tree = NULL;
+    layout_program();
 }
 
-// Outputs the 32-bit machine code as an 8-character hexadecimal string to the specified file
-void output_hex(unsigned int code, FILE *output_file) {
-    // Use fprintf to print the 32-bit machine code in hexadecimal format to the file
-    // "0x" is added as a prefix, and the code is printed as an 8-character hexadecimal value
-    fprintf(output_file, "0x%08X\n", code);  // it ensures output is always 8 hex digits, with leading zeros if necessary
+// Outputs the machine code as a hexadecimal string to the specified file
+void output_hex(unsigned int code, int size, FILE *output_file) {
+    // Use fprintf to print the machine code in hexadecimal format to the file
+    // "0x" is added as a prefix, and the code is printed with 2 hex digits per byte
+    fprintf(output_file, "0x%0*X\n", 2 * size, code);  // it ensures output is always 8 (or 4) hex digits, with leading zeros if necessary
 }
 
+/*
+ * Writes the symbol table to a map file, one "0xADDRESS label" line per label,
+ * so tools such as the simulator can name the code regions of the program.
+ *
+ * @param map_file: The file the symbol table is written to.
+ */
+void output_symbols(FILE *map_file) {
+    for (int i = 0; i < labelCount; i++) {
+        fprintf(map_file, "0x%08X %s\n", labelTable[i].address, labelTable[i].label);
+    }
+}
+
+/*
+ * Writes the assembled program to a POSIX shared-memory segment so another
+ * process can map it without parsing text. The layout is documented in image_shm.h.
+ *
+ * @param name: The shared-memory object name (e.g. "/rvimage").
+ * @param image: The machine code bytes in RISC-V (little-endian) byte order.
+ * @param size: The number of machine code bytes.
+ * @return: 0 on success, 1 if the segment cannot be created.
+ */
+int output_shared_memory(const char *name, const unsigned char *image, int size) {
+    uint32_t string_size = 0;
+    for (int i = 0; i < labelCount; i++) {
+        string_size += strlen(labelTable[i].label) + 1;
+    }
+
+    ImageHeader header = {0};
+    header.version = IMAGE_VERSION;
+    header.header_size = sizeof(ImageHeader);
+    header.entry = 0;
+    header.load_address = 0;
+    header.image_offset = sizeof(ImageHeader);
+    header.image_size = size;
+    header.symbol_offset = (header.image_offset + header.image_size + 3) & ~3u;  // Keep the table aligned
+    header.symbol_count = labelCount;
+    header.string_offset = header.symbol_offset + labelCount * sizeof(ImageSymbol);
+    header.string_size = string_size;
+    header.total_size = header.string_offset + string_size;
+
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Error creating shared memory");
+        return 1;
+    }
+    if (ftruncate(fd, header.total_size) != 0) {
+        perror("Error sizing shared memory");
+        close(fd);
+        return 1;
+    }
+    unsigned char *segment = mmap(NULL, header.total_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);  // The mapping stays valid after the descriptor is closed
+    if (segment == MAP_FAILED) {
+        perror("Error mapping shared memory");
+        return 1;
+    }
+
+    // Machine code, already in RISC-V (little-endian) byte order
+    memcpy(segment + header.image_offset, image, size);
+
+    // Symbol table and label names
+    ImageSymbol *symbol_table = (ImageSymbol *)(segment + header.symbol_offset);
+    char *strings = (char *)(segment + header.string_offset);
+    uint32_t name_offset = 0;
+    for (int i = 0; i < labelCount; i++) {
+        symbol_table[i].address = labelTable[i].address;
+        symbol_table[i].name_offset = name_offset;
+        strcpy(strings + name_offset, labelTable[i].label);
+        name_offset += strlen(labelTable[i].label) + 1;
+    }
+
+    // Publish the header last: the magic number marks the segment as complete
+    memcpy(segment, &header, sizeof(header));
+    __sync_synchronize();
+    ((ImageHeader *)segment)->magic = IMAGE_MAGIC;
+    munmap(segment, header.total_size);
+    return 0;
+}
 
 // Function to output machine code in binary
-void output_binary(unsigned int code, FILE *output_file) {
-    // Loop through each bit of the 32-bit machine code, starting from the most significant bit (bit 31)
-    for (int i = 31; i >= 0; --i) {
+void output_binary(unsigned int code, int size, FILE *output_file) {
+    // Loop through each bit of the machine code, starting from the most significant bit (bit 31, or 15 when compressed)
+    for (int i = 8 * size - 1; i >= 0; --i) {
         // Check if the ith bit of 'code' is set (1) or not (0), and output '1' or '0' accordingly
-        fputc((code & (1 << i)) ? '1' : '0', output_file);
+        fputc((code & (1u << i)) ? '1' : '0', output_file);
     }
-    // After outputting all 32 bits, add a newline character to the file
+    // After outputting all the bits, add a newline character to the file
     fputc('\n', output_file);
 }
\ No newline at end of file
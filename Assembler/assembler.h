@@ -25,21 +25,89 @@
 extern int labelCount;        // Counts the number of labels in the assembly file
 extern int instruction_count; // Tracks the number of instructions processed in the first pass
 extern int instruction_count2; // Tracks the number of instructions processed in the second pass
+extern int current_address;    // Byte address of the instruction being assembled
+extern int source_line;        // Line number of the source line read by the first pass
+extern int error_count;        // Errors found in the source; the run fails if there are any
 
 // Structure to hold label names and their corresponding memory addresses
 typedef struct {
     char label[MAX_LINE_LENGTH]; // The label name (symbol)
-    int address;                 // The address associated with the label
+    int statement;               // Index of the instruction the label marks
+    int offset;                  // Bytes past that instruction (0 except for __global_pointer$)
+    int address;                 // The byte address associated with the label
 } Label;
 
+// Kinds of recorded instructions, for the ones relaxation may rewrite
+#define KIND_OTHER 0   // Any instruction without a label operand
+#define KIND_BRANCH 1  // Conditional branch to a label (beq ... ble)
+#define KIND_JUMP 2    // jal / j to a label
+#define KIND_CONSTANT 3  // li, expanded to the shortest lui/addi sequence
+#define KIND_DATA 4      // Data emitted as is (.word, .half, .byte, .string, .space), never executed
+
+// Sections the first pass records into; the layout places them in this order
+#define SECTION_TEXT 0   // Code and literal pools
+#define SECTION_DATA 1   // Initialized data
+#define SECTION_SDATA 2  // Small initialized data, reached from gp
+#define SECTION_SBSS 3   // Small zero-initialized data, reached from gp
+#define SECTION_COUNT 4
+
+// Encodings an instruction can be emitted in, from shortest to longest
+#define FORM_COMPRESSED 0  // 16-bit RV32C instruction
+#define FORM_NORMAL 1      // 32-bit instruction
+#define FORM_LONG 2        // Branch: inverted branch over a jal (reaches +-1 MiB)
+#define FORM_FAR 3         // Jump with a link register, call or tail: auipc+jalr (reaches +-2 GiB)
+
+// Structure to hold an instruction recorded during the first pass
+typedef struct {
+    char text[MAX_LINE_LENGTH];  // Instruction text without label and comment
+    int address;                 // Byte address assigned by the layout
+    int size;                    // Encoded size in bytes
+    int kind;                    // KIND_OTHER, KIND_BRANCH, KIND_JUMP, KIND_CONSTANT or KIND_DATA
+    int form;                    // FORM_COMPRESSED ... FORM_FAR
+    int target;                  // Index of the target label of a branch or jump, -1 if none
+    int align;                   // Required alignment of the address in bytes (0 if none)
+    int padding;                 // Bytes of nops in front of the instruction, set by the layout
+    int line;                    // Line number in the source file
+    int loop_bound;              // Iteration bound from a loop_bound annotation, 0 if none
+    int section;                 // SECTION_* the statement was recorded in
+    int data;                    // Offset of the bytes of a data statement in the data arena, -1 for zeros
+    int blob;                    // File region of an .incbin data statement, -1 if none
+} Statement;
+
+// Structure describing the registers and memory accesses of a recorded instruction
+typedef struct {
+    unsigned int code;  // Machine code (first word for a multi-instruction sequence)
+    int rd;             // Register written, 0 if none
+    int rs1, rs2;       // Registers read, 0 if none
+    bool is_load;       // Reads memory
+    bool is_store;      // Writes memory
+    bool is_control;    // Branch or jump: ends a basic block
+    bool is_pinned;     // Must not move (auipc depends on its own address)
+} StatementInfo;
+
+// Global label table filled during the first pass (labelCount entries)
+extern Label *labelTable;
+
+// Instructions recorded during the first pass (instruction_count entries)
+extern Statement *statements;
+
 // Function declarations used in the assembler
 
-// Adds a new label to the symbol table with its corresponding address
-void add_label(const char *label, int address);
+// Adds a new label to the symbol table, bound to the instruction with the given index
+void add_label(const char *label, int statement);
+
+// Records an instruction of the given size in bytes and kind during the first pass
+void add_statement(const char *instruction, int size, int kind);
 
 // Finds the memory address of a label by searching the symbol table
 int find_label_address(const char *label);
 
+// Removes the flagged labels from the symbol table; returns the number removed
+int remove_labels(const bool *removed);
+
+// Finds the index of a label in the symbol table, -1 if it is not defined
+int find_label(const char *label);
+
 // Removes the colon at the end of labels in assembly code (e.g., "loop:" becomes "loop")
 void remove_colon(char *str);
 
@@ -53,13 +121,212 @@ void replaceCommas(char *str);
 void first_pass(char *instruction);
 
 // Assembles an individual instruction into its corresponding machine code
+// (the first word of the expansion of a pseudo-instruction)
 unsigned int assemble_instruction(char *instruction);
 
-// Outputs the machine code in hexadecimal format to the output file
-void output_hex(unsigned int code, FILE *output_file);
+// Assembles an instruction, expanding pseudo-instructions (nop, mv, not, neg, seqz, snez, li, la,
+// loads and stores of a symbol, beqz, bnez, bgt, ble, bgtu, bleu, j, jr, ret, call, tail); returns the number of machine code words
+int assemble_sequence(char *instruction, unsigned int *codes);
+
+// Converts a decimal or "0x" hexadecimal string to a number
+long int convertToDecimal(const char *str);
+
+// Reads a whole operand as a 32-bit constant (signed or unsigned); returns false if it is not one
+bool parse_constant(const char *str, long int *value);
+
+// Writes the shortest lui/addi sequence loading value into register rd; returns the number of instructions
+int materialize_constant(unsigned int rd, int value, unsigned int *codes);
+
+// Reports the branches, jumps and symbol accesses (la, lw rd, symbol ...) naming an undefined label; returns their number
+int check_code_labels(void);
+
+// Assigns byte addresses to every instruction and label from the sizes and alignments
+void layout_program(void);
+
+// Section currently recorded into by the first pass (SECTION_*)
+extern int current_section;
+
+// Handles a section directive (.text, .data, .sdata, .sbss, .section) or data directive (.word,
+// .half, .byte, .string, .asciz, .ascii, .space, .zero, .incbin) of the first pass; returns true if the line held one
+bool data_directive(const char *instruction);
+
+// Stores the bytes of a data statement in the data arena; returns their offset there
+int add_data(const unsigned char *bytes, int size);
+
+// Moves the data sections after the code and defines __global_pointer$ for the small data
+void place_sections(void);
+
+// Reports the label operands of .word that name no label; returns their number
+int check_data_labels(void);
+
+// Writes the bytes of the data statement with the given index; returns their number
+int encode_data(int index, unsigned char *bytes);
+
+// Returns the bytes of an .incbin statement, mapped from its file, or NULL for any other statement
+const unsigned char *blob_bytes(int index);
+
+// Copies the bytes of an .incbin statement from its file to the end of a binary output file
+int copy_blob(int index, FILE *output_file);
+
+// Rewrites the accesses to data within +-2 KiB of __global_pointer$ into single gp-relative
+// instructions; returns the instructions saved, or -1 if the program does not set gp
+int relax_gp(void);
+
+// Describes the registers and memory accesses of the recorded instruction with the given index
+void describe_statement(int index, StatementInfo *info);
+
+// Structure counting the rewrites of the peephole optimizer
+typedef struct {
+    int self_moves;     // mv rd, rd removed
+    int zero_adds;      // addi rd, rd, 0 removed
+    int jumps_to_next;  // Branches and jumps to the next instruction removed
+    int threaded;       // Branches and jumps retargeted to the end of a jump chain
+} PeepholeStats;
+
+// Peephole optimizer (peephole.c): removes and simplifies redundant instructions of the
+// first pass and rebinds the labels; returns the number of instructions removed
+int peephole_program(PeepholeStats *stats);
+
+// Unreachable-code elimination (peephole.c): removes the instructions not reachable from the
+// first one and their labels; returns the instructions removed, or -1 if the program was kept
+int strip_unreachable(int *bytes, int *labels);
+
+// Structure describing the result of the literal-pool pass
+typedef struct {
+    int loads;                // li instructions turned into auipc+lw
+    int entries;              // Distinct pool entries placed
+    int pools;                // Pools placed after jumps and returns
+    int inline_instructions;  // Instructions of the loads as inline lui+addi
+    int inline_bytes;         // Bytes of the loads as inline lui+addi (compressed where possible)
+    int pool_bytes;           // Bytes of the loads and of the pool entries
+} PoolStats;
+
+// Literal pool (pool.c): loads the constants needing lui+addi from pools of shared entries;
+// returns the number of li instructions turned into loads
+int build_literal_pools(bool compress, PoolStats *stats);
+
+// Structure describing the result of the profile-guided function ordering
+typedef struct {
+    int functions;     // Functions found (entry, call targets, callees of the profile)
+    int hot;           // Units executed by the profile (functions glued by fall-through count once)
+    int cold;          // Units never executed, placed at the end
+    int hot_bytes;     // Size of the hot units
+    int span_before;   // Bytes from the first to the last hot instruction, before and after
+    int span_after;
+} FunctionOrderStats;
+
+// Structure describing the result of the profile-guided block layout
+typedef struct {
+    int inverted;            // Branches inverted so the likely successor falls through
+    int inserted;            // Jumps added to blocks followed by neither successor
+    int removed;             // Jumps to the block laid out next, removed
+    long long taken_before;  // Times the profiled branches (and the jumps added after them) jump
+    long long taken_after;
+} BlockLayoutStats;
+
+// Profile-guided layout (profile.c): reads the execution profile (0 on success), packs the
+// hot functions together and lays the blocks of every function out along the likely path
+// (0 on success, 1 if the program was left unchanged)
+int load_profile(const char *file_name);
+int order_functions(FunctionOrderStats *stats);
+int order_blocks(BlockLayoutStats *stats);
+
+// Instruction scheduler (scheduler.c): latency model and list scheduling of basic blocks
+extern int load_latency;  // Cycles from a load to the first instruction that can use its result
+extern int alu_latency;   // Cycles from any other instruction to the first use of its result
+int schedule_program(int *stalls_before, int *stalls_after);
+
+// Macro-op fusion (scheduler.c): reads the pairs the target core fuses (0 on success), records
+// the pairs of the source, moves the second of each fusible pair next to the first (returns
+// the number moved) and counts the pairs created and broken since the snapshot
+int load_fusion_table(const char *file_name);
+void fusion_snapshot(void);
+int fuse_program(void);
+int fusion_report(int *created, int *broken);
+
+// Structure holding the static pipeline model of a basic block (listing.c)
+typedef struct {
+    int ready[32];     // Cycle at which each register can be read
+    int producer[32];  // Instruction that last wrote each register
+    int time;          // Issue cycle of the last instruction, -1 at the start of the block
+} PipelineState;
+
+// Structure holding the result of issuing one recorded instruction in the pipeline model
+typedef struct {
+    int instructions;  // Machine instructions issued, including alignment nops
+    int stall;         // Stall cycles waiting for a register
+    int reg;           // Register waited for (when stall > 0)
+    int producer;      // Index of the instruction writing that register
+    int internal;      // Stall cycles inside a lui+addi or auipc+jalr sequence
+} PipelineIssue;
+
+// Static hazard analysis (listing.c): writes the source annotated with addresses, machine code,
+// pipeline stalls and per-block cycle estimates; returns 0 on success, 1 on error
+extern int branch_penalty;  // Cycles lost by a taken branch or jump
+void pipeline_reset(PipelineState *state);
+void pipeline_issue(PipelineState *state, int index, const StatementInfo *info, PipelineIssue *issue);
+int write_listing(FILE *listing_file, const char *source_file_name);
+
+// Control-flow graph and worst-case cycle bounds (cfg.c). build_cfg must run after
+// relax_program and returns the number of functions; the outputs describe the last build
+int build_cfg(void);
+void output_cfg_dot(FILE *dot_file);
+void output_cfg_json(FILE *json_file);
+void output_wcet(FILE *report_file);
+
+// Aligns every instruction targeted by a backward branch or jump; returns the number of loop heads
+int align_loop_heads(int alignment);
+
+// Chooses the form of every instruction so each branch and jump reaches its target
+// (and uses 16-bit RV32C forms where possible if compress is set), then lays the program out
+void relax_program(bool compress);
+
+// Returns the 16-bit RV32C form of a 32-bit instruction, or 0 if it has none
+unsigned int compress_instruction(unsigned int code);
+
+// Assembles the recorded instruction with the given index at its assigned address into
+// codes (up to 2 machine code words, or one 16-bit code); returns the number of codes
+int encode_statement(int index, unsigned int *codes);
+
+// Outputs the machine code (size 4, or 2 for compressed instructions) in hexadecimal format
+void output_hex(unsigned int code, int size, FILE *output_file);
+
+// Outputs the machine code (size 4, or 2 for compressed instructions) in binary format
+void output_binary(unsigned int code, int size, FILE *output_file);
+
+// Outputs the symbol table ("0xADDRESS label" per line) to the map file
+void output_symbols(FILE *map_file);
+
+// Writes the machine code image and the symbol table to a POSIX shared-memory segment (see image_shm.h)
+int output_shared_memory(const char *name, const unsigned char *image, int size);
+
+// Starts the preprocessor on the given source file, the base of the relative .include paths
+void begin_preprocessor(const char *file_name);
+
+// Runs a source line (comment removed, commas replaced) through the macro preprocessor (.macro, .rept,
+// .irp, .if, .include), handing the lines it keeps and the expansions to first_pass
+void preprocess_line(char *line);
+
+// Finds the file named by .include or .incbin, next to the including file or in the working directory
+bool find_source_file(const char *name, char *path, size_t size);
+
+// Records a file the program is assembled from (an included source or .incbin file), for -MD
+void add_dependency(const char *path);
+
+// Writes a make rule making the target depend on the source file and every file it included
+void write_dependencies(FILE *dependency_file, const char *target);
+
+// Reports the macro definitions, repeated blocks and .if blocks left open; returns their number
+int end_preprocessor(void);
+
+// Returns the loop_bound annotation of a source line's comment, 0 if there is none, -1 if it is invalid
+long int loop_bound_annotation(const char *line);
+
+// Records the loop_bound annotation of a source line's comment for the next instruction
+void read_annotations(const char *line);
 
-// Outputs the machine code in binary format to the output file
-void output_binary(unsigned int code, FILE *output_file);
+// Reads the next source line like fgets, clearing complete if it does not fit in the buffer
+bool read_line(char *line, int size, FILE *file, bool *complete);
 
 void removeComment(char* str);
 
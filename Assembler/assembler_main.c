@@ -5,21 +5,122 @@
  *
  * This file serves as the main entry point for a RISC-V assembler written in C.
  * It processes an input assembly file and generates the corresponding machine code
- * in either hexadecimal or binary format. The assembler reads the input file in two passes:
- *   1. The first pass handles label parsing and symbol resolution.
- *   2. The second pass translates assembly instructions into machine code.
- * Usage: ./assembler_main <input_file> <output_file> <-h|-b>
+ * in either hexadecimal or binary format. The assembler works in two passes:
+ *   1. The first pass handles label parsing and records every instruction with its size.
+ *   2. After the layout assigns addresses, the second pass translates the recorded
+ *      instructions into machine code.
+ * Usage: ./assembler_main <input_file> <output_file> <-h|-b|-f|-s> [-m <map_file>] [--compress] [--align-loops <bytes>]
  *   -h: Outputs the machine code in hexadecimal format.
  *   -b: Outputs the machine code in binary format.
+ *   -f: Outputs the raw little-endian bytes of the program (flat binary image); .incbin
+ *       regions are copied into it file to file.
+ *   -s: Writes the machine code and symbol table to the POSIX shared-memory object
+ *       named by output_file (e.g. /rvimage), laid out as described in image_shm.h.
+ *   -m: Also writes the symbol table (label addresses) to map_file.
+ *   -MD: Writes a make rule to the given file making output_file depend on input_file and
+ *       every file it includes (.include and .incbin), like the -MD -MP options of C compilers.
+ *   --compress: Emits the RV32C 16-bit form of every instruction that has one. Compressed
+ *       instructions are written as 4 hex digits (or 16 bits) per line.
+ *   --peephole: Removes "mv rd, rd", "addi rd, rd, 0" and branches or jumps to the next
+ *       instruction, threads jumps through chains of jumps, and reports what it removed.
+ *   --strip-unreachable: Removes the instructions that cannot be reached from the first one
+ *       (following branches, jumps and calls, with every address-taken label kept for the
+ *       indirect ones) together with their labels, and reports the bytes saved.
+ *   --profile: Reads an execution profile (instructions per label region and calls between
+ *       regions, e.g. from ./simulator --profile) and packs the hot functions together, in
+ *       call order, with the functions never executed at the end (see profile.c).
+ *   --block-layout: With --profile, also reorders the basic blocks of every function so the
+ *       likely successor of each branch falls through, inverting branches and adding or
+ *       removing jumps, and reports the taken branches before and after.
+ *   --fusion: Reads the macro-op fusion pairs of the target core from the given table (see
+ *       scheduler.c), moves fusible pairs next to each other, keeps them together when
+ *       scheduling, and reports the pairs created and broken.
+ *   --schedule: Reorders the instructions of each basic block to hide load-use and other
+ *       result latencies (--load-latency, default 2, and --alu-latency, default 1, in cycles)
+ *       and reports the stall cycles before and after.
+ *   --literal-pool: Loads every constant that li would build with lui+addi from a pool of
+ *       shared entries placed after the next jump or return (auipc+lw, see pool.c), and
+ *       compares the instructions and bytes with the inline sequences.
+ *   --listing: Writes the source annotated with addresses, machine code, the load-use and
+ *       RAW stalls of an in-order pipeline (same latency options, plus --branch-penalty,
+ *       default 2) and the estimated cycles of every basic block to the given file.
+ *   --cfg-dot, --cfg-json: Write the control-flow graph of the program (basic blocks, branch,
+ *       jump and call edges, loop bounds and cycle estimates) in Graphviz DOT or JSON format.
+ *   --wcet: Reports the worst-case cycles of every function, bounding each loop with its
+ *       ".loop_bound n" directive or "# loop_bound n" comment (see cfg.c).
+ *   --align-loops: Aligns every loop head (label targeted by a backward branch) to the given
+ *       boundary in bytes, e.g. the fetch block or cache line size, padding with nops.
  */
 
 #include "assembler.h"  // Include the header file that contains function declarations and constants
 
+#define NOP 0x00000013             // addi x0, x0, 0
+#define NOP_COMPRESSED 0x0001       // c.nop
+
+// Destination of the machine code: a text file (hex or binary), a flat binary file or the shared-memory image
+static bool isHex, isBin, isFlat;
+static FILE *output_file = NULL;
+static unsigned char *image = NULL;
+
+// Prints the command line usage of the assembler
+static void usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s <input_file> <output_file> <-h|-b|-f|-s> [-m <map_file>] [-MD <dependency_file>] [--compress]\n"
+                    "       [--align-loops <bytes>] [--peephole] [--strip-unreachable] [--profile <file>] [--block-layout] [--fusion <table>] [--schedule] [--load-latency <cycles>] [--alu-latency <cycles>]\n"
+                    "       [--literal-pool] [--listing <file>]\n"
+                    "       [--branch-penalty <cycles>] [--cfg-dot <file>] [--cfg-json <file>] [--wcet]\n",
+            program_name);
+}
+
+// Writes one machine code of 'size' bytes, located at 'address', in the chosen output format
+static void write_code(unsigned int code, int size, int address) {
+    if (isHex) {
+        output_hex(code, size, output_file);  // Output the machine code in hexadecimal format
+    } else if (isBin) {
+        output_binary(code, size, output_file);  // Output the machine code in binary format
+    } else if (isFlat) {
+        for (int byte = 0; byte < size; byte++) fputc((code >> (8 * byte)) & 0xFF, output_file);
+    } else {
+        for (int byte = 0; byte < size; byte++) {
+            image[address + byte] = (code >> (8 * byte)) & 0xFF;  // Little-endian
+        }
+    }
+}
+
+// Data bytes collected into one 32-bit (or 16-bit, at a halfword address) unit of the text formats
+static unsigned int data_unit = 0;
+static int data_bytes = 0, data_address = 0;
+
+// Writes the data bytes collected so far, zero-padded to a whole unit
+static void flush_data(void) {
+    if (data_bytes == 0) return;
+    write_code(data_unit, (data_address % 4 == 2 && data_bytes <= 2) ? 2 : 4, data_address);
+    data_unit = 0;
+    data_bytes = 0;
+}
+
+// Writes data bytes located at 'address'; the text formats get them as whole 16- or 32-bit units
+static void write_data(const unsigned char *bytes, int size, int address) {
+    if (image) {
+        memcpy(image + address, bytes, size);  // Straight into the shared-memory image
+        return;
+    }
+    if (isFlat) {
+        fwrite(bytes, 1, size, output_file);
+        return;
+    }
+    for (int b = 0; b < size; b++) {
+        if (data_bytes == 0) data_address = address + b;
+        data_unit |= (unsigned int)bytes[b] << (8 * data_bytes);
+        data_bytes++;
+        if (data_bytes == ((data_address % 4 == 2) ? 2 : 4)) flush_data();
+    }
+}
+
 int main(int argc, char *argv[]) {
     // Check if the correct number of command line arguments is provided
     if (argc < 4) {
         // Print usage instructions if incorrect arguments are provided
-        fprintf(stderr, "Usage: %s <input_file> <output_file> <-h|-b>\n", argv[0]);
+        usage(argv[0]);
         return 1;
     }
 
@@ -27,6 +128,79 @@ int main(int argc, char *argv[]) {
     const char *input_file_name = argv[1];
     const char *output_file_name = argv[2];
 
+    isHex = (strcmp(argv[3], "-h") == 0);
+    isBin = (strcmp(argv[3], "-b") == 0);
+    isFlat = (strcmp(argv[3], "-f") == 0);
+    bool isShm = (strcmp(argv[3], "-s") == 0);
+    if (!isHex & !isBin & !isFlat & !isShm) {
+        fprintf(stderr, "Invalid Output flag. ");
+        usage(argv[0]);
+        return 1;
+    }
+    const char *map_file_name = NULL;  // Optional symbol map file
+    const char *dependency_file_name = NULL;  // Optional make rule listing the source files
+    bool compress = false;             // Emit RV32C instructions where possible
+    int loop_alignment = 0;            // Boundary for loop heads, 0 to leave them where they are
+    bool peephole = false;             // Remove redundant instructions and thread jump chains
+    bool schedule = false;             // Reorder basic blocks to hide result latencies
+    bool fusion = false;               // Pair instructions for the fusion table of the target core
+    bool strip = false;                // Remove the code not reachable from the entry
+    bool literal_pool = false;         // Load large constants from shared pool entries
+    const char *profile_file_name = NULL;  // Optional execution profile for the function order
+    bool block_layout = false;             // Also lay the blocks out along the profiled paths
+    const char *listing_file_name = NULL;  // Optional annotated listing with static stall estimates
+    const char *dot_file_name = NULL;      // Optional control-flow graph in DOT format
+    const char *json_file_name = NULL;     // Optional control-flow graph in JSON format
+    bool wcet = false;                     // Report the worst-case cycles of every function
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            map_file_name = argv[++i];
+        } else if (strcmp(argv[i], "-MD") == 0 && i + 1 < argc) {
+            dependency_file_name = argv[++i];
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            compress = true;
+        } else if (strcmp(argv[i], "--peephole") == 0) {
+            peephole = true;
+        } else if (strcmp(argv[i], "--strip-unreachable") == 0) {
+            strip = true;
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile_file_name = argv[++i];
+        } else if (strcmp(argv[i], "--block-layout") == 0) {
+            block_layout = true;
+        } else if (strcmp(argv[i], "--fusion") == 0 && i + 1 < argc) {
+            if (load_fusion_table(argv[++i]) != 0) return 1;
+            fusion = true;
+        } else if (strcmp(argv[i], "--literal-pool") == 0) {
+            literal_pool = true;
+        } else if (strcmp(argv[i], "--schedule") == 0) {
+            schedule = true;
+        } else if (strcmp(argv[i], "--load-latency") == 0 && i + 1 < argc) {
+            load_latency = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--alu-latency") == 0 && i + 1 < argc) {
+            alu_latency = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--branch-penalty") == 0 && i + 1 < argc) {
+            branch_penalty = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--listing") == 0 && i + 1 < argc) {
+            listing_file_name = argv[++i];
+        } else if (strcmp(argv[i], "--cfg-dot") == 0 && i + 1 < argc) {
+            dot_file_name = argv[++i];
+        } else if (strcmp(argv[i], "--cfg-json") == 0 && i + 1 < argc) {
+            json_file_name = argv[++i];
+        } else if (strcmp(argv[i], "--wcet") == 0) {
+            wcet = true;
+        } else if (strcmp(argv[i], "--align-loops") == 0 && i + 1 < argc) {
+            loop_alignment = atoi(argv[++i]);
+            if (loop_alignment < 2 || (loop_alignment & (loop_alignment - 1)) != 0) {
+                fprintf(stderr, "Loop alignment must be a power of two of at least 2 bytes\n");
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Invalid option. ");
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
     // Open the input file for reading
     FILE *input_file = fopen(input_file_name, "r");
     if (!input_file) {
@@ -35,65 +209,278 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    // Open the output file for writing
-    FILE *output_file = fopen(output_file_name, "w");
-    if (!output_file) {
-        // Display an error message if the output file cannot be opened
-        perror("Error opening output file");
-        fclose(input_file);  // Close the input file before exiting
-        return 1;
-    }
-    bool isHex = (strcmp(argv[3], "-h") == 0);
-    bool isBin = (strcmp(argv[3], "-b") == 0);
-    if (!isHex & !isBin ) {
-        fprintf(stderr, "Invalid Output flag. Usage: %s <input_file> <output_file> <-h|-b>\n", argv[0]);
-        return 1;
-    }
-
     char line[MAX_LINE_LENGTH];  // Buffer to hold each line from the input file
+    begin_preprocessor(input_file_name);
     // First pass: read each line, replacing commas and handling label definitions
-    while (fgets(line, sizeof(line), input_file)) {
+    bool complete;
+    while (read_line(line, sizeof(line), input_file, &complete)) {
+        source_line++;
+        if (!complete) {
+            fprintf(stderr, "Line too long at line %d: at most %d characters\n", source_line, MAX_LINE_LENGTH - 1);
+            error_count++;
+            continue;
+        }
+        read_annotations(line);
         removeComment(line);
         replaceCommas(line);   // Replace commas with spaces for easier processing
-        first_pass(line);      // Handle label resolution and symbol table population
+        preprocess_line(line); // Expand macros, then handle label resolution and record the instruction
     }
-
-    // Close the input and output files after the first pass
     fclose(input_file);
-    fclose(output_file);
+    check_data_labels();
+    if (end_preprocessor() > 0 || error_count > 0) return 1;
+    place_sections();  // The data follows the code
+    if (check_code_labels() > 0) return 1;  // Once place_sections has defined __global_pointer$
 
-    // Reopen the input file for the second pass
-    input_file = fopen(input_file_name, "r");
-    if (!input_file) {
-        perror("Error opening input file");
-        return 1;
+    // Every source file is known after the first pass, write the make rule if requested
+    if (dependency_file_name) {
+        FILE *dependency_file = fopen(dependency_file_name, "w");
+        if (!dependency_file) {
+            perror("Error opening dependency file");
+            return 1;
+        }
+        write_dependencies(dependency_file, output_file_name);
+        fclose(dependency_file);
     }
 
-    // Reopen the output file for writing the machine code
-    output_file = fopen(output_file_name, "w");
-    if (!output_file) {
-        perror("Error opening output file");
-        fclose(input_file);  // Close the input file before exiting
+    if (block_layout && !profile_file_name) {
+        fprintf(stderr, "The block layout needs an execution profile (--profile)\n");
+        return 1;
+    }
+    if (load_latency < 1 || alu_latency < 1 || branch_penalty < 0) {
+        fprintf(stderr, "Latencies must be at least 1 cycle and the branch penalty not negative\n");
         return 1;
     }
 
-    // Second pass: read each line again, assemble instructions into machine code
-    while (fgets(line, sizeof(line), input_file)) {
-        removeComment(line);
-        replaceCommas(line);   // Ensure commas are replaced again
-        unsigned int machine_code = assemble_instruction(line);  // Assemble the instruction to machine code
+    // Simplify the recorded instructions first, so the later passes see the final stream
+    if (fusion) fusion_snapshot();
+    if (peephole) {
+        PeepholeStats stats;
+        int removed = peephole_program(&stats);
+        fprintf(stderr, "Peephole: removed %d instructions (%d mv rd,rd, %d addi rd,rd,0, %d jumps to the next "
+                        "instruction), threaded %d jump chains\n", removed, stats.self_moves, stats.zero_adds,
+                stats.jumps_to_next, stats.threaded);
+    }
+    if (strip) {
+        int bytes, labels;
+        int removed = strip_unreachable(&bytes, &labels);
+        if (removed >= 0) {
+            fprintf(stderr, "Removed %d unreachable instructions (%d bytes) and %d labels\n", removed, bytes, labels);
+        }
+    }
+
+    // Profile-guided layout of functions and blocks, while every branch and jump still names its label
+    if (profile_file_name) {
+        if (load_profile(profile_file_name) != 0) return 1;
+        FunctionOrderStats stats;
+        if (order_functions(&stats) == 0) {
+            fprintf(stderr, "Function order: %d functions, %d hot units (%d bytes) spread over %d -> %d bytes, "
+                            "%d cold units moved to the end\n", stats.functions, stats.hot, stats.hot_bytes,
+                    stats.span_before, stats.span_after, stats.cold);
+        }
+    }
+    if (block_layout) {
+        BlockLayoutStats stats;
+        if (order_blocks(&stats) == 0) {
+            fprintf(stderr, "Block layout: %d branches inverted, %d jumps added, %d jumps removed, profiled "
+                            "branches taken %lld -> %lld times\n", stats.inverted, stats.inserted, stats.removed,
+                    stats.taken_before, stats.taken_after);
+        }
+    }
+
+    // Reorder the basic blocks before the layout fixes any address, fusion pairs first
+    int fusion_moves = fusion ? fuse_program() : 0;
+    if (schedule) {
+        int stalls_before, stalls_after;
+        int blocks = schedule_program(&stalls_before, &stalls_after);
+        fprintf(stderr, "Scheduled %d blocks: %d -> %d stall cycles (load latency %d, ALU latency %d)\n", blocks,
+                stalls_before, stalls_after, load_latency, alu_latency);
+    }
+    if (fusion) {
+        int created, broken;
+        int pairs = fusion_report(&created, &broken);
+        fprintf(stderr, "Fusion: %d adjacent pairs (%d created, %d broken), %d instructions moved\n", pairs, created,
+                broken, fusion_moves);
+    }
+
+    // Pools go after the last pass that moves instructions, so they stay after their jump
+    if (literal_pool) {
+        PoolStats stats;
+        build_literal_pools(compress, &stats);
+        fprintf(stderr, "Literal pool: %d constants loaded from %d entries in %d pools: %d -> %d instructions, "
+                        "%d -> %d bytes against inline lui+addi\n", stats.loads, stats.entries, stats.pools,
+                stats.inline_instructions, 2 * stats.loads, stats.inline_bytes, stats.pool_bytes);
+    }
+
+    // Single gp-relative accesses to the small data, before the relaxation sizes the code
+    int gp_saved = relax_gp();
+    if (gp_saved < 0) {
+        fprintf(stderr, "Small data accessed pc-relative: the program never loads __global_pointer$ into gp\n");
+    } else if (gp_saved > 0) {
+        fprintf(stderr, "Small data: %d accesses rewritten relative to gp, %d instructions (%d bytes) saved\n",
+                gp_saved, gp_saved, 4 * gp_saved);
+    }
 
-        // Output the machine code in hex or binary format based on the user's choice
-        if (isHex & machine_code) {
-            output_hex(machine_code, output_file);  // Output the machine code in hexadecimal format
-        } else if (isBin & machine_code) {
-            output_binary(machine_code, output_file);  // Output the machine code in binary format
+    // Choose the form of every instruction (compressed, or relaxed to reach its target) and assign addresses
+    int loop_heads = loop_alignment ? align_loop_heads(loop_alignment) : 0;
+    relax_program(compress);
+    if (error_count > 0) return 1;  // A branch or jump out of reach
+    int compressed = 0, relaxed_branches = 0, relaxed_jumps = 0, original_size = 0, padding = 0, instructions = 0;
+    for (int i = 0; i < instruction_count; i++) {
+        if (statements[i].kind != KIND_DATA) {
+            padding += statements[i].padding;  // Data is padded with zeros, not nops
+            instructions++;
         }
+        original_size += statements[i].padding;
+        if (statements[i].form == FORM_COMPRESSED) compressed++;
+        if (statements[i].form >= FORM_LONG && statements[i].kind == KIND_BRANCH) relaxed_branches++;
+        if (statements[i].form >= FORM_LONG && statements[i].kind == KIND_JUMP) relaxed_jumps++;
+        original_size += (statements[i].form == FORM_COMPRESSED) ? 4 : statements[i].size;
     }
+    int image_size = (instruction_count > 0)
+                         ? statements[instruction_count - 1].address + statements[instruction_count - 1].size
+                         : 0;
 
-    // Close the input and output files after the second pass
-    fclose(input_file);
-    fclose(output_file);
+    // All labels are known after the layout, write the symbol map if requested
+    if (map_file_name) {
+        FILE *map_file = fopen(map_file_name, "w");
+        if (!map_file) {
+            perror("Error opening map file");
+            return 1;
+        }
+        output_symbols(map_file);
+        fclose(map_file);
+    }
+
+    // The annotated listing needs the final addresses, known after the layout
+    if (listing_file_name) {
+        FILE *listing_file = fopen(listing_file_name, "w");
+        if (!listing_file) {
+            perror("Error opening listing file");
+            return 1;
+        }
+        int status = write_listing(listing_file, input_file_name);
+        fclose(listing_file);
+        if (status != 0) return status;
+    }
+
+    // The control-flow graph and the function bounds use the final forms too
+    if (dot_file_name || json_file_name || wcet) {
+        build_cfg();
+        const char *file_names[2] = { dot_file_name, json_file_name };
+        for (int f = 0; f < 2; f++) {
+            if (!file_names[f]) continue;
+            FILE *cfg_file = fopen(file_names[f], "w");
+            if (!cfg_file) {
+                perror("Error opening control-flow graph file");
+                return 1;
+            }
+            if (f == 0) {
+                output_cfg_dot(cfg_file);
+            } else {
+                output_cfg_json(cfg_file);
+            }
+            fclose(cfg_file);
+        }
+        if (wcet) output_wcet(stderr);
+    }
+
+    // Open the output file for writing (a shared-memory image is written at the end instead)
+    if (!isShm) {
+        output_file = fopen(output_file_name, isFlat ? "wb" : "w");
+        if (!output_file) {
+            // Display an error message if the output file cannot be opened
+            perror("Error opening output file");
+            return 1;
+        }
+    }
+
+    // Machine code bytes collected for the shared-memory image
+    if (isShm) {
+        image = malloc(image_size > 0 ? image_size : 1);
+        if (!image) {
+            perror("Error allocating machine code buffer");
+            return 1;
+        }
+    }
+
+    // Second pass: assemble every recorded instruction at its address
+    unsigned char *data = NULL;  // Bytes of the current data statement, with its zero padding
+    int data_capacity = 0;
+    for (int i = 0; i < instruction_count; i++) {
+        int address = statements[i].address - statements[i].padding;
+        if (blob_bytes(i)) {
+            // Included file: copied file to file into a flat binary, from its mapping otherwise
+            static const unsigned char zeros[16] = { 0 };
+            for (int p = 0; p < statements[i].padding; p += 16) {
+                int count = statements[i].padding - p;
+                write_data(zeros, count < 16 ? count : 16, address + p);
+            }
+            if (isFlat) {
+                if (copy_blob(i, output_file) != 0) return 1;
+            } else {
+                write_data(blob_bytes(i), statements[i].size, statements[i].address);
+            }
+            continue;
+        }
+        if (statements[i].kind == KIND_DATA) {
+            int size = statements[i].padding + statements[i].size;
+            if (size > data_capacity) {
+                data_capacity = size;
+                data = realloc(data, data_capacity);
+                if (!data) {
+                    perror("Error allocating data");
+                    return 1;
+                }
+            }
+            memset(data, 0, statements[i].padding);
+            encode_data(i, data + statements[i].padding);
+            write_data(data, size, address);
+            continue;
+        }
+        flush_data();
+
+        // Alignment padding: a c.nop for a 2-byte remainder, then canonical addi x0, x0, 0 nops
+        if (statements[i].padding % 4) {
+            write_code(NOP_COMPRESSED, 2, address);
+            address += 2;
+        }
+        while (address < statements[i].address) {
+            write_code(NOP, 4, address);
+            address += 4;
+        }
+
+        unsigned int codes[2];
+        int count = encode_statement(i, codes);  // Assemble the instruction to machine code
+        int size = (statements[i].form == FORM_COMPRESSED) ? 2 : 4;
+        for (int j = 0; j < count; j++) {
+            // Output the machine code in hex or binary format based on the user's choice
+            write_code(codes[j], size, address);
+            address += size;
+        }
+    }
+    flush_data();
+    free(data);
+    if (output_file) fclose(output_file);
+
+    if (padding > 0 || loop_heads > 0) {
+        fprintf(stderr, "Aligned %d loop heads, %d bytes of nop padding\n", loop_heads, padding);
+    }
+    if (relaxed_branches + relaxed_jumps > 0) {
+        fprintf(stderr, "Relaxed %d branches and %d jumps to reach out-of-range targets\n", relaxed_branches,
+                relaxed_jumps);
+    }
+    if (compress) {
+        fprintf(stderr, "Compressed %d of %d instructions: %d -> %d bytes (%.1f%% smaller)\n", compressed,
+                instructions, original_size, image_size,
+                original_size ? 100.0 * (original_size - image_size) / original_size : 0.0);
+    }
+
+    // Hand the whole image over in shared memory
+    if (isShm) {
+        int status = output_shared_memory(output_file_name, image, image_size);
+        free(image);
+        return status;
+    }
 
     return 0;  // Return success if everything executed correctly
 }
@@ -0,0 +1,733 @@
+/*
+ * RISC-V Assembler Control-Flow Graph
+ *
+ * This file builds the control-flow graph of the encoded program and bounds the
+ * worst-case cycles (WCET) of every function with the pipeline model of listing.c.
+ * A basic block starts at a label, an aligned instruction or after a branch or
+ * jump. Its successors depend on the instruction ending it:
+ *   - beq ... bgeu: the label (taken, plus the branch penalty) and the next block,
+ *   - j / jal x0: the label; a jump to itself ends the program ("done: j done"),
+ *   - jal rd (rd != x0): a call of the function at the label, then the next block,
+ *   - jalr x0 / jr / ret: none, the function returns,
+ *   - jalr rd (rd != x0): an indirect call, then the next block,
+ *   - anything else: the next block.
+ * Functions start at the first instruction and at every call target, and own the
+ * blocks reachable from their entry without following calls.
+ *
+ * Loops are found from back edges (an edge to a block dominating its source). Each
+ * loop needs a bound, the most times its body runs each time the loop is entered,
+ * given by ".loop_bound n" or a "# loop_bound n" comment on the loop head or on the
+ * branch closing the loop. Loops are then collapsed from the innermost outwards: a
+ * loop becomes one node costing bound - 1 times its longest iteration, which is left
+ * through the loop exits, each costing the longest path from the header to it: the
+ * body runs bound times, the last time up to an exit. The bound of the
+ * function is the longest path from its entry through the remaining acyclic graph,
+ * where a call costs the bound of the callee. A function with a loop without a
+ * bound, an irreducible loop, recursion or an indirect call has no bound.
+ */
+
+#include "assembler.h"
+
+// Structure holding one basic block of the graph
+typedef struct {
+    int first, last;        // First and last instruction of the block
+    int instructions;       // Machine instructions, alignment nops included
+    int cycles;             // Cycles in the pipeline model, including the penalty of a final jump
+    int taken;              // Successor when the branch or jump is taken, -1 if none
+    int fall;               // Successor when the block falls through, -1 if none
+    int taken_cost;         // Extra cycles of each edge (branch penalty)
+    int fall_cost;
+    int callee;             // Function called by the final jal, -1 if none
+    bool indirect_call;     // Ends with jalr rd (rd != x0)
+    bool returns;           // Ends with jalr x0 (ret, jr)
+    bool loop_header;       // Target of a back edge
+    int loop_bound;         // Annotated bound of the loop it heads, 0 if none
+    int function;           // Function owning the block, -1 if unreachable
+    const char *name;       // First label of the block, NULL if none
+} Block;
+
+// Structure holding one function of the graph and its bound
+typedef struct {
+    int entry;                    // Entry block
+    char name[MAX_LINE_LENGTH];   // Label of the entry, or its address
+    long long wcet;               // Worst-case cycles, -1 if there is no bound
+    char reason[2 * MAX_LINE_LENGTH]; // Why there is no bound
+    int state;                    // 0: not computed, 1: being computed, 2: done
+    int *blocks;                  // Blocks reachable from the entry, in depth-first order
+    int block_count;
+} Function;
+
+// Structure holding an edge of the graph being collapsed by function_bound
+typedef struct {
+    int to;          // Local index of the target node
+    long long cost;  // Cycles added by following the edge
+    int next;        // Next edge leaving the same node, -1 at the end
+    bool live;       // Removed edges are kept but ignored
+} Edge;
+
+// Structure holding a natural loop found by function_bound
+typedef struct {
+    int header;      // Local index of the header
+    int *body;       // Local indices of the body, header included
+    int size;
+    int *latches;    // Local indices of the blocks branching back to the header
+    int latch_count;
+} Loop;
+
+static Block *blocks = NULL;
+static int block_count = 0;
+static int *local = NULL;  // Local index of every block in the function being bounded, -1 outside
+static Function *functions = NULL;
+static int function_count = 0;
+
+// Returns the function starting at a block, adding it if it is new
+static int function_at(int block) {
+    for (int f = 0; f < function_count; f++) {
+        if (functions[f].entry == block) return f;
+    }
+    functions = realloc(functions, (function_count + 1) * sizeof(Function));
+    if (!functions) {
+        perror("Error allocating control-flow graph");
+        exit(1);
+    }
+    Function *function = &functions[function_count];
+    memset(function, 0, sizeof(*function));
+    function->entry = block;
+    if (blocks[block].name) {
+        snprintf(function->name, sizeof(function->name), "%s", blocks[block].name);
+    } else {
+        snprintf(function->name, sizeof(function->name), "0x%08X", statements[blocks[block].first].address);
+    }
+    return function_count++;
+}
+
+// Returns the block holding the instruction a label marks, -1 past the end of the program
+static int label_block(int label, const int *block_of) {
+    int statement = labelTable[label].statement;
+    return (statement < instruction_count) ? block_of[statement] : -1;
+}
+
+// Collects the blocks reachable from the entry of a function without following calls
+static void collect_blocks(Function *function) {
+    int *stack = malloc(block_count * sizeof(int));
+    int *seen = local;  // Scratch: marked with the function number
+    int mark = -2 - (int)(function - functions);
+    function->blocks = malloc(block_count * sizeof(int));
+    if (!stack || !function->blocks) {
+        perror("Error allocating control-flow graph");
+        exit(1);
+    }
+    int top = 0;
+    stack[top++] = function->entry;
+    seen[function->entry] = mark;
+    while (top > 0) {
+        int b = stack[--top];
+        function->blocks[function->block_count++] = b;
+        if (blocks[b].function < 0) blocks[b].function = (int)(function - functions);
+        int successors[2] = { blocks[b].fall, blocks[b].taken };
+        for (int s = 0; s < 2; s++) {
+            if (successors[s] >= 0 && seen[successors[s]] != mark) {
+                seen[successors[s]] = mark;
+                stack[top++] = successors[s];
+            }
+        }
+    }
+    function->blocks = realloc(function->blocks, (function->block_count + 1) * sizeof(int));
+    free(stack);
+}
+
+// Returns the representative of a node after the loops containing it were collapsed
+static int find_node(int *parent, int node) {
+    while (parent[node] != node) {
+        parent[node] = parent[parent[node]];
+        node = parent[node];
+    }
+    return node;
+}
+
+// Orders loops from the smallest body, so inner loops are collapsed first
+static int compare_loops(const void *a, const void *b) {
+    return ((const Loop *)a)->size - ((const Loop *)b)->size;
+}
+
+// Adds an edge between local nodes to the graph being collapsed
+static void add_edge(Edge **edges, int *edge_count, int *head, int from, int to, long long cost) {
+    if ((*edge_count & (*edge_count - 1)) == 0) {
+        // The capacity doubles whenever the count reaches a power of two
+        *edges = realloc(*edges, (*edge_count ? 2 * *edge_count : 1) * sizeof(Edge));
+        if (!*edges) {
+            perror("Error allocating control-flow graph");
+            exit(1);
+        }
+    }
+    Edge *edge = &(*edges)[*edge_count];
+    edge->to = to;
+    edge->cost = cost;
+    edge->next = head[from];
+    edge->live = true;
+    head[from] = (*edge_count)++;
+}
+
+/*
+ * Longest path through the acyclic graph formed by the given live nodes, from
+ * 'start' and without the edges to 'start' (the back edges of a loop).
+ *
+ * @param nodes: The nodes, each marked with mark[node] == stamp and numbered by slot[node].
+ * @param dist: Receives the longest path to each node (start included), -1 if unreached.
+ * @return: false if the nodes still contain a cycle (an irreducible loop).
+ */
+static bool longest_paths(const int *nodes, int count, int start, const int *mark, int stamp, int *slot,
+                          int *parent, const int *head, const Edge *edges, const long long *cost, long long *dist) {
+    int *indegree = calloc(count + 1, sizeof(int));
+    int *queue = malloc((count + 1) * sizeof(int));
+    if (!indegree || !queue) {
+        perror("Error allocating control-flow graph");
+        exit(1);
+    }
+    for (int k = 0; k < count; k++) {
+        slot[nodes[k]] = k;
+        dist[nodes[k]] = (nodes[k] == start) ? cost[start] : -1;
+    }
+    for (int k = 0; k < count; k++) {
+        for (int e = head[nodes[k]]; e >= 0; e = edges[e].next) {
+            int to = find_node(parent, edges[e].to);
+            if (edges[e].live && mark[to] == stamp && to != start) indegree[slot[to]]++;
+        }
+    }
+    int front = 0, back = 0;
+    for (int k = 0; k < count; k++) {
+        if (indegree[k] == 0) queue[back++] = nodes[k];
+    }
+    while (front < back) {
+        int node = queue[front++];
+        for (int e = head[node]; e >= 0; e = edges[e].next) {
+            int to = find_node(parent, edges[e].to);
+            if (!edges[e].live || mark[to] != stamp || to == start) continue;
+            if (dist[node] >= 0 && dist[node] + edges[e].cost + cost[to] > dist[to]) {
+                dist[to] = dist[node] + edges[e].cost + cost[to];
+            }
+            if (--indegree[slot[to]] == 0) queue[back++] = to;
+        }
+    }
+    free(indegree);
+    free(queue);
+    return back == count;
+}
+
+// Returns the loop bound annotated on the instructions of a block, 0 if none
+static int block_bound(int b) {
+    for (int i = blocks[b].first; i <= blocks[b].last; i++) {
+        if (statements[i].loop_bound > 0) return statements[i].loop_bound;
+    }
+    return 0;
+}
+
+/*
+ * Computes the worst-case cycles of a function, after the ones of its callees.
+ * Sets function->wcet, or -1 and function->reason when there is no bound.
+ */
+static void function_bound(Function *function) {
+    if (function->state == 2) return;
+    function->state = 1;
+    function->wcet = -1;
+    int n = function->block_count;
+
+    // The callees first, before the local numbering below is taken over
+    for (int k = 0; k < n; k++) {
+        Block *block = &blocks[function->blocks[k]];
+        if (block->indirect_call && !function->reason[0]) {
+            snprintf(function->reason, sizeof(function->reason), "indirect call at 0x%08X",
+                     statements[block->last].address);
+        }
+        if (block->callee < 0) continue;
+        Function *callee = &functions[block->callee];
+        if (callee->state == 1 && !function->reason[0]) {
+            snprintf(function->reason, sizeof(function->reason), "recursive call of %s", callee->name);
+        }
+        if (callee->state == 0) function_bound(callee);
+        if (callee->state == 2 && callee->wcet < 0 && !function->reason[0]) {
+            snprintf(function->reason, sizeof(function->reason), "calls %s, which has no bound", callee->name);
+        }
+    }
+
+    // Node costs: the block itself plus the bound of the function it calls
+    long long *cost = malloc(n * sizeof(long long));
+    if (!cost) {
+        perror("Error allocating control-flow graph");
+        exit(1);
+    }
+    for (int k = 0; k < n; k++) {
+        Block *block = &blocks[function->blocks[k]];
+        local[function->blocks[k]] = k;
+        cost[k] = block->cycles;
+        if (block->callee >= 0 && functions[block->callee].wcet > 0) cost[k] += functions[block->callee].wcet;
+    }
+
+    // Predecessors and reverse postorder, for the dominators
+    int *predecessor_start = calloc(n + 1, sizeof(int));
+    int *predecessors = malloc((2 * n + 1) * sizeof(int));
+    int *order = malloc(n * sizeof(int));      // Reverse postorder
+    int *rank = malloc(n * sizeof(int));       // Position in reverse postorder
+    int *idom = malloc(n * sizeof(int));
+    int *stack = malloc(n * sizeof(int));
+    int *child = calloc(n, sizeof(int));
+    if (!predecessor_start || !predecessors || !order || !rank || !idom || !stack || !child) {
+        perror("Error allocating control-flow graph");
+        exit(1);
+    }
+    for (int k = 0; k < n; k++) {
+        Block *block = &blocks[function->blocks[k]];
+        if (block->taken >= 0) predecessor_start[local[block->taken] + 1]++;
+        if (block->fall >= 0 && block->fall != block->taken) predecessor_start[local[block->fall] + 1]++;
+    }
+    for (int k = 0; k < n; k++) predecessor_start[k + 1] += predecessor_start[k];
+    int *filled = calloc(n, sizeof(int));
+    for (int k = 0; k < n; k++) {
+        Block *block = &blocks[function->blocks[k]];
+        int successors[2] = { block->taken, (block->fall != block->taken) ? block->fall : -1 };
+        for (int s = 0; s < 2; s++) {
+            if (successors[s] < 0) continue;
+            int to = local[successors[s]];
+            predecessors[predecessor_start[to] + filled[to]++] = k;
+        }
+    }
+    free(filled);
+    int top = 0, visited = n;
+    bool *seen = calloc(n, sizeof(bool));
+    stack[top++] = 0;
+    seen[0] = true;
+    while (top > 0) {
+        int k = stack[top - 1];
+        Block *block = &blocks[function->blocks[k]];
+        int successors[2] = { block->fall, block->taken };
+        if (child[k] < 2) {
+            int s = successors[child[k]++];
+            if (s >= 0 && !seen[local[s]]) {
+                seen[local[s]] = true;
+                stack[top++] = local[s];
+            }
+            continue;
+        }
+        order[--visited] = k;
+        top--;
+    }
+    for (int r = 0; r < n; r++) rank[order[r]] = r;
+    free(seen);
+
+    // Immediate dominators (Cooper, Harvey and Kennedy)
+    for (int k = 0; k < n; k++) idom[k] = -1;
+    idom[0] = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int r = 1; r < n; r++) {
+            int k = order[r], dominator = -1;
+            for (int p = predecessor_start[k]; p < predecessor_start[k + 1]; p++) {
+                int other = predecessors[p];
+                if (idom[other] < 0) continue;
+                if (dominator < 0) {
+                    dominator = other;
+                    continue;
+                }
+                while (dominator != other) {
+                    while (rank[dominator] > rank[other]) dominator = idom[dominator];
+                    while (rank[other] > rank[dominator]) other = idom[other];
+                }
+            }
+            if (dominator != idom[k]) {
+                idom[k] = dominator;
+                changed = true;
+            }
+        }
+    }
+
+    // Natural loops: the header, the blocks branching back to it and everything reaching them
+    Loop *loops = NULL;
+    int loop_count = 0;
+    int *mark = calloc(n, sizeof(int));
+    int stamp = 0;
+    for (int h = 0; h < n; h++) {
+        int latch_count = 0;
+        for (int p = predecessor_start[h]; p < predecessor_start[h + 1]; p++) {
+            int u = predecessors[p];
+            int d = u;
+            while (d != h && d != 0) d = idom[d];
+            if (d == h) stack[latch_count++] = u;
+        }
+        if (latch_count == 0) continue;
+        loops = realloc(loops, (loop_count + 1) * sizeof(Loop));
+        Loop *loop = &loops[loop_count++];
+        loop->header = h;
+        loop->latches = malloc(latch_count * sizeof(int));
+        loop->latch_count = latch_count;
+        memcpy(loop->latches, stack, latch_count * sizeof(int));
+        int capacity = 16;
+        loop->body = malloc(capacity * sizeof(int));
+        loop->size = 0;
+        stamp++;
+        mark[h] = stamp;
+        loop->body[loop->size++] = h;
+        for (int q = 0; q < loop->size; q++) {
+            // Walk back from the latches; the header stops the walk
+            int k = loop->body[q];
+            int first = (q == 0) ? 0 : predecessor_start[k];
+            int last = (q == 0) ? latch_count : predecessor_start[k + 1];
+            for (int p = first; p < last; p++) {
+                int u = (q == 0) ? loop->latches[p] : predecessors[p];
+                if (mark[u] == stamp) continue;
+                mark[u] = stamp;
+                if (loop->size == capacity) {
+                    capacity *= 2;
+                    loop->body = realloc(loop->body, capacity * sizeof(int));
+                }
+                loop->body[loop->size++] = u;
+            }
+        }
+        // The bound is annotated on the head or on a branch closing the loop
+        Block *header = &blocks[function->blocks[h]];
+        header->loop_header = true;
+        header->loop_bound = block_bound(function->blocks[h]);
+        for (int l = 0; l < latch_count && header->loop_bound == 0; l++) {
+            header->loop_bound = block_bound(function->blocks[loop->latches[l]]);
+        }
+    }
+    qsort(loops, loop_count, sizeof(Loop), compare_loops);
+
+    // Graph being collapsed: the edges of the blocks, then every loop into its header
+    Edge *edges = NULL;
+    int edge_count = 0;
+    int *head = malloc(n * sizeof(int));
+    int *parent = malloc(n * sizeof(int));
+    long long *dist = malloc(n * sizeof(long long));
+    int *nodes = malloc(n * sizeof(int));
+    int *slot = malloc(n * sizeof(int));
+    if (!head || !parent || !dist || !nodes || !slot) {
+        perror("Error allocating control-flow graph");
+        exit(1);
+    }
+    for (int k = 0; k < n; k++) {
+        head[k] = -1;
+        parent[k] = k;
+        Block *block = &blocks[function->blocks[k]];
+        if (block->fall >= 0) add_edge(&edges, &edge_count, head, k, local[block->fall], block->fall_cost);
+        if (block->taken >= 0) add_edge(&edges, &edge_count, head, k, local[block->taken], block->taken_cost);
+    }
+    for (int l = 0; l < loop_count && !function->reason[0]; l++) {
+        Loop *loop = &loops[l];
+        int h = loop->header;
+        Block *header = &blocks[function->blocks[h]];
+        if (header->loop_bound == 0) {
+            snprintf(function->reason, sizeof(function->reason), "loop at %s%s0x%08X has no loop_bound annotation",
+                     header->name ? header->name : "", header->name ? " " : "", statements[header->first].address);
+            break;
+        }
+        stamp++;
+        int count = 0;
+        for (int q = 0; q < loop->size; q++) {
+            int r = find_node(parent, loop->body[q]);
+            if (mark[r] != stamp) {
+                mark[r] = stamp;
+                nodes[count++] = r;
+            }
+        }
+        if (!longest_paths(nodes, count, h, mark, stamp, slot, parent, head, edges, cost, dist)) {
+            snprintf(function->reason, sizeof(function->reason), "irreducible loop at 0x%08X",
+                     statements[header->first].address);
+            break;
+        }
+        // An iteration ends with a branch back to the header; the last pass leaves through an exit
+        long long iteration = 0;
+        int exit_first = edge_count;
+        for (int q = 0; q < count; q++) {
+            int r = nodes[q];
+            for (int e = head[r]; e >= 0; e = edges[e].next) {
+                if (!edges[e].live || dist[r] < 0) continue;
+                int to = find_node(parent, edges[e].to);
+                if (to == h && mark[to] == stamp) {
+                    if (dist[r] + edges[e].cost > iteration) iteration = dist[r] + edges[e].cost;
+                } else if (mark[to] != stamp) {
+                    add_edge(&edges, &edge_count, head, h, to, dist[r] + edges[e].cost);
+                }
+            }
+        }
+        for (int q = 0; q < count; q++) {
+            for (int e = head[nodes[q]]; e >= 0; e = edges[e].next) {
+                if (e < exit_first) edges[e].live = false;
+            }
+            parent[nodes[q]] = h;
+        }
+        cost[h] = (header->loop_bound - 1) * iteration;  // The exit edges carry the last pass
+    }
+
+    // Longest path from the entry through what is left
+    if (!function->reason[0]) {
+        int count = 0;
+        stamp++;
+        for (int k = 0; k < n; k++) {
+            if (find_node(parent, k) == k) {
+                mark[k] = stamp;
+                nodes[count++] = k;
+            }
+        }
+        if (!longest_paths(nodes, count, 0, mark, stamp, slot, parent, head, edges, cost, dist)) {
+            snprintf(function->reason, sizeof(function->reason), "irreducible loop");
+        } else {
+            function->wcet = 0;
+            for (int q = 0; q < count; q++) {
+                if (dist[nodes[q]] > function->wcet) function->wcet = dist[nodes[q]];
+            }
+        }
+    }
+
+    for (int l = 0; l < loop_count; l++) {
+        free(loops[l].body);
+        free(loops[l].latches);
+    }
+    free(loops);
+    free(edges);
+    free(head);
+    free(parent);
+    free(dist);
+    free(nodes);
+    free(slot);
+    free(mark);
+    free(predecessor_start);
+    free(predecessors);
+    free(order);
+    free(rank);
+    free(idom);
+    free(stack);
+    free(child);
+    for (int k = 0; k < n; k++) local[function->blocks[k]] = -1;
+    free(cost);
+    function->state = 2;
+}
+
+/*
+ * Builds the control-flow graph of the program and the worst-case cycles of every
+ * function. Must run after relax_program, when the forms and addresses are final.
+ *
+ * @return: The number of functions.
+ */
+int build_cfg(void) {
+    for (int f = 0; f < function_count; f++) free(functions[f].blocks);
+    free(functions);
+    free(blocks);
+    free(local);
+    functions = NULL;
+    local = NULL;
+    function_count = 0;
+    blocks = NULL;
+    block_count = 0;
+    if (instruction_count == 0) return 0;
+
+    // Blocks start at labels and aligned instructions, and after branches and jumps
+    StatementInfo *infos = malloc(instruction_count * sizeof(StatementInfo));
+    bool *starts = calloc(instruction_count + 1, sizeof(bool));
+    const char **names = calloc(instruction_count + 1, sizeof(char *));
+    int *block_of = malloc(instruction_count * sizeof(int));
+    blocks = malloc(instruction_count * sizeof(Block));
+    if (!infos || !starts || !names || !block_of || !blocks) {
+        perror("Error allocating control-flow graph");
+        exit(1);
+    }
+    for (int i = 0; i < labelCount; i++) {
+        starts[labelTable[i].statement] = true;
+        if (!names[labelTable[i].statement]) names[labelTable[i].statement] = labelTable[i].label;
+    }
+    for (int i = 0; i < instruction_count; i++) {
+        describe_statement(i, &infos[i]);
+        if (statements[i].align > 1) starts[i] = true;
+        if (infos[i].is_control) starts[i + 1] = true;
+    }
+    PipelineState pipeline;
+    for (int i = 0; i < instruction_count; i++) {
+        if (starts[i] || i == 0) {
+            Block *block = &blocks[block_count++];
+            memset(block, 0, sizeof(*block));
+            block->first = i;
+            block->taken = block->fall = block->callee = block->function = -1;
+            block->name = names[i];
+            pipeline_reset(&pipeline);
+        }
+        Block *block = &blocks[block_count - 1];
+        PipelineIssue issue;
+        pipeline_issue(&pipeline, i, &infos[i], &issue);
+        block->last = i;
+        block->instructions += issue.instructions;
+        block->cycles = pipeline.time + 1;
+        block_of[i] = block_count - 1;
+    }
+
+    // Successors from the instruction ending each block; the program entry is the first function
+    function_at(0);
+    for (int b = 0; b < block_count; b++) {
+        Block *block = &blocks[b];
+        Statement *last = &statements[block->last];
+        StatementInfo *info = &infos[block->last];
+        unsigned int opcode = info->code & 0x7F;
+        int next = (b + 1 < block_count) ? b + 1 : -1;
+        int target = (last->target >= 0 && (last->kind == KIND_BRANCH || last->kind == KIND_JUMP))
+                         ? label_block(last->target, block_of)
+                         : -1;
+        if (!info->is_control) {
+            block->fall = next;
+        } else if (opcode == 0b1100011) {
+            block->taken = target;
+            block->fall = next;
+            block->taken_cost = branch_penalty;
+            // A relaxed branch jumps on both paths: over the jump, or through it
+            block->fall_cost = (last->form >= FORM_LONG) ? branch_penalty : 0;
+        } else if (opcode == 0b1101111) {
+            block->cycles += branch_penalty;
+            if (info->rd != 0 && target >= 0) {
+                block->callee = function_at(target);
+                block->fall = next;
+            } else if (info->rd == 0 && target >= 0 && labelTable[last->target].statement != block->last) {
+                block->taken = target;  // A jump to itself ends the program
+            }
+        } else {
+            block->cycles += branch_penalty;
+            if (info->rd != 0) {
+                block->indirect_call = true;
+                block->fall = next;
+            } else {
+                block->returns = true;
+            }
+        }
+    }
+    local = malloc(block_count * sizeof(int));
+    if (!local) {
+        perror("Error allocating control-flow graph");
+        exit(1);
+    }
+    for (int b = 0; b < block_count; b++) local[b] = -1;
+    for (int f = 0; f < function_count; f++) collect_blocks(&functions[f]);
+    for (int b = 0; b < block_count; b++) local[b] = -1;
+    for (int f = 0; f < function_count; f++) function_bound(&functions[f]);
+
+    free(infos);
+    free(starts);
+    free(names);
+    free(block_of);
+    return function_count;
+}
+
+// Writes the name of a block (its label, or its address) to a file
+static void print_block_name(FILE *file, const Block *block) {
+    if (block->name) {
+        fprintf(file, "%s", block->name);
+    } else {
+        fprintf(file, "0x%08X", statements[block->first].address);
+    }
+}
+
+/*
+ * Outputs the control-flow graph in Graphviz DOT format, one cluster per function.
+ * Solid edges are taken branches and jumps, dotted ones fall through, dashed ones calls.
+ */
+void output_cfg_dot(FILE *dot_file) {
+    fprintf(dot_file, "digraph cfg {\n");
+    fprintf(dot_file, "    node [shape=box, fontname=\"monospace\"];\n");
+    for (int f = 0; f < function_count; f++) {
+        Function *function = &functions[f];
+        fprintf(dot_file, "    subgraph cluster_%d {\n", f);
+        if (function->wcet >= 0) {
+            fprintf(dot_file, "        label=\"%s: WCET %lld cycles\";\n", function->name, function->wcet);
+        } else {
+            fprintf(dot_file, "        label=\"%s: no bound (%s)\";\n", function->name, function->reason);
+        }
+        for (int k = 0; k < function->block_count; k++) {
+            int b = function->blocks[k];
+            Block *block = &blocks[b];
+            if (block->function != f) continue;  // Drawn with the function that reached it first
+            Statement *last = &statements[block->last];
+            fprintf(dot_file, "        B%d [label=\"", b);
+            print_block_name(dot_file, block);
+            fprintf(dot_file, "\\n0x%08X-0x%08X\\n%d instructions, %d cycles", statements[block->first].address,
+                    last->address + last->size, block->instructions, block->cycles);
+            if (block->loop_header && block->loop_bound > 0) fprintf(dot_file, "\\nloop bound %d", block->loop_bound);
+            if (block->loop_header && block->loop_bound == 0) fprintf(dot_file, "\\nloop without bound");
+            fprintf(dot_file, "\"%s];\n", block->loop_header ? ", peripheries=2" : "");
+        }
+        fprintf(dot_file, "    }\n");
+    }
+    for (int b = 0; b < block_count; b++) {
+        Block *block = &blocks[b];
+        if (block->taken >= 0) fprintf(dot_file, "    B%d -> B%d [label=\"taken\"];\n", b, block->taken);
+        if (block->fall >= 0) fprintf(dot_file, "    B%d -> B%d [style=dotted];\n", b, block->fall);
+        if (block->callee >= 0) {
+            fprintf(dot_file, "    B%d -> B%d [style=dashed, label=\"call\"];\n", b, functions[block->callee].entry);
+        }
+    }
+    fprintf(dot_file, "}\n");
+}
+
+/*
+ * Outputs the control-flow graph as JSON: the functions with their bound and blocks,
+ * and the blocks with their address range, cost and successors.
+ */
+void output_cfg_json(FILE *json_file) {
+    fprintf(json_file, "{\n  \"branch_penalty\": %d,\n  \"functions\": [", branch_penalty);
+    for (int f = 0; f < function_count; f++) {
+        Function *function = &functions[f];
+        fprintf(json_file, "%s\n    {\"name\": \"%s\", \"entry\": %d, \"wcet\": ", f ? "," : "", function->name,
+                function->entry);
+        if (function->wcet >= 0) {
+            fprintf(json_file, "%lld", function->wcet);
+        } else {
+            fprintf(json_file, "null, \"reason\": \"%s\"", function->reason);
+        }
+        fprintf(json_file, ", \"blocks\": [");
+        for (int k = 0; k < function->block_count; k++) {
+            fprintf(json_file, "%s%d", k ? ", " : "", function->blocks[k]);
+        }
+        fprintf(json_file, "]}");
+    }
+    fprintf(json_file, "\n  ],\n  \"blocks\": [");
+    for (int b = 0; b < block_count; b++) {
+        Block *block = &blocks[b];
+        Statement *last = &statements[block->last];
+        fprintf(json_file, "%s\n    {\"id\": %d, \"name\": \"", b ? "," : "", b);
+        print_block_name(json_file, block);
+        fprintf(json_file, "\", \"start\": %d, \"end\": %d, \"first_line\": %d, \"last_line\": %d, "
+                           "\"instructions\": %d, \"cycles\": %d, \"successors\": [",
+                statements[block->first].address, last->address + last->size, statements[block->first].line,
+                last->line, block->instructions, block->cycles);
+        int printed = 0;
+        if (block->taken >= 0) {
+            fprintf(json_file, "{\"block\": %d, \"kind\": \"taken\", \"cost\": %d}", block->taken, block->taken_cost);
+            printed++;
+        }
+        if (block->fall >= 0) {
+            fprintf(json_file, "%s{\"block\": %d, \"kind\": \"fall\", \"cost\": %d}", printed ? ", " : "", block->fall,
+                    block->fall_cost);
+        }
+        fprintf(json_file, "]");
+        if (block->callee >= 0) fprintf(json_file, ", \"call\": \"%s\"", functions[block->callee].name);
+        if (block->indirect_call) fprintf(json_file, ", \"indirect_call\": true");
+        if (block->returns) fprintf(json_file, ", \"returns\": true");
+        if (block->loop_header) {
+            if (block->loop_bound > 0) {
+                fprintf(json_file, ", \"loop_bound\": %d", block->loop_bound);
+            } else {
+                fprintf(json_file, ", \"loop_bound\": null");
+            }
+        }
+        fprintf(json_file, "}");
+    }
+    fprintf(json_file, "\n  ]\n}\n");
+}
+
+// Outputs the worst-case cycles of every function, one line each
+void output_wcet(FILE *report_file) {
+    for (int f = 0; f < function_count; f++) {
+        Function *function = &functions[f];
+        int address = statements[blocks[function->entry].first].address;
+        if (function->wcet >= 0) {
+            fprintf(report_file, "WCET %s at 0x%08X: %lld cycles\n", function->name, address, function->wcet);
+        } else {
+            fprintf(report_file, "WCET %s at 0x%08X: no bound, %s\n", function->name, address, function->reason);
+        }
+    }
+}
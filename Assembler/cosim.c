@@ -0,0 +1,206 @@
+/*
+ * RISC-V Simulator Lockstep Co-simulation
+ *
+ * This file compares the simulator against a commit log produced by an RTL
+ * simulation. The log has one line per retired instruction:
+ *
+ *     <pc> <instruction> <rd> <value>
+ *
+ * All fields are hexadecimal with an optional "0x" prefix, rd may also be written
+ * as "xN", and fields may be separated by spaces, tabs or commas. rd is the
+ * register written by the instruction, 0 if none (the value is then ignored).
+ * Blank lines and lines starting with '#' are skipped. The log is read in large
+ * blocks and parsed in place so whole regression logs can be checked quickly.
+ */
+
+#include "simulator.h"
+
+#define COSIM_BUFFER_SIZE (1 << 20)  // Bytes of the commit log read at a time
+#define COSIM_MAX_LINE 256           // Longest record line accepted
+
+static FILE *cosim_file = NULL;
+static const char *cosim_file_name = NULL;
+static char *cosim_buffer = NULL;
+static size_t cosim_start = 0;       // First unparsed byte of the buffer
+static size_t cosim_end = 0;         // End of the valid data in the buffer
+static bool cosim_eof = false;       // True once the whole file has been read
+static unsigned long long cosim_line = 0;     // Line number of the last parsed record
+static unsigned long long cosim_matched = 0;  // Records compared successfully
+
+// Value of each hexadecimal digit, -1 for any other character
+static signed char hex_value[256];
+
+// Structure holding one record of the commit log
+typedef struct {
+    unsigned int pc;
+    unsigned int instruction;
+    unsigned int rd;
+    unsigned int value;
+} CommitRecord;
+
+/*
+ * Opens the commit log to compare against.
+ *
+ * @param file_name: The commit log produced by the RTL simulation.
+ * @return: 0 on success, 1 if the file cannot be opened.
+ */
+int cosim_open(const char *file_name) {
+    cosim_file = fopen(file_name, "rb");
+    if (!cosim_file) {
+        perror("Error opening commit log");
+        return 1;
+    }
+    cosim_file_name = file_name;
+    cosim_buffer = malloc(COSIM_BUFFER_SIZE + 1);
+    if (!cosim_buffer) {
+        perror("Error allocating commit log buffer");
+        exit(1);
+    }
+    memset(hex_value, -1, sizeof(hex_value));
+    for (int digit = 0; digit < 10; digit++) hex_value['0' + digit] = digit;
+    for (int digit = 0; digit < 6; digit++) {
+        hex_value['a' + digit] = 10 + digit;
+        hex_value['A' + digit] = 10 + digit;
+    }
+    return 0;
+}
+
+// Moves the unparsed tail of the buffer to the front and reads the next block after it
+static void cosim_fill(void) {
+    size_t remaining = cosim_end - cosim_start;
+    memmove(cosim_buffer, cosim_buffer + cosim_start, remaining);
+    cosim_start = 0;
+    cosim_end = remaining;
+    size_t read = fread(cosim_buffer + cosim_end, 1, COSIM_BUFFER_SIZE - cosim_end, cosim_file);
+    cosim_end += read;
+    cosim_buffer[cosim_end] = '\0';  // Parsing stops at the end of the valid data
+    if (read == 0) cosim_eof = true;
+}
+
+// Skips field separators (spaces, tabs, commas and carriage returns)
+static const char *skip_separators(const char *text) {
+    while (*text == ' ' || *text == '\t' || *text == ',' || *text == '\r') text++;
+    return text;
+}
+
+/*
+ * Parses one hexadecimal field.
+ *
+ * @param text: Points at the field, advanced past it on return.
+ * @param value: Receives the value of the field.
+ * @return: true if at least one hexadecimal digit was found.
+ */
+static bool parse_hex(const char **text, unsigned int *value) {
+    const char *p = skip_separators(*text);
+    unsigned int result = 0;
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+    const char *digits = p;
+    while (hex_value[(unsigned char)*p] >= 0) {
+        result = (result << 4) | (unsigned int)hex_value[(unsigned char)*p];
+        p++;
+    }
+    *text = p;
+    *value = result;
+    return p != digits;
+}
+
+/*
+ * Reads the next record of the commit log. The fields are parsed directly from
+ * the buffer, which always holds at least COSIM_MAX_LINE bytes unless the end of
+ * the file is near, so each byte of the log is examined only once.
+ *
+ * @param record: Receives the parsed record.
+ * @return: 1 if a record was read, 0 at the end of the log, -1 on a malformed line.
+ */
+static int cosim_next(CommitRecord *record) {
+    for (;;) {
+        if (cosim_end - cosim_start < COSIM_MAX_LINE && !cosim_eof) cosim_fill();
+        if (cosim_start == cosim_end) return 0;
+
+        const char *line = cosim_buffer + cosim_start;
+        const char *text = skip_separators(line);
+        cosim_line++;
+        if (*text == '\n' || *text == '\0' || *text == '#') {
+            // Blank or comment line: skip to the next one
+            const char *newline = memchr(text, '\n', cosim_end - (text - cosim_buffer));
+            cosim_start = newline ? (size_t)(newline + 1 - cosim_buffer) : cosim_end;
+            continue;
+        }
+
+        bool valid = parse_hex(&text, &record->pc) && parse_hex(&text, &record->instruction);
+        text = skip_separators(text);
+        if (*text == 'x') {
+            // Register written as "xN"
+            text++;
+            record->rd = 0;
+            const char *digits = text;
+            while (*text >= '0' && *text <= '9') record->rd = record->rd * 10 + (*text++ - '0');
+            valid = valid && text != digits;
+        } else {
+            valid = valid && parse_hex(&text, &record->rd);
+        }
+        valid = valid && parse_hex(&text, &record->value);
+        text = skip_separators(text);
+        if (*text == '\n') {
+            text++;
+        } else if (*text != '\0' || (size_t)(text - cosim_buffer) != cosim_end) {
+            valid = false;  // Trailing characters, or a line longer than COSIM_MAX_LINE
+        }
+        cosim_start = text - cosim_buffer;
+        return (valid && record->rd < 32) ? 1 : -1;
+    }
+}
+
+/*
+ * Compares one retired instruction with the next record of the commit log.
+ *
+ * @param retired: The instruction retired by the simulator.
+ * @return: COSIM_MATCH if they agree, COSIM_END if the log is exhausted, or
+ *          COSIM_MISMATCH after printing the first divergence.
+ */
+int cosim_record(const Retired *retired) {
+    CommitRecord record;
+    int status = cosim_next(&record);
+
+    if (status == 0) return COSIM_END;
+    if (status < 0) {
+        fprintf(stderr, "Malformed commit log record at %s:%llu\n", cosim_file_name, cosim_line);
+        return COSIM_MISMATCH;
+    }
+    if (record.pc == retired->pc && record.instruction == retired->instruction && record.rd == retired->rd &&
+        (record.rd == 0 || record.value == retired->value)) {
+        cosim_matched++;
+        return COSIM_MATCH;
+    }
+
+    fprintf(stderr, "Divergence at retirement %llu (%s:%llu):\n", cosim_matched + 1, cosim_file_name, cosim_line);
+    fprintf(stderr, "  rtl:       pc 0x%08X instruction 0x%08X rd x%-2u value 0x%08X\n",
+            record.pc, record.instruction, record.rd, record.value);
+    fprintf(stderr, "  simulator: pc 0x%08X instruction 0x%08X rd x%-2u value 0x%08X\n",
+            retired->pc, retired->instruction, retired->rd, retired->value);
+    return COSIM_MISMATCH;
+}
+
+// Returns true if the commit log still holds records after the simulator stopped
+bool cosim_pending(void) {
+    CommitRecord record;
+    return cosim_next(&record) != 0;
+}
+
+// Prints the number of records compared and closes the commit log
+void cosim_report(FILE *output_file) {
+    fprintf(output_file, "Co-simulation: %llu retirements matched %s\n", cosim_matched, cosim_file_name);
+    fclose(cosim_file);
+    free(cosim_buffer);
+}
+
+/*
+ * Writes one retired instruction in the commit log format, so the simulator can
+ * produce golden logs for the RTL or for later comparisons.
+ *
+ * @param trace_file: The file the record is appended to.
+ * @param retired: The retired instruction.
+ */
+void trace_record(FILE *trace_file, const Retired *retired) {
+    fprintf(trace_file, "0x%08x 0x%08x x%u 0x%08x\n", retired->pc, retired->instruction, retired->rd, retired->value);
+}
@@ -0,0 +1,571 @@
+/*
+ * RISC-V Assembler Data Sections
+ *
+ * This file contains the section and data directives of the first pass and the
+ * placement of the data after the code. Statements are recorded into the current
+ * section (.text, .data, .sdata or .sbss, also as ".section <name>"); place_sections
+ * then moves the data sections behind the code, in that order, so the program still
+ * starts with its first instruction.
+ *
+ * The values of .word, .half and .byte (numbers, or labels for .word) and the
+ * characters of .string/.asciz/.ascii are parsed once, in a single walk over the
+ * line, into one growing byte arena; .space/.zero take no room there at all. The
+ * output copies the bytes from the arena, patching in the label addresses once the
+ * layout is known. .sbss only holds zeros.
+ *
+ * .incbin "file"[, offset[, length]] includes a region of a binary file, found like
+ * the files of .include. The first pass only takes its size from the file system; the
+ * bytes are mapped (mmap) when the output needs them, and a flat binary output gets
+ * them copied file to file (copy_file_range), so large blobs are never read into
+ * buffers or parsed. A file that cannot be included fails the run.
+ *
+ * When there is small data, __global_pointer$ is defined GP_OFFSET bytes into it, so
+ * gp reaches the whole window of +-2 KiB around it with a 12-bit offset. Once the
+ * program loads it ("la gp, __global_pointer$"), relax_gp rewrites every access to a
+ * data symbol inside that window into a single gp-relative instruction:
+ *   la rd, symbol          auipc+addi  ->  addi rd, gp, offset
+ *   lw rd, symbol          auipc+lw    ->  lw rd, offset(gp)      (lb, lbu, lh, lhu too)
+ *   sw rs, symbol, rt      auipc+sw    ->  sw rs, offset(gp)      (sb, sh too)
+ * The data sections follow the code and start aligned to the largest alignment used
+ * in them, so the distance between gp and a data symbol does not change when the
+ * relaxation later resizes the code.
+ */
+
+#define _GNU_SOURCE  // copy_file_range, with mmap and sysconf
+
+#include "assembler.h"
+#include <fcntl.h>     // open
+#include <sys/mman.h>  // mmap
+#include <sys/stat.h>  // stat
+#include <unistd.h>    // copy_file_range, sysconf and close
+
+#define GP_SYMBOL "__global_pointer$"
+#define GP_OFFSET 0x800  // Distance of __global_pointer$ from the start of the small data
+
+// Directive names of the sections, in SECTION_* order
+static const char *section_names[SECTION_COUNT] = { ".text", ".data", ".sdata", ".sbss" };
+
+// Bytes of all data statements, in the order the first pass parsed them
+static unsigned char *data_arena = NULL;
+static int data_arena_size = 0, data_arena_capacity = 0;
+
+// Structure holding a label operand of .word, filled in once the layout is known
+typedef struct {
+    int offset;   // Offset of the word in the data arena
+    char *label;  // Label name
+    int line;     // Source line of the .word
+} DataReference;
+
+// Label operands of .word, by increasing arena offset
+static DataReference *references = NULL;
+static int reference_count = 0, reference_capacity = 0;
+
+// Structure describing the file region included by an .incbin
+typedef struct {
+    char *path;
+    long offset;                // First byte of the region in the file
+    long length;                // Bytes of the region
+    const unsigned char *map;   // Mapping of the region once the output needs it, NULL before
+    size_t map_size;            // Bytes mapped, from the page holding the first byte
+    size_t map_skip;            // Bytes of that page before the region
+} Blob;
+
+static Blob *blobs = NULL;
+static int blob_count = 0, blob_capacity = 0;
+
+// Loads and stores that have a "symbol" form (see the pseudo-instruction table)
+static const char *symbol_loads[] = { "lb", "lbu", "lh", "lhu", "lw", NULL };
+static const char *symbol_stores[] = { "sb", "sh", "sw", NULL };
+
+// Returns true if the name is in the NULL-terminated list
+static bool is_one_of(const char *name, const char **list) {
+    for (int i = 0; list[i]; i++) {
+        if (strcmp(name, list[i]) == 0) return true;
+    }
+    return false;
+}
+
+// Returns the section named by a directive (".sdata", or a subsection such as ".sdata.counter"), -1 if none
+static int find_section(const char *name) {
+    for (int s = 0; s < SECTION_COUNT; s++) {
+        size_t length = strlen(section_names[s]);
+        if (strncmp(name, section_names[s], length) == 0 && (name[length] == '\0' || name[length] == '.')) {
+            return s;
+        }
+    }
+    return -1;
+}
+
+// Grows the data arena to hold size more bytes; returns where they go
+static unsigned char *reserve_data(int size) {
+    if (data_arena_size + size > data_arena_capacity) {
+        while (data_arena_size + size > data_arena_capacity) {
+            data_arena_capacity = data_arena_capacity ? 2 * data_arena_capacity : 4096;
+        }
+        data_arena = realloc(data_arena, data_arena_capacity);
+        if (!data_arena) {
+            perror("Error allocating data");
+            exit(1);
+        }
+    }
+    data_arena_size += size;
+    return data_arena + data_arena_size - size;
+}
+
+/*
+ * Stores the bytes of a data statement in the data arena.
+ *
+ * @param bytes: The bytes, in memory order.
+ * @param size: The number of bytes.
+ * @return: The offset of the bytes in the arena (the data field of the statement).
+ */
+int add_data(const unsigned char *bytes, int size) {
+    memcpy(reserve_data(size), bytes, size);
+    return data_arena_size - size;
+}
+
+// Records a label operand of the .word stored at the given arena offset
+static void add_reference(int offset, const char *label, int length) {
+    if (reference_count == reference_capacity) {
+        reference_capacity = reference_capacity ? 2 * reference_capacity : 64;
+        references = realloc(references, reference_capacity * sizeof(DataReference));
+        if (!references) {
+            perror("Error allocating data");
+            exit(1);
+        }
+    }
+    references[reference_count].offset = offset;
+    references[reference_count].label = malloc(length + 1);
+    if (!references[reference_count].label) {
+        perror("Error allocating data");
+        exit(1);
+    }
+    memcpy(references[reference_count].label, label, length);
+    references[reference_count].label[length] = '\0';
+    references[reference_count].line = source_line;
+    reference_count++;
+}
+
+/*
+ * Parses the operands of .word, .half or .byte straight into the arena, little-endian.
+ * Numbers are decimal, 0x hexadecimal or 0 octal; .word also takes labels.
+ *
+ * @param cursor: The operands (separated by spaces, commas already replaced).
+ * @param width: The size of one value in bytes (4, 2 or 1).
+ * @return: The number of bytes, or -1 if an operand is not a value or does not fit
+ *          in the width, signed or unsigned.
+ */
+static int parse_values(const char *cursor, int width) {
+    int size = 0;
+    while (true) {
+        while (isspace((unsigned char)*cursor)) cursor++;
+        if (*cursor == '\0') return size;
+        unsigned long value = 0;
+        if (width == 4 && (isalpha((unsigned char)*cursor) || *cursor == '_' || *cursor == '.' || *cursor == '$')) {
+            const char *end = cursor;
+            while (*end && !isspace((unsigned char)*end)) end++;
+            add_reference(data_arena_size, cursor, end - cursor);  // Filled in by encode_data
+            cursor = end;
+        } else {
+            char *end;
+            long int number = strtol(cursor, &end, 0);
+            if (end == cursor || (*end && !isspace((unsigned char)*end))) return -1;
+            if (number < -(1LL << (8 * width - 1)) || number > (1LL << (8 * width)) - 1) return -1;
+            value = (unsigned long)number;
+            cursor = end;
+        }
+        unsigned char *bytes = reserve_data(width);
+        for (int b = 0; b < width; b++) bytes[b] = (value >> (8 * b)) & 0xFF;
+        size += width;
+    }
+}
+
+/*
+ * Parses the string literals of .string, .asciz or .ascii into the arena. The escapes
+ * \n, \t, \r, \0, \\, \" and \' are understood.
+ *
+ * @param cursor: The operands, one or more "..." literals.
+ * @param terminate: true to end every string with a zero byte (.string, .asciz).
+ * @return: The number of bytes, or -1 if an operand is not a string literal.
+ */
+static int parse_strings(const char *cursor, bool terminate) {
+    int size = 0;
+    while (true) {
+        while (isspace((unsigned char)*cursor)) cursor++;
+        if (*cursor == '\0') return size;
+        if (*cursor++ != '"') return -1;
+        for (; *cursor != '"'; cursor++) {
+            if (*cursor == '\0') return -1;  // Unterminated
+            char c = *cursor;
+            if (c == '\\') {
+                cursor++;
+                c = (*cursor == 'n') ? '\n' : (*cursor == 't') ? '\t' : (*cursor == 'r') ? '\r' :
+                    (*cursor == '0') ? '\0' : *cursor;
+                if (c == '\0' && *cursor != '0') return -1;
+            }
+            *reserve_data(1) = (unsigned char)c;
+            size++;
+        }
+        cursor++;
+        if (terminate) {
+            *reserve_data(1) = 0;
+            size++;
+        }
+    }
+}
+
+/*
+ * Records the region of a file included by .incbin. Only the size of the file is
+ * read, not its content.
+ *
+ * @param operands: The operands: "file", then the offset and the length, both optional.
+ * @return: The index of the region, or -1 (with a message) if it cannot be included.
+ */
+static int add_blob(const char *operands) {
+    while (isspace((unsigned char)*operands)) operands++;
+    const char *end = (*operands == '"') ? strchr(operands + 1, '"') : NULL;
+    if (!end) {
+        fprintf(stderr, "Invalid .incbin at line %d: the file name must be quoted\n", source_line);
+        return -1;
+    }
+    char name[MAX_LINE_LENGTH], path[2 * MAX_LINE_LENGTH];
+    snprintf(name, sizeof(name), "%.*s", (int)(end - operands - 1), operands + 1);
+    find_source_file(name, path, sizeof(path));  // Looked up as .include does
+    char *cursor;
+    long offset = strtol(end + 1, &cursor, 0);
+    long length = strtol(cursor, &cursor, 0);
+
+    struct stat status;
+    if (stat(path, &status) != 0) {
+        fprintf(stderr, "Error including %s at line %d: ", name, source_line);
+        perror(NULL);
+        return -1;
+    }
+    if (length == 0) length = status.st_size - offset;  // The rest of the file
+    if (offset < 0 || length < 0 || offset + length > status.st_size || length > 0x7FFFFFFF) {
+        fprintf(stderr, "Invalid .incbin region at line %d: %ld bytes from %ld in a file of %lld bytes\n",
+                source_line, length, offset, (long long)status.st_size);
+        return -1;
+    }
+    if (blob_count == blob_capacity) {
+        blob_capacity = blob_capacity ? 2 * blob_capacity : 16;
+        blobs = realloc(blobs, blob_capacity * sizeof(Blob));
+        if (!blobs) {
+            perror("Error allocating data");
+            exit(1);
+        }
+    }
+    Blob *blob = &blobs[blob_count];
+    blob->path = malloc(strlen(path) + 1);
+    if (!blob->path) {
+        perror("Error allocating data");
+        exit(1);
+    }
+    strcpy(blob->path, path);
+    add_dependency(path);
+    blob->offset = offset;
+    blob->length = length;
+    blob->map = NULL;
+    return blob_count++;
+}
+
+/*
+ * Handles the section and data directives of the first pass. Data is recorded as a
+ * KIND_DATA statement of the current section.
+ *
+ * @param instruction: The source line (label and comment removed, commas replaced).
+ * @return: true if the line held a section or data directive.
+ */
+bool data_directive(const char *instruction) {
+    char text[MAX_LINE_LENGTH];
+    strcpy(text, instruction);
+    char *directive = strtok(text, " \t\n");
+    if (!directive) return false;
+
+    // .text, .data, .sdata, .sbss and .section <name> switch sections
+    bool named = (strcmp(directive, ".section") == 0);
+    const char *name = named ? strtok(NULL, " \t\n") : directive;
+    int section = name ? find_section(name) : -1;
+    if (section >= 0) {
+        current_section = section;
+        return true;
+    }
+    if (named) {
+        fprintf(stderr, "Unknown section ignored: %s\n", name ? name : "");
+        return true;
+    }
+
+    // Values go to the arena; .sbss takes the size only
+    int first = data_arena_size, first_reference = reference_count, size = 0;
+    if (strcmp(directive, ".word") == 0 || strcmp(directive, ".half") == 0 || strcmp(directive, ".byte") == 0) {
+        size = parse_values(instruction + (directive - text) + strlen(directive), directive[1] == 'w' ? 4 :
+                            directive[1] == 'h' ? 2 : 1);
+    } else if (strcmp(directive, ".string") == 0 || strcmp(directive, ".asciz") == 0 ||
+               strcmp(directive, ".ascii") == 0) {
+        size = parse_strings(instruction + (directive - text) + strlen(directive), directive[5] != 'i');
+    } else if (strcmp(directive, ".incbin") == 0) {
+        if (current_section == SECTION_SBSS) {
+            fprintf(stderr, "Initial values ignored in .sbss at line %d\n", source_line);
+            return true;
+        }
+        int blob = add_blob(instruction + (directive - text) + strlen(directive));
+        if (blob < 0) error_count++;  // The image would lack the blob: fail the run
+        if (blob >= 0 && blobs[blob].length > 0) {
+            add_statement(instruction, blobs[blob].length, KIND_DATA);
+            statements[instruction_count - 1].blob = blob;
+        }
+        return true;
+    } else if (strcmp(directive, ".space") == 0 || strcmp(directive, ".zero") == 0) {
+        char *value = strtok(NULL, " \t\n");
+        size = value ? (int)convertToDecimal(value) : -1;
+        first = -1;
+    } else {
+        return false;
+    }
+    bool ignored = (size < 0);
+    if (ignored) {
+        const char *shown = instruction + strspn(instruction, " \t");
+        fprintf(stderr, "Invalid data at line %d: %.*s\n", source_line, (int)strcspn(shown, "\r\n"), shown);
+        error_count++;
+    } else if (current_section == SECTION_SBSS && first >= 0) {
+        fprintf(stderr, "Initial values ignored in .sbss at line %d\n", source_line);
+        ignored = true;
+        size = data_arena_size - first;  // Zeros of the same size
+    }
+    if (ignored && first >= 0) {
+        // Drop what was parsed
+        for (int r = first_reference; r < reference_count; r++) free(references[r].label);
+        reference_count = first_reference;
+        data_arena_size = first;
+        first = -1;
+    }
+    if (size < 0) return true;
+    if (size > 0) {
+        add_statement(instruction, size, KIND_DATA);
+        statements[instruction_count - 1].data = first;
+    }
+    return true;
+}
+
+/*
+ * Moves the statements of the data sections after the code, keeping their order within
+ * each section, and rebinds the labels. Every data section starts aligned to the largest
+ * alignment used in it (at least a word), the first one to the largest of all the data,
+ * and __global_pointer$ is defined for the small data unless the program defines it
+ * itself. Must run right after the first pass.
+ */
+void place_sections(void) {
+    int n = instruction_count;
+    int first[SECTION_COUNT + 1];  // First statement of every section once placed
+    Statement *moved = malloc((n + 1) * sizeof(Statement));
+    int *new_index = malloc((n + 1) * sizeof(int));
+    if (!moved || !new_index) {
+        perror("Error allocating sections");
+        exit(1);
+    }
+    int position = 0, align = 4;
+    int section_align[SECTION_COUNT];  // Largest alignment used in every section, at least a word
+    for (int s = 0; s < SECTION_COUNT; s++) {
+        first[s] = position;
+        section_align[s] = 4;
+        for (int i = 0; i < n; i++) {
+            if (statements[i].section != s) continue;
+            new_index[i] = position;
+            moved[position++] = statements[i];
+            if (statements[i].align > section_align[s]) section_align[s] = statements[i].align;
+        }
+        if (s != SECTION_TEXT && section_align[s] > align) align = section_align[s];
+    }
+    first[SECTION_COUNT] = position;
+    new_index[n] = n;
+    for (int l = 0; l < labelCount; l++) labelTable[l].statement = new_index[labelTable[l].statement];
+
+    // The data start is aligned for every section, so the code size never moves a section against gp
+    for (int s = SECTION_TEXT + 1; s < SECTION_COUNT; s++) {
+        if (first[s] == first[s + 1]) continue;  // Empty
+        int start = (first[s] == first[SECTION_TEXT + 1]) ? align : section_align[s];
+        if (moved[first[s]].align < start) moved[first[s]].align = start;
+    }
+
+    instruction_count = 0;
+    for (int i = 0; i < n; i++) {
+        add_statement(moved[i].text, moved[i].size, moved[i].kind);
+        statements[i] = moved[i];
+    }
+    if (first[SECTION_SDATA] < first[SECTION_COUNT] && find_label(GP_SYMBOL) < 0) {
+        add_label(GP_SYMBOL, first[SECTION_SDATA]);
+        labelTable[labelCount - 1].offset = GP_OFFSET;
+    }
+    free(moved);
+    free(new_index);
+}
+
+/*
+ * Reports every label operand of .word that names no label. Must run after the first
+ * pass, once every label is defined.
+ *
+ * @return: The number of undefined labels.
+ */
+int check_data_labels(void) {
+    int undefined = 0;
+    for (int r = 0; r < reference_count; r++) {
+        if (find_label(references[r].label) >= 0) continue;
+        fprintf(stderr, "Undefined label %s in data at line %d\n", references[r].label, references[r].line);
+        undefined++;
+    }
+    error_count += undefined;
+    return undefined;
+}
+
+/*
+ * Writes the bytes of a data statement in memory (little-endian) order: a copy of its
+ * bytes in the arena with the label addresses filled in, or zeros for .space.
+ *
+ * @param index: The index of the statement in the statement list.
+ * @param bytes: Receives the bytes (the size of the statement).
+ * @return: The number of bytes written.
+ */
+int encode_data(int index, unsigned char *bytes) {
+    Statement *statement = &statements[index];
+    if (statement->blob >= 0) {
+        memcpy(bytes, blob_bytes(index), statement->size);
+        return statement->size;
+    }
+    if (statement->data < 0) {
+        memset(bytes, 0, statement->size);
+        return statement->size;
+    }
+    memcpy(bytes, data_arena + statement->data, statement->size);
+
+    // First label operand inside the statement, by binary search over the ordered references
+    int low = 0, high = reference_count;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (references[middle].offset < statement->data) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    for (int r = low; r < reference_count && references[r].offset < statement->data + statement->size; r++) {
+        unsigned int address = (unsigned int)find_label_address(references[r].label);
+        for (int b = 0; b < 4; b++) bytes[references[r].offset - statement->data + b] = (address >> (8 * b)) & 0xFF;
+    }
+    return statement->size;
+}
+
+/*
+ * Maps the file region of an .incbin statement, once, and returns its bytes.
+ *
+ * @param index: The index of the statement in the statement list.
+ * @return: The bytes of the region, or NULL if the statement is not an .incbin.
+ */
+const unsigned char *blob_bytes(int index) {
+    if (statements[index].blob < 0) return NULL;
+    Blob *blob = &blobs[statements[index].blob];
+    if (!blob->map) {
+        // mmap starts at a page boundary
+        long page = sysconf(_SC_PAGESIZE);
+        blob->map_skip = blob->offset % page;
+        blob->map_size = blob->map_skip + blob->length;
+        int fd = open(blob->path, O_RDONLY);
+        void *map = (fd >= 0) ? mmap(NULL, blob->map_size, PROT_READ, MAP_PRIVATE, fd, blob->offset - blob->map_skip)
+                              : MAP_FAILED;
+        if (fd >= 0) close(fd);  // The mapping stays valid after the descriptor is closed
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "Error mapping %s: ", blob->path);
+            perror(NULL);
+            exit(1);
+        }
+        blob->map = map;
+    }
+    return blob->map + blob->map_skip;
+}
+
+/*
+ * Appends the file region of an .incbin statement to a binary output file, copied
+ * by the kernel from file to file where it can (copy_file_range), from the mapping
+ * otherwise.
+ *
+ * @param index: The index of the statement in the statement list.
+ * @param output_file: The binary output file, positioned at the address of the statement.
+ * @return: 0 on success, 1 if the output cannot be written.
+ */
+int copy_blob(int index, FILE *output_file) {
+    Blob *blob = &blobs[statements[index].blob];
+    long copied = 0;
+#ifdef __linux__
+    int fd = open(blob->path, O_RDONLY);
+    if (fd >= 0 && fflush(output_file) == 0) {
+        loff_t offset = blob->offset;
+        while (copied < blob->length) {
+            ssize_t count = copy_file_range(fd, &offset, fileno(output_file), NULL, blob->length - copied, 0);
+            if (count <= 0) break;  // Not supported between these files: finish from the mapping
+            copied += count;
+        }
+        fseek(output_file, 0, SEEK_END);  // The stream continues after the copied bytes
+    }
+    if (fd >= 0) close(fd);
+#endif
+    if (copied < blob->length &&
+        fwrite(blob_bytes(index) + copied, 1, blob->length - copied, output_file) != (size_t)(blob->length - copied)) {
+        perror("Error writing output file");
+        return 1;
+    }
+    return 0;
+}
+
+// Returns true if an instruction names __global_pointer$, as "la gp, __global_pointer$" does
+static bool names_gp(int index) {
+    char text[MAX_LINE_LENGTH];
+    strcpy(text, statements[index].text);
+    for (char *token = strtok(text, " \t\n"); token; token = strtok(NULL, " \t\n")) {
+        if (strcmp(token, GP_SYMBOL) == 0) return true;
+    }
+    return false;
+}
+
+/*
+ * Rewrites the loads, stores and la of data symbols within +-2 KiB of
+ * __global_pointer$ into single gp-relative instructions. Must run after the passes
+ * that move instructions and before the relaxation.
+ *
+ * @return: The number of instructions saved (one per access rewritten), or -1 if
+ *          there is small data but the program never loads __global_pointer$.
+ */
+int relax_gp(void) {
+    int gp = find_label(GP_SYMBOL);
+    if (gp < 0 || labelTable[gp].offset != GP_OFFSET) return 0;  // No small data, or a gp of the program's own
+    bool sets_gp = false;
+    for (int i = 0; i < instruction_count && !sets_gp; i++) {
+        if (statements[i].kind != KIND_DATA) sets_gp = names_gp(i);
+    }
+    if (!sets_gp) return -1;
+
+    layout_program();
+    int gp_address = labelTable[gp].address, saved = 0;
+    for (int i = 0; i < instruction_count; i++) {
+        Statement *statement = &statements[i];
+        if (statement->kind != KIND_OTHER || statement->size != 8) continue;
+        char tokens[4][MAX_LINE_LENGTH];
+        int count = sscanf(statement->text, "%s %s %s %s", tokens[0], tokens[1], tokens[2], tokens[3]);
+        bool load = (count == 3 && is_one_of(tokens[0], symbol_loads));
+        bool store = (count == 4 && is_one_of(tokens[0], symbol_stores));
+        bool address = (count == 3 && strcmp(tokens[0], "la") == 0 && get_register_number(tokens[1]) != 3);
+        if (!load && !store && !address) continue;
+        int label = find_label(tokens[2]);
+        if (label < 0 || label == gp) continue;
+        int target = labelTable[label].statement;
+        if (target >= instruction_count || statements[target].section == SECTION_TEXT) continue;  // Code moves
+        int offset = labelTable[label].address - gp_address;
+        if (offset < -2048 || offset > 2047) continue;
+        if (address) {
+            snprintf(statement->text, sizeof(statement->text), "addi %.16s gp %d", tokens[1], offset);
+        } else {
+            snprintf(statement->text, sizeof(statement->text), "%.8s %.16s %d(gp)", tokens[0], tokens[1], offset);
+        }
+        statement->size = 4;
+        saved++;
+    }
+    return saved;
+}
@@ -0,0 +1,91 @@
+/*
+ * RISC-V Simulator Memory-Mapped Devices
+ *
+ * This file contains the device models the simulator maps into the address space
+ * for driver-level programs:
+ *   - A 16550-style UART at UART_BASE. Bytes written to the transmit register are
+ *     copied to the host (stdout or a file); the line status register always reports
+ *     an empty transmitter and no received data.
+ *   - The machine timer of the core-local interruptor at CLINT_BASE. mtime counts
+ *     simulated cycles (one per retired instruction) divided by the timer divider,
+ *     and mtimecmp holds the value programs compare against.
+ * Both are registered with register_device, so only the slow path of the memory
+ * model ever looks at them.
+ */
+
+#include "simulator.h"
+
+#define UART_THR 0      // Transmit holding register (write) / receive buffer (read)
+#define UART_LSR 5      // Line status register
+#define UART_LSR_IDLE 0x60  // Transmit holding register empty and transmitter idle
+
+static FILE *uart_output = NULL;           // Host file receiving the UART output
+static unsigned int timer_divider = 1;     // Cycles per mtime tick
+static unsigned long long mtime_offset = 0; // Value written to mtime minus the cycle-derived time
+static unsigned long long mtimecmp = ~0ULL; // Timer compare register (reset value: never)
+
+// Reads a UART register: only the line status register returns a non-zero value
+static unsigned int uart_load(unsigned int offset, unsigned int size) {
+    return (offset == UART_LSR) ? UART_LSR_IDLE : 0;
+}
+
+// Writes a UART register: a byte written to the transmit register goes to the host
+static void uart_store(unsigned int offset, unsigned int size, unsigned int value) {
+    if (offset == UART_THR) {
+        fputc(value & 0xFF, uart_output);
+        if ((value & 0xFF) == '\n') fflush(uart_output);
+    }
+}
+
+// Returns the current value of mtime
+static unsigned long long timer_mtime(void) {
+    return cpu.instret / timer_divider + mtime_offset;
+}
+
+/*
+ * Reads part of a 64-bit timer register. Accesses of 1, 2 or 4 bytes may hit
+ * any byte of mtime or mtimecmp.
+ */
+static unsigned int timer_load(unsigned int offset, unsigned int size) {
+    unsigned long long value;
+    if (offset >= CLINT_MTIME && offset < CLINT_MTIME + 8) {
+        value = timer_mtime() >> (8 * (offset - CLINT_MTIME));
+    } else if (offset >= CLINT_MTIMECMP && offset < CLINT_MTIMECMP + 8) {
+        value = mtimecmp >> (8 * (offset - CLINT_MTIMECMP));
+    } else {
+        return 0;
+    }
+    return (size == 4) ? (unsigned int)value : (unsigned int)value & ((1u << (8 * size)) - 1);
+}
+
+// Replaces 'size' bytes at byte position 'shift' of a 64-bit register
+static unsigned long long replace_bytes(unsigned long long reg, unsigned int shift, unsigned int size, unsigned int value) {
+    unsigned long long mask = ((size == 4) ? 0xFFFFFFFFULL : ((1ULL << (8 * size)) - 1)) << (8 * shift);
+    return (reg & ~mask) | (((unsigned long long)value << (8 * shift)) & mask);
+}
+
+// Writes part of mtime (which re-bases the counter) or of mtimecmp
+static void timer_store(unsigned int offset, unsigned int size, unsigned int value) {
+    if (offset >= CLINT_MTIME && offset < CLINT_MTIME + 8) {
+        unsigned long long written = replace_bytes(timer_mtime(), offset - CLINT_MTIME, size, value);
+        mtime_offset = written - cpu.instret / timer_divider;
+    } else if (offset >= CLINT_MTIMECMP && offset < CLINT_MTIMECMP + 8) {
+        mtimecmp = replace_bytes(mtimecmp, offset - CLINT_MTIMECMP, size, value);
+    }
+}
+
+/*
+ * Maps the UART and the machine timer into the simulated address space.
+ *
+ * @param output: The host file receiving the bytes written to the UART.
+ * @param divider: Number of cycles per mtime tick (at least 1).
+ */
+void devices_init(FILE *output, unsigned int divider) {
+    Device uart = { UART_BASE, UART_SIZE, uart_load, uart_store };
+    Device timer = { CLINT_BASE, CLINT_SIZE, timer_load, timer_store };
+
+    uart_output = output;
+    timer_divider = divider;
+    register_device(&uart);
+    register_device(&timer);
+}
@@ -0,0 +1,57 @@
+/*
+ * RISC-V Shared-Memory Image Layout
+ *
+ * This header documents the POSIX shared-memory segment written by the assembler
+ * with the -s output flag (./assembler <input_file> /name -s). A consumer opens it
+ * with shm_open("/name", O_RDONLY, 0), maps it with mmap and reads the image and
+ * the symbol table in place, without parsing any text. The writer does not remove
+ * the segment; the consumer (or the harness) calls shm_unlink when done.
+ *
+ * Segment layout (header and symbol fields in host byte order, machine code in
+ * RISC-V little-endian byte order, all offsets from the segment start):
+ *
+ *     +--------------------------+ 0
+ *     | ImageHeader              |
+ *     +--------------------------+ image_offset   (4-byte aligned)
+ *     | machine code             |   image_size bytes, loaded at load_address
+ *     +--------------------------+ symbol_offset  (4-byte aligned)
+ *     | ImageSymbol[symbol_count]|   in definition order
+ *     +--------------------------+ string_offset
+ *     | label names              |   string_size bytes of NUL-terminated names
+ *     +--------------------------+ total_size
+ *
+ * The magic number is written last, so a consumer that finds IMAGE_MAGIC sees a
+ * complete image.
+ */
+
+#ifndef IMAGE_SHM_H  // Include guard to prevent multiple inclusion of this header file
+#define IMAGE_SHM_H
+
+#include <stdint.h>
+
+#define IMAGE_MAGIC 0x4D495652u  // "RVIM" when read as little-endian bytes
+#define IMAGE_VERSION 1          // Incremented whenever the layout changes
+
+// Structure at the start of the segment
+typedef struct {
+    uint32_t magic;          // IMAGE_MAGIC once the segment is complete
+    uint32_t version;        // IMAGE_VERSION
+    uint32_t header_size;    // sizeof(ImageHeader), lets newer headers grow
+    uint32_t total_size;     // Size of the whole segment in bytes
+    uint32_t entry;          // Address of the first instruction to execute
+    uint32_t load_address;   // Address of the first byte of the machine code
+    uint32_t image_offset;   // Offset of the machine code
+    uint32_t image_size;     // Size of the machine code in bytes
+    uint32_t symbol_offset;  // Offset of the symbol table
+    uint32_t symbol_count;   // Number of ImageSymbol entries
+    uint32_t string_offset;  // Offset of the label names
+    uint32_t string_size;    // Size of the label names in bytes
+} ImageHeader;
+
+// Structure holding one label of the symbol table
+typedef struct {
+    uint32_t address;      // Byte address of the label
+    uint32_t name_offset;  // Offset of the name from string_offset
+} ImageSymbol;
+
+#endif // End of the include guard for IMAGE_SHM_H
@@ -0,0 +1,276 @@
+/*
+ * RISC-V Assembler Annotated Listing
+ *
+ * This file contains the static hazard analysis written with --listing. Without
+ * running the program it models an in-order, single-issue pipeline: an instruction
+ * issues one cycle after the previous one unless a register it reads is not ready
+ * yet, which costs a stall of
+ *   - load_latency - 1 cycles right after a load of that register (load-use hazard),
+ *   - alu_latency - 1 cycles right after any other write (read-after-write hazard).
+ * A taken branch or jump costs branch_penalty cycles. The model restarts at every
+ * basic block (a label, an aligned instruction or the instruction after a branch or
+ * jump), assuming the values computed by earlier blocks are ready. Data is listed
+ * with its bytes and never enters the model.
+ *
+ * The listing shows every source line with the address and machine code of its
+ * instructions, the stalls they suffer with the instruction they wait for, and after
+ * each block its instruction count, stalls and estimated cycles. The same model
+ * (pipeline_reset, pipeline_issue) gives the block costs of the control-flow graph.
+ */
+
+#include "assembler.h"
+
+#define LISTING_SOURCE_WIDTH 40  // Column where the annotations start
+#define LISTING_DATA_LINES 4     // Words listed per data directive (.space lists its first ones only)
+
+int branch_penalty = 2;  // Cycles lost refetching after a taken branch or jump
+
+// Structure holding the pipeline model result of one recorded instruction
+typedef struct {
+    PipelineIssue issue;  // Stalls of the instruction
+    bool block_end;       // The instruction ends a basic block
+} Hazard;
+
+// Reads the whole source file into an array of lines (without the newline)
+static char **read_source(const char *file_name, int *line_count) {
+    FILE *source_file = fopen(file_name, "r");
+    if (!source_file) {
+        perror("Error opening input file");
+        return NULL;
+    }
+    char line[MAX_LINE_LENGTH];
+    char **lines = NULL;
+    int count = 0, capacity = 0;
+    while (fgets(line, sizeof(line), source_file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 256;
+            lines = realloc(lines, capacity * sizeof(char *));
+            if (!lines) {
+                perror("Error allocating listing");
+                exit(1);
+            }
+        }
+        lines[count] = malloc(strlen(line) + 1);
+        strcpy(lines[count++], line);
+    }
+    fclose(source_file);
+    *line_count = count;
+    return lines;
+}
+
+// Returns the number of nops making up the padding in front of an instruction
+static int padding_nops(const Statement *statement) {
+    return statement->padding / 4 + (statement->padding % 4 ? 1 : 0);
+}
+
+// Restarts the pipeline model at the beginning of a basic block: every register is ready
+void pipeline_reset(PipelineState *state) {
+    for (int r = 0; r < 32; r++) {
+        state->ready[r] = 0;
+        state->producer[r] = 0;
+    }
+    state->time = -1;
+}
+
+/*
+ * Issues a recorded instruction, with its alignment padding, in the pipeline model.
+ * Afterwards state->time + 1 is the number of cycles since the block started.
+ *
+ * @param state: The pipeline model of the current block.
+ * @param index: The index of the instruction in the statement list.
+ * @param info: The description of the instruction (describe_statement).
+ * @param issue: Receives the instruction count and the stalls of the instruction.
+ */
+void pipeline_issue(PipelineState *state, int index, const StatementInfo *info, PipelineIssue *issue) {
+    const Statement *statement = &statements[index];
+    int nops = padding_nops(statement);
+    memset(issue, 0, sizeof(*issue));
+    if (statement->kind == KIND_DATA) return;  // Never executed
+
+    // Padding nops, then wait for the registers read
+    state->time += nops;
+    int earliest = state->time + 1;
+    int sources[2] = { info->rs1, info->rs2 };
+    for (int s = 0; s < 2; s++) {
+        int r = sources[s];
+        if (r != 0 && state->ready[r] > earliest) {
+            earliest = state->ready[r];
+            issue->reg = r;
+            issue->producer = state->producer[r];
+        }
+    }
+    unsigned int codes[2];
+    int count = encode_statement(index, codes);
+    issue->stall = earliest - (state->time + 1);
+    state->time = earliest + count - 1;
+    if ((statement->form == FORM_NORMAL && count == 2) || statement->form == FORM_FAR) {
+        // lui+addi, auipc+addi/lw and auipc+jalr: the second instruction reads the result of the first
+        issue->internal = alu_latency - 1;
+        state->time += alu_latency - 1;
+    }
+    if (info->rd != 0) {
+        state->ready[info->rd] = state->time + (info->is_load ? load_latency : alu_latency);
+        state->producer[info->rd] = index;
+    }
+    issue->instructions = nops + count;
+}
+
+// Prints a source line without code, or one line of machine code next to its source
+static void print_line(FILE *listing_file, int address, unsigned int code, int size, int line, const char *source) {
+    if (size == 0) {
+        fprintf(listing_file, "%-10s  %-8s  %5d  %s\n", "", "", line, source);
+    } else if (line == 0 && source[0] == '\0') {
+        fprintf(listing_file, "0x%08X  %0*X", address, 2 * size, code);  // Further instructions of a sequence
+    } else if (line == 0) {
+        fprintf(listing_file, "0x%08X  %0*X%*s  %5s  %s", address, 2 * size, code, 8 - 2 * size, "", "", source);
+    } else {
+        fprintf(listing_file, "0x%08X  %0*X%*s  %5d  %s", address, 2 * size, code, 8 - 2 * size, "", line, source);
+    }
+}
+
+// Prints the first words of a data statement, one per line, next to its source
+static void print_data(FILE *listing_file, int index, int line, const char *source) {
+    const Statement *statement = &statements[index];
+    const unsigned char *blob = blob_bytes(index);  // An included file is listed from its mapping
+    unsigned char *bytes = blob ? NULL : malloc(statement->size);
+    if (!blob && !bytes) {
+        perror("Error allocating listing");
+        exit(1);
+    }
+    if (!blob) encode_data(index, bytes);
+    for (int offset = 0; offset < statement->size && offset < 4 * LISTING_DATA_LINES; offset += 4) {
+        int size = (statement->size - offset < 4) ? statement->size - offset : 4;
+        unsigned int value = 0;
+        for (int b = 0; b < size; b++) value |= (unsigned int)(blob ? blob : bytes)[offset + b] << (8 * b);
+        print_line(listing_file, statement->address + offset, value, size, offset == 0 ? line : 0,
+                   offset == 0 ? source : "");
+        fputc('\n', listing_file);
+    }
+    free(bytes);
+}
+
+/*
+ * Writes the annotated listing of the program. Must run after relax_program, when
+ * the addresses and forms of all instructions are final.
+ *
+ * @param listing_file: The file receiving the listing.
+ * @param source_file_name: The assembly source, printed next to the machine code.
+ * @return: 0 on success, 1 if the source cannot be read.
+ */
+int write_listing(FILE *listing_file, const char *source_file_name) {
+    int line_count;
+    char **lines = read_source(source_file_name, &line_count);
+    if (!lines) return 1;
+
+    // Blocks start at labels and aligned instructions, and after branches and jumps
+    Hazard *hazards = calloc(instruction_count + 1, sizeof(Hazard));
+    StatementInfo *infos = malloc((instruction_count + 1) * sizeof(StatementInfo));
+    bool *starts = calloc(instruction_count + 1, sizeof(bool));
+    const char **names = calloc(instruction_count + 1, sizeof(char *));  // First label of each instruction
+    if (!hazards || !infos || !starts || !names) {
+        perror("Error allocating listing");
+        exit(1);
+    }
+    for (int i = 0; i < labelCount; i++) {
+        starts[labelTable[i].statement] = true;
+        if (!names[labelTable[i].statement]) names[labelTable[i].statement] = labelTable[i].label;
+    }
+    for (int i = 0; i < instruction_count; i++) {
+        describe_statement(i, &infos[i]);
+        if (statements[i].align > 1 || statements[i].kind == KIND_DATA) starts[i] = true;
+        if (infos[i].is_control) starts[i + 1] = true;
+    }
+    for (int i = 0; i < instruction_count; i++) {
+        hazards[i].block_end = (i + 1 == instruction_count) || starts[i + 1];
+    }
+
+    fprintf(listing_file, "# Static pipeline model: in-order single issue, load latency %d, ALU latency %d, "
+                          "taken branch penalty %d\n", load_latency, alu_latency, branch_penalty);
+    fprintf(listing_file, "# %-8s  %-8s  %5s  %s\n", "address", "code", "line", "source");
+
+    PipelineState pipeline;
+    int block_instructions = 0, block_stalls = 0, block_first = 0;
+    int total_instructions = 0, total_stalls = 0, load_use = 0, blocks = 0;
+    int next_line = 1;  // First source line not printed yet
+
+    for (int i = 0; i < instruction_count; i++) {
+        Statement *statement = &statements[i];
+        StatementInfo *info = &infos[i];
+        if (starts[i] || i == 0) {
+            pipeline_reset(&pipeline);
+            block_instructions = block_stalls = 0;
+            block_first = i;
+        }
+
+        PipelineIssue *issue = &hazards[i].issue;
+        pipeline_issue(&pipeline, i, info, issue);
+        int nops = padding_nops(statement);
+        unsigned int codes[2];
+        int count = (statement->kind == KIND_DATA) ? 0 : encode_statement(i, codes);
+        block_instructions += issue->instructions;
+        block_stalls += issue->stall + issue->internal;
+        if (issue->stall > 0 && infos[issue->producer].is_load) load_use += issue->stall;
+
+        // Source lines up to this instruction, then the instruction itself
+        int line = statement->line;
+        while (next_line < line && next_line <= line_count) {
+            print_line(listing_file, 0, 0, 0, next_line, lines[next_line - 1]);
+            next_line++;
+        }
+        if (line >= next_line) next_line = line + 1;
+        int address = statement->address - statement->padding;
+        if (statement->kind == KIND_DATA) {
+            print_data(listing_file, i, line, (line >= 1 && line <= line_count) ? lines[line - 1] : "");
+            continue;
+        }
+        for (int n = 0; n < nops; n++) {
+            int size = (n == 0 && statement->padding % 4) ? 2 : 4;
+            print_line(listing_file, address, (size == 2) ? 0x0001 : 0x00000013, size, 0, "(alignment padding)\n");
+            address += size;
+        }
+        int size = (statement->form == FORM_COMPRESSED) ? 2 : 4;
+        for (int c = 0; c < count; c++) {
+            const char *source = (c == 0 && line >= 1 && line <= line_count) ? lines[line - 1] : "";
+            print_line(listing_file, address + c * size, codes[c], size, c == 0 ? line : 0, source);
+            if (c == 0 && issue->stall > 0) {
+                int width = (int)strlen(source);
+                fprintf(listing_file, "%*s# %s stall %d: x%d from 0x%08X (line %d)", width < LISTING_SOURCE_WIDTH ?
+                        LISTING_SOURCE_WIDTH - width : 1, "", infos[issue->producer].is_load ? "load-use" : "RAW",
+                        issue->stall, issue->reg, statements[issue->producer].address, statements[issue->producer].line);
+            }
+            fputc('\n', listing_file);
+        }
+
+        if (hazards[i].block_end) {
+            // Block summary: cycles until the last instruction issued, plus the refetch of a taken jump
+            unsigned int opcode = info->code & 0x7F;
+            bool jumps = info->is_control && opcode != 0b1100011;
+            bool branches = info->is_control && opcode == 0b1100011;
+            int cycles = pipeline.time + 1 + (jumps ? branch_penalty : 0);
+            const char *name = names[block_first];
+            fprintf(listing_file, "#   block %s%s0x%08X: %d instructions, %d stall cycles, %d cycles",
+                    name ? name : "", name ? " at " : "at ", statements[block_first].address, block_instructions,
+                    block_stalls, cycles);
+            if (branches) fprintf(listing_file, " (+%d if the branch is taken)", branch_penalty);
+            fputc('\n', listing_file);
+            total_instructions += block_instructions;
+            total_stalls += block_stalls;
+            blocks++;
+        }
+    }
+    while (next_line <= line_count) {
+        print_line(listing_file, 0, 0, 0, next_line, lines[next_line - 1]);
+        next_line++;
+    }
+    fprintf(listing_file, "# Total: %d instructions in %d blocks, %d stall cycles (%d load-use, %d other RAW)\n",
+            total_instructions, blocks, total_stalls, load_use, total_stalls - load_use);
+
+    for (int i = 0; i < line_count; i++) free(lines[i]);
+    free(lines);
+    free(hazards);
+    free(infos);
+    free(starts);
+    free(names);
+    return 0;
+}
@@ -0,0 +1,832 @@
+/*
+ * RISC-V Assembler Macro Preprocessor
+ *
+ * This file contains the preprocessor sitting between the source lines (comments
+ * removed, commas replaced) and the first pass:
+ *   .macro name a, b=default ... .endm    defines a macro; "name x, y" or "name b=y, x"
+ *                                         invokes it, \a and \b in the body standing for
+ *                                         the arguments, \@ for the invocation count and
+ *                                         \() for nothing (to end a name: \a\()_end)
+ *   .rept count ... .endr                 repeats the body count times
+ *   .irp symbol, v1, v2, ... .endr         repeats the body once per value of \symbol
+ *   .if expr / .elseif expr / .else / .endif
+ *                                         keeps the lines of the first branch whose
+ *                                         expression is not zero
+ *   .include "file"                       preprocesses the lines of another source file,
+ *                                         found next to the including file or else in
+ *                                         the working directory (.incbin files too)
+ * Counts and conditions are integer expressions with the C operators (arithmetic,
+ * shifts, comparisons, bitwise and logical, parentheses).
+ *
+ * A body is compiled once, when its definition ends, into a list of segments: runs of
+ * literal text and references to parameters. An expansion concatenates the segments
+ * with the arguments, so the body is never scanned again, and its lines go straight
+ * to the first pass (through this preprocessor again, for nested blocks and
+ * invocations) without being cleaned again. The expansion of a macro is cached under
+ * its arguments: a later invocation with the same arguments replays the lines already
+ * built. Bodies using \@ differ at every invocation and are not cached; .rept replays
+ * its single body.
+ *
+ * An included file is read and cleaned (comments removed, commas replaced, loop_bound
+ * annotations turned into .loop_bound lines) once per run and replayed from memory
+ * wherever it is included again. Every file read this way, .incbin files included,
+ * is recorded as a dependency for the make rule written with -MD.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // access
+
+#include "assembler.h"
+#include <unistd.h>  // access
+
+#define MACRO_MAX_PARAMETERS 16  // Parameters of a macro (one for .irp)
+#define MACRO_MAX_DEPTH 64       // Nested expansions, to stop a macro invoking itself forever
+#define MACRO_MAX_CONDITIONS 64  // Nested .if blocks
+#define SEGMENT_LINE_END -1      // Segment ending a line of a body
+#define SEGMENT_COUNTER -2       // Segment standing for \@
+#define SEGMENT_TEXT -3          // Segment of literal text; parameters are 0 and up
+
+// Structure holding one segment of a compiled body
+typedef struct {
+    int kind;     // Parameter number, or SEGMENT_LINE_END, SEGMENT_COUNTER or SEGMENT_TEXT
+    int start;    // Literal text: offset in the text of the body
+    int length;
+} Segment;
+
+// Structure holding a compiled body
+typedef struct {
+    char *text;          // The lines of the body, as recorded
+    Segment *segments;
+    int count;
+    bool counter;        // The body uses \@
+} Body;
+
+// Structure holding a macro definition
+typedef struct {
+    char *name;
+    int parameter_count;
+    char *parameters[MACRO_MAX_PARAMETERS];
+    char *defaults[MACRO_MAX_PARAMETERS];  // Value of a parameter left out, "" if none was given
+    Body body;
+} Macro;
+
+// Structure holding the lines of an expansion, each one ending with '\0'
+typedef struct {
+    char *text;
+    int length;
+    int capacity;
+} Expansion;
+
+// Structure holding a cached expansion of a macro
+typedef struct {
+    char *key;           // Macro name and arguments
+    Expansion expansion;
+} CachedExpansion;
+
+// Structure holding a .if block
+typedef struct {
+    bool outer;          // The lines around the block are kept
+    bool active;         // The lines of the current branch are kept
+    bool taken;          // A branch has been kept already
+} Condition;
+
+// Structure holding an included file, cleaned and split into lines once
+typedef struct {
+    char *path;
+    Expansion lines;
+} IncludedFile;
+
+// Block being recorded
+enum { RECORD_NONE, RECORD_MACRO, RECORD_REPT, RECORD_IRP };
+
+static Macro *macros = NULL;
+static int macro_count = 0, macro_capacity = 0;
+static CachedExpansion *cache = NULL;  // Open-addressing hash of expansions (NULL keys mark empty slots)
+static unsigned int cache_size = 0, cache_count = 0;
+static int invocations = 0;            // Value of \@
+static int depth = 0;                  // Expansions in progress
+
+static int recording = RECORD_NONE;
+static int record_depth = 0;           // Blocks of the same kind opened inside the recorded one
+static int record_line = 0;            // Source line of the directive starting the block
+static char record_header[MAX_LINE_LENGTH];
+static Expansion recorded = { NULL, 0, 0 };
+
+static Condition conditions[MACRO_MAX_CONDITIONS];
+static int condition_count = 0;
+
+static IncludedFile *included = NULL;
+static int included_count = 0, included_capacity = 0;
+static const char *current_file = NULL;  // File whose lines are being preprocessed
+static char **dependencies = NULL;       // Files the program was assembled from
+static int dependency_count = 0, dependency_capacity = 0;
+
+// Allocates memory or exits, as every allocation failure of the preprocessor is fatal
+static void *allocate(void *pointer, size_t size) {
+    pointer = realloc(pointer, size);
+    if (!pointer) {
+        perror("Error allocating macro preprocessor");
+        exit(1);
+    }
+    return pointer;
+}
+
+// Returns a copy of the first length characters of a string
+static char *copy_text(const char *text, int length) {
+    char *copy = allocate(NULL, length + 1);
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+// Appends a line to an expansion
+static void append_line(Expansion *expansion, const char *line, int length) {
+    if (expansion->length + length + 1 > expansion->capacity) {
+        expansion->capacity = 2 * (expansion->length + length + 1) + 256;
+        expansion->text = allocate(expansion->text, expansion->capacity);
+    }
+    memcpy(expansion->text + expansion->length, line, length);
+    expansion->text[expansion->length + length] = '\0';
+    expansion->length += length + 1;
+}
+
+// FNV-1a hash of a cache key
+static unsigned int hash_key(const char *key) {
+    unsigned int hash = 2166136261u;
+    while (*key) {
+        hash = (hash ^ (unsigned char)*key++) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns the cache slot holding the key, or the empty slot where it belongs
+static unsigned int cache_slot(const char *key) {
+    unsigned int slot = hash_key(key) & (cache_size - 1);
+    while (cache[slot].key && strcmp(cache[slot].key, key) != 0) {
+        slot = (slot + 1) & (cache_size - 1);
+    }
+    return slot;
+}
+
+// Returns the macro with the given name, or -1 if there is none
+static int find_macro(const char *name) {
+    for (int m = macro_count - 1; m >= 0; m--) {  // A redefinition hides the earlier one
+        if (strcmp(macros[m].name, name) == 0) return m;
+    }
+    return -1;
+}
+
+// Splits a line into its whitespace-separated words, a quoted string being one word; returns their number
+static int split_words(char *line, char **words, int capacity) {
+    int count = 0;
+    char *cursor = line;
+    while (count < capacity) {
+        while (isspace((unsigned char)*cursor)) cursor++;
+        if (*cursor == '\0') break;
+        words[count++] = cursor;
+        bool quoted = false;
+        while (*cursor && (quoted || !isspace((unsigned char)*cursor))) {
+            if (*cursor == '\\' && quoted && cursor[1]) {
+                cursor++;
+            } else if (*cursor == '"') {
+                quoted = !quoted;
+            }
+            cursor++;
+        }
+        if (*cursor) *cursor++ = '\0';
+    }
+    return count;
+}
+
+/*
+ * Compiles the recorded lines of a body into segments.
+ *
+ * @param text: The lines, each one ending with '\0'; the body keeps the buffer.
+ * @param length: The bytes of the lines.
+ * @param parameters: The parameter names referenced as \name.
+ * @param parameter_count: The number of parameters.
+ * @return: The compiled body.
+ */
+static Body compile_body(char *text, int length, char **parameters, int parameter_count) {
+    Body body = { text, NULL, 0, false };
+    int capacity = 0;
+    for (int position = 0; position < length;) {
+        int start = position;
+        int kind = SEGMENT_TEXT, skip = 0;
+        // Literal text up to the next reference or the end of the line
+        while (text[position] != '\0') {
+            if (text[position] == '\\') {
+                const char *name = text + position + 1;
+                if (*name == '@') {
+                    kind = SEGMENT_COUNTER;
+                    skip = 2;
+                } else if (name[0] == '(' && name[1] == ')') {
+                    kind = SEGMENT_TEXT;
+                    skip = 3;
+                } else {
+                    int longest = 0;
+                    for (int p = 0; p < parameter_count; p++) {
+                        int size = (int)strlen(parameters[p]);
+                        if (size > longest && strncmp(name, parameters[p], size) == 0) {
+                            kind = p;
+                            longest = size;
+                        }
+                    }
+                    skip = longest ? longest + 1 : 0;
+                }
+                if (skip) break;
+            }
+            position++;
+        }
+        if (body.count + 3 > capacity) {
+            capacity = 2 * capacity + 64;
+            body.segments = allocate(body.segments, capacity * sizeof(Segment));
+        }
+        if (position > start) {
+            body.segments[body.count++] = (Segment){ SEGMENT_TEXT, start, position - start };
+        }
+        if (text[position] == '\0') {
+            body.segments[body.count++] = (Segment){ SEGMENT_LINE_END, 0, 0 };
+            position++;
+            continue;
+        }
+        if (kind != SEGMENT_TEXT) body.segments[body.count++] = (Segment){ kind, 0, 0 };
+        if (kind == SEGMENT_COUNTER) body.counter = true;
+        position += skip;
+    }
+    return body;
+}
+
+/*
+ * Expands a compiled body with the given arguments.
+ *
+ * @param body: The compiled body.
+ * @param arguments: The value of every parameter.
+ * @param expansion: Receives the lines of the expansion.
+ */
+static void expand_body(const Body *body, char **arguments, Expansion *expansion) {
+    char line[MAX_LINE_LENGTH];
+    int length = 0;
+    bool cut = false;  // Report a line cut short once
+    char counter[16];
+    snprintf(counter, sizeof(counter), "%d", invocations);
+    for (int s = 0; s < body->count; s++) {
+        const Segment *segment = &body->segments[s];
+        if (segment->kind == SEGMENT_LINE_END) {
+            append_line(expansion, line, length);
+            length = 0;
+            cut = false;
+            continue;
+        }
+        const char *text = (segment->kind == SEGMENT_TEXT) ? body->text + segment->start
+                         : (segment->kind == SEGMENT_COUNTER) ? counter : arguments[segment->kind];
+        int size = (segment->kind == SEGMENT_TEXT) ? segment->length : (int)strlen(text);
+        if (length + size >= MAX_LINE_LENGTH) {
+            if (!cut) {
+                fprintf(stderr, "Expanded line too long at line %d\n", source_line);
+                error_count++;
+                cut = true;
+            }
+            size = MAX_LINE_LENGTH - 1 - length;
+        }
+        memcpy(line + length, text, size);
+        length += size;
+    }
+}
+
+// Runs the lines of an expansion through the preprocessor and the first pass
+static void replay(const char *text, int length) {
+    if (depth == MACRO_MAX_DEPTH) {
+        fprintf(stderr, "Macro expansion nested too deep at line %d\n", source_line);
+        error_count++;
+        return;
+    }
+    depth++;
+    char line[MAX_LINE_LENGTH];
+    for (int position = 0; position < length; position += (int)strlen(text + position) + 1) {
+        strcpy(line, text + position);  // The first pass edits its line
+        preprocess_line(line);
+    }
+    depth--;
+}
+
+// Parses an integer expression with the C operators; *ok is cleared on a syntax error
+static long int parse_expression(const char **cursor, int level, bool *ok);
+
+// Parses a number, a parenthesized expression or a unary operator applied to one
+static long int parse_operand(const char **cursor, bool *ok) {
+    while (isspace((unsigned char)**cursor)) (*cursor)++;
+    char c = **cursor;
+    if (c == '-' || c == '+' || c == '~' || c == '!') {
+        (*cursor)++;
+        long int value = parse_operand(cursor, ok);
+        return (c == '-') ? -value : (c == '~') ? ~value : (c == '!') ? !value : value;
+    }
+    if (c == '(') {
+        (*cursor)++;
+        long int value = parse_expression(cursor, 0, ok);
+        while (isspace((unsigned char)**cursor)) (*cursor)++;
+        if (**cursor == ')') {
+            (*cursor)++;
+        } else {
+            *ok = false;
+        }
+        return value;
+    }
+    char *end;
+    long int value = strtol(*cursor, &end, 0);
+    if (end == *cursor) *ok = false;
+    *cursor = end;
+    return value;
+}
+
+// Binary operators from the lowest precedence level up
+static const char *const operator_levels[][4] = {
+    { "||" }, { "&&" }, { "|" }, { "^" }, { "&" }, { "==", "!=" }, { "<=", ">=", "<", ">" },
+    { "<<", ">>" }, { "+", "-" }, { "*", "/", "%" },
+};
+#define OPERATOR_LEVELS (int)(sizeof(operator_levels) / sizeof(operator_levels[0]))
+
+// Returns the operator of the level found at the cursor, NULL if there is none
+static const char *match_operator(const char *cursor, int level) {
+    for (int o = 0; o < 4 && operator_levels[level][o]; o++) {
+        const char *operator = operator_levels[level][o];
+        size_t size = strlen(operator);
+        // "|" and "&" must not take the first half of "||" and "&&", nor "<" of "<<"
+        if (strncmp(cursor, operator, size) == 0 && !(size == 1 && cursor[1] == cursor[0] && strchr("|&<>", *cursor))) {
+            return operator;
+        }
+    }
+    return NULL;
+}
+
+static long int parse_expression(const char **cursor, int level, bool *ok) {
+    if (level == OPERATOR_LEVELS) return parse_operand(cursor, ok);
+    long int value = parse_expression(cursor, level + 1, ok);
+    for (;;) {
+        while (isspace((unsigned char)**cursor)) (*cursor)++;
+        const char *operator = match_operator(*cursor, level);
+        if (!operator || !*ok) return value;
+        *cursor += strlen(operator);
+        long int right = parse_expression(cursor, level + 1, ok);
+        if ((operator[0] == '/' || operator[0] == '%') && right == 0) {
+            *ok = false;
+            return 0;
+        }
+        switch (operator[0] + (operator[1] ? 256 * operator[1] : 0)) {
+            case '|' + 256 * '|': value = value || right; break;
+            case '&' + 256 * '&': value = value && right; break;
+            case '|': value |= right; break;
+            case '^': value ^= right; break;
+            case '&': value &= right; break;
+            case '=' + 256 * '=': value = value == right; break;
+            case '!' + 256 * '=': value = value != right; break;
+            case '<' + 256 * '=': value = value <= right; break;
+            case '>' + 256 * '=': value = value >= right; break;
+            case '<': value = value < right; break;
+            case '>': value = value > right; break;
+            case '<' + 256 * '<': value = (long int)((unsigned long int)value << (right & 63)); break;
+            case '>' + 256 * '>': value >>= (right & 63); break;
+            case '+': value += right; break;
+            case '-': value -= right; break;
+            case '*': value *= right; break;
+            case '/': value /= right; break;
+            default: value %= right; break;
+        }
+    }
+}
+
+/*
+ * Evaluates the integer expression operand of a directive.
+ *
+ * @param text: The expression.
+ * @param value: Receives its value.
+ * @return: true if the expression is valid, false (with a message) otherwise.
+ */
+static bool evaluate(const char *text, long int *value) {
+    bool ok = true;
+    *value = parse_expression(&text, 0, &ok);
+    while (isspace((unsigned char)*text)) text++;
+    if (!ok || *text != '\0') {
+        fprintf(stderr, "Invalid expression at line %d\n", source_line);
+        error_count++;
+        return false;
+    }
+    return true;
+}
+
+// Returns the text of a line after its first word (the directive)
+static const char *operands_of(const char *line) {
+    while (isspace((unsigned char)*line)) line++;
+    while (*line && !isspace((unsigned char)*line)) line++;
+    return line;
+}
+
+// Defines the macro recorded under the header ".macro name parameters..."
+static void define_macro(char *text, int length) {
+    char header[MAX_LINE_LENGTH];
+    strcpy(header, record_header);
+    char *words[MACRO_MAX_PARAMETERS + 3];
+    int count = split_words(header, words, MACRO_MAX_PARAMETERS + 3);
+    if (count < 2 || count > MACRO_MAX_PARAMETERS + 2) {
+        fprintf(stderr, "Invalid macro definition at line %d\n", record_line);
+        error_count++;
+        free(text);
+        return;
+    }
+    if (macro_count == macro_capacity) {
+        macro_capacity = macro_capacity ? 2 * macro_capacity : 16;
+        macros = allocate(macros, macro_capacity * sizeof(Macro));
+    }
+    Macro *macro = &macros[macro_count++];
+    macro->name = copy_text(words[1], (int)strlen(words[1]));
+    macro->parameter_count = count - 2;
+    for (int p = 0; p < macro->parameter_count; p++) {
+        char *word = words[p + 2];
+        char *equals = strchr(word, '=');
+        int size = equals ? (int)(equals - word) : (int)strlen(word);
+        macro->parameters[p] = copy_text(word, size);
+        macro->defaults[p] = equals ? copy_text(equals + 1, (int)strlen(equals + 1)) : copy_text("", 0);
+    }
+    macro->body = compile_body(text, length, macro->parameters, macro->parameter_count);
+}
+
+// Expands an invocation of a macro with the arguments of its line
+static void invoke_macro(int index, char *operands) {
+    Macro *macro = &macros[index];
+    char *words[MACRO_MAX_PARAMETERS + 1];
+    char *arguments[MACRO_MAX_PARAMETERS];
+    int count = split_words(operands, words, MACRO_MAX_PARAMETERS + 1);
+    for (int p = 0; p < macro->parameter_count; p++) arguments[p] = macro->defaults[p];
+    int next = 0;  // Next positional argument
+    for (int w = 0; w < count; w++) {
+        // "name=value" sets that parameter, anything else the next one
+        char *equals = strchr(words[w], '=');
+        int parameter = -1;
+        for (int p = 0; equals && p < macro->parameter_count && parameter < 0; p++) {
+            size_t size = strlen(macro->parameters[p]);
+            if (size == (size_t)(equals - words[w]) && strncmp(words[w], macro->parameters[p], size) == 0) {
+                parameter = p;
+            }
+        }
+        if (parameter >= 0) {
+            arguments[parameter] = equals + 1;
+        } else if (next < macro->parameter_count) {
+            arguments[next++] = words[w];
+        } else {
+            fprintf(stderr, "Too many arguments for macro %s at line %d\n", macro->name, source_line);
+            error_count++;
+            return;
+        }
+    }
+    invocations++;
+    if (macro->body.counter) {
+        Expansion expansion = { NULL, 0, 0 };
+        expand_body(&macro->body, arguments, &expansion);
+        replay(expansion.text, expansion.length);
+        free(expansion.text);
+        return;
+    }
+
+    // The cache key is the macro (its index, as a redefinition is another macro) and its arguments
+    char key[MAX_LINE_LENGTH + 16];
+    int length = snprintf(key, sizeof(key), "%d", index);
+    for (int p = 0; p < macro->parameter_count && length < (int)sizeof(key); p++) {
+        length += snprintf(key + length, sizeof(key) - length, "\x1f%s", arguments[p]);
+    }
+    if (2 * (cache_count + 1) > cache_size) {
+        // Keep the cache at most half full, rehashing it when it grows
+        CachedExpansion *old = cache;
+        unsigned int old_size = cache_size;
+        cache_size = cache_size ? 2 * cache_size : 64;
+        cache = allocate(NULL, cache_size * sizeof(CachedExpansion));
+        memset(cache, 0, cache_size * sizeof(CachedExpansion));
+        for (unsigned int s = 0; s < old_size; s++) {
+            if (old[s].key) cache[cache_slot(old[s].key)] = old[s];
+        }
+        free(old);
+    }
+    unsigned int slot = cache_slot(key);
+    if (!cache[slot].key) {
+        cache[slot].key = copy_text(key, (int)strlen(key));
+        cache[slot].expansion = (Expansion){ NULL, 0, 0 };
+        expand_body(&macro->body, arguments, &cache[slot].expansion);
+        cache_count++;
+    }
+    // Nested invocations may grow the cache: replay from the entry, not the slot
+    Expansion expansion = cache[slot].expansion;
+    replay(expansion.text, expansion.length);
+}
+
+// Expands the .rept or .irp block just recorded
+static void expand_block(int kind, char *text, int length) {
+    char header[MAX_LINE_LENGTH];
+    strcpy(header, record_header);
+    if (kind == RECORD_REPT) {
+        long int count;
+        if (evaluate(operands_of(header), &count)) {
+            for (long int r = 0; r < count; r++) replay(text, length);
+        }
+        free(text);
+        return;
+    }
+    char *words[MACRO_MAX_PARAMETERS * 16];
+    int count = split_words(header, words, MACRO_MAX_PARAMETERS * 16);
+    if (count < 2) {
+        fprintf(stderr, "Invalid .irp at line %d\n", record_line);
+        error_count++;
+        free(text);
+        return;
+    }
+    Body body = compile_body(text, length, &words[1], 1);
+    for (int w = 2; w < count; w++) {
+        Expansion expansion = { NULL, 0, 0 };
+        expand_body(&body, &words[w], &expansion);
+        replay(expansion.text, expansion.length);
+        free(expansion.text);
+    }
+    free(body.segments);
+    free(text);
+}
+
+/*
+ * Records a file the program is assembled from, once.
+ *
+ * @param path: The path of the file, as it was opened.
+ */
+void add_dependency(const char *path) {
+    for (int d = 0; d < dependency_count; d++) {
+        if (strcmp(dependencies[d], path) == 0) return;
+    }
+    if (dependency_count == dependency_capacity) {
+        dependency_capacity = dependency_capacity ? 2 * dependency_capacity : 16;
+        dependencies = allocate(dependencies, dependency_capacity * sizeof(char *));
+    }
+    dependencies[dependency_count++] = copy_text(path, (int)strlen(path));
+}
+
+/*
+ * Finds a file named by .include or .incbin: next to the file being preprocessed
+ * first, then in the working directory.
+ *
+ * @param name: The file name of the directive.
+ * @param path: Receives the path of the file found, or the name itself if there is none.
+ * @param size: The size of the path buffer.
+ * @return: true if a readable file was found.
+ */
+bool find_source_file(const char *name, char *path, size_t size) {
+    const char *slash = (current_file && name[0] != '/') ? strrchr(current_file, '/') : NULL;
+    if (slash) {
+        snprintf(path, size, "%.*s/%s", (int)(slash - current_file), current_file, name);
+        if (access(path, R_OK) == 0) return true;
+    }
+    snprintf(path, size, "%s", name);
+    return access(path, R_OK) == 0;
+}
+
+// Returns the included file read from the given path, reading and cleaning it on first use; -1 if it cannot be read
+static int load_included(const char *path) {
+    for (int f = 0; f < included_count; f++) {
+        if (strcmp(included[f].path, path) == 0) return f;
+    }
+    FILE *file = fopen(path, "r");
+    if (!file) return -1;
+    Expansion lines = { NULL, 0, 0 };
+    char line[MAX_LINE_LENGTH];
+    bool complete;
+    for (int number = 1; read_line(line, sizeof(line), file, &complete); number++) {
+        if (!complete) {
+            fprintf(stderr, "Line too long at line %d of %s: at most %d characters\n", number, path, MAX_LINE_LENGTH - 1);
+            error_count++;
+            continue;
+        }
+        long int bound = loop_bound_annotation(line);
+        if (bound != 0) {
+            char directive[32];
+            append_line(&lines, directive, snprintf(directive, sizeof(directive), ".loop_bound %ld", bound));
+        }
+        removeComment(line);
+        replaceCommas(line);
+        int length = (int)strcspn(line, "\r\n");
+        while (length > 0 && isspace((unsigned char)line[length - 1])) length--;
+        if (length > 0) append_line(&lines, line, length);
+    }
+    fclose(file);
+    if (included_count == included_capacity) {
+        included_capacity = included_capacity ? 2 * included_capacity : 16;
+        included = allocate(included, included_capacity * sizeof(IncludedFile));
+    }
+    included[included_count].path = copy_text(path, (int)strlen(path));
+    included[included_count].lines = lines;
+    add_dependency(path);
+    return included_count++;
+}
+
+// Preprocesses the lines of the file named by an .include directive
+static void include_file(char *operands) {
+    char *words[1];
+    if (split_words(operands, words, 1) == 0) {
+        fprintf(stderr, "Invalid .include at line %d\n", source_line);
+        error_count++;
+        return;
+    }
+    char *name = words[0];
+    size_t size = strlen(name);
+    if (size >= 2 && name[0] == '"' && name[size - 1] == '"') {
+        name[size - 1] = '\0';
+        name++;
+    }
+
+    char path[2 * MAX_LINE_LENGTH];
+    int file = find_source_file(name, path, sizeof(path)) ? load_included(path) : -1;
+    if (file < 0) {
+        fprintf(stderr, "Error including %s at line %d: ", name, source_line);
+        perror(NULL);
+        error_count++;
+        return;
+    }
+
+    // Nested includes may grow the table: keep the path and lines, not the entry
+    const char *outer = current_file;
+    Expansion lines = included[file].lines;
+    current_file = included[file].path;
+    replay(lines.text, lines.length);
+    current_file = outer;
+}
+
+// Returns true if the lines at this point are kept
+static bool active(void) {
+    return condition_count == 0 || conditions[condition_count - 1].active;
+}
+
+/*
+ * Handles .if, .elseif, .else and .endif.
+ *
+ * @return: true if the line held one of them.
+ */
+static bool conditional_directive(const char *directive, const char *operands) {
+    long int value = 0;
+    if (strcmp(directive, ".if") == 0) {
+        if (condition_count == MACRO_MAX_CONDITIONS) {
+            fprintf(stderr, ".if nested too deep at line %d\n", source_line);
+            exit(1);
+        }
+        Condition *condition = &conditions[condition_count];
+        condition->outer = active();
+        condition->active = condition->outer && evaluate(operands, &value) && value != 0;
+        condition->taken = condition->active;
+        condition_count++;
+    } else if (strcmp(directive, ".elseif") == 0 || strcmp(directive, ".else") == 0) {
+        if (condition_count == 0) {
+            fprintf(stderr, "%s without .if at line %d\n", directive, source_line);
+            error_count++;
+            return true;
+        }
+        Condition *condition = &conditions[condition_count - 1];
+        bool chosen = condition->outer && !condition->taken;
+        if (chosen && strcmp(directive, ".elseif") == 0) chosen = evaluate(operands, &value) && value != 0;
+        condition->active = chosen;
+        condition->taken = condition->taken || chosen;
+    } else if (strcmp(directive, ".endif") == 0) {
+        if (condition_count == 0) {
+            fprintf(stderr, ".endif without .if at line %d\n", source_line);
+            error_count++;
+        } else {
+            condition_count--;
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Runs a source line through the preprocessor, then the first pass. The line has
+ * its comment removed and its commas replaced already.
+ *
+ * @param line: The line; it may be modified.
+ */
+void preprocess_line(char *line) {
+    char directive[MAX_LINE_LENGTH] = "";
+    sscanf(line, "%255s", directive);
+
+    // Inside a definition or a repeated block, record the line up to the matching end
+    if (recording != RECORD_NONE) {
+        bool macro = (recording == RECORD_MACRO);
+        if (macro ? strcmp(directive, ".macro") == 0
+                  : (strcmp(directive, ".rept") == 0 || strcmp(directive, ".irp") == 0)) {
+            record_depth++;
+        } else if (strcmp(directive, macro ? ".endm" : ".endr") == 0 && record_depth-- == 0) {
+            // Release the recorder first: the expansion may record blocks of its own
+            int kind = recording;
+            char *text = recorded.text;
+            int length = recorded.length;
+            recording = RECORD_NONE;
+            recorded = (Expansion){ NULL, 0, 0 };
+            if (kind == RECORD_MACRO) {
+                define_macro(text, length);
+            } else {
+                expand_block(kind, text, length);
+            }
+            return;
+        }
+        int length = (int)strcspn(line, "\r\n");
+        while (length > 0 && isspace((unsigned char)line[length - 1])) length--;
+        append_line(&recorded, line, length);
+        return;
+    }
+
+    if (conditional_directive(directive, operands_of(line)) || !active()) return;
+
+    if (strcmp(directive, ".macro") == 0 || strcmp(directive, ".rept") == 0 || strcmp(directive, ".irp") == 0) {
+        recording = (directive[1] == 'm') ? RECORD_MACRO : (directive[2] == 'e') ? RECORD_REPT : RECORD_IRP;
+        record_depth = 0;
+        record_line = source_line;
+        strcpy(record_header, line);
+        return;
+    }
+    if (strcmp(directive, ".endm") == 0 || strcmp(directive, ".endr") == 0) {
+        fprintf(stderr, "%s without a block to end at line %d\n", directive, source_line);
+        error_count++;
+        return;
+    }
+    if (strcmp(directive, ".include") == 0) {
+        include_file((char *)operands_of(line));
+        return;
+    }
+
+    // An invocation, after the label of its line if it has one
+    char *rest = line;
+    size_t size = strlen(directive);
+    if (size > 1 && directive[size - 1] == ':') {
+        rest = strchr(line, ':') + 1;
+        sscanf(rest, "%255s", directive);
+    }
+    int macro = (macro_count > 0) ? find_macro(directive) : -1;
+    if (macro < 0) {
+        first_pass(line);
+        return;
+    }
+    if (rest != line) {
+        char label[MAX_LINE_LENGTH];
+        snprintf(label, sizeof(label), "%.*s \n", (int)(rest - line), line);
+        first_pass(label);  // The label marks the first instruction of the expansion
+    }
+    invoke_macro(macro, (char *)operands_of(rest));
+}
+
+/*
+ * Starts the preprocessor on a source file.
+ *
+ * @param file_name: The source file, the first dependency and the base of relative .include paths.
+ */
+void begin_preprocessor(const char *file_name) {
+    current_file = file_name;
+    add_dependency(file_name);
+}
+
+/*
+ * Reports the blocks still open at the end of the source.
+ *
+ * @return: The number of blocks left open.
+ */
+int end_preprocessor(void) {
+    int open = condition_count + (recording != RECORD_NONE);
+    if (recording != RECORD_NONE) {
+        fprintf(stderr, "Missing %s for the block started at line %d\n", recording == RECORD_MACRO ? ".endm" : ".endr",
+                record_line);
+    }
+    if (condition_count > 0) fprintf(stderr, "Missing .endif for %d .if blocks\n", condition_count);
+    return open;
+}
+
+// Writes a file name into a make rule, escaping the characters make would split or expand
+static void write_make_name(FILE *dependency_file, const char *name) {
+    for (; *name; name++) {
+        if (*name == ' ' || *name == '#') fputc('\\', dependency_file);
+        if (*name == '$') fputc('$', dependency_file);
+        fputc(*name, dependency_file);
+    }
+}
+
+/*
+ * Writes the dependencies of the output in make syntax, like the -MD -MP options of
+ * C compilers: one rule making the target depend on every source file, and an empty
+ * rule per included file so make does not stop when one of them is removed.
+ *
+ * @param dependency_file: The file receiving the rules.
+ * @param target: The output file the rules are for.
+ */
+void write_dependencies(FILE *dependency_file, const char *target) {
+    write_make_name(dependency_file, target);
+    fputc(':', dependency_file);
+    for (int d = 0; d < dependency_count; d++) {
+        fputs(" \\\n ", dependency_file);
+        write_make_name(dependency_file, dependencies[d]);
+    }
+    fputc('\n', dependency_file);
+    for (int d = 1; d < dependency_count; d++) {
+        fputc('\n', dependency_file);
+        write_make_name(dependency_file, dependencies[d]);
+        fputs(":\n", dependency_file);
+    }
+}
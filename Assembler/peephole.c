@@ -0,0 +1,280 @@
+/*
+ * RISC-V Assembler Peephole Optimizer
+ *
+ * This file contains the optional peephole pass run with --peephole. It works on
+ * the instructions recorded by the first pass, before any address is fixed, and
+ * repeats until nothing changes:
+ *   - jump threading: a branch or jump whose label marks an unconditional jump
+ *     (j / tail / jal x0) is retargeted to the end of the chain, up to PEEPHOLE_MAX_CHAIN
+ *     jumps deep (a chain running in a circle is left alone),
+ *   - "mv rd, rd" and "addi rd, rd, 0" (rd != x0) are removed; the canonical nop
+ *     "addi x0, x0, 0" is kept, as it is usually there on purpose,
+ *   - a branch, j, tail or jal x0 to the very next instruction is removed.
+ * The labels of a removed instruction move to the next one, together with its
+ * alignment and loop bound, and the layout recomputes every address afterwards.
+ *
+ * Unreachable-code elimination (--strip-unreachable) keeps only the instructions
+ * reachable from the first one, following fall-through, branches, jumps and calls.
+ * Indirect jumps and calls (jalr other than ret) are handled conservatively: every
+ * label whose address is taken by reachable code (la or any other operand naming
+ * it) or by data (.word label) counts as reachable. The labels of the removed
+ * instructions are removed as well, so the symbol map only lists live code.
+ */
+
+#include "assembler.h"
+
+#define PEEPHOLE_MAX_CHAIN 64  // Longest jump chain followed when threading
+
+// Splits the text of a recorded instruction into up to 4 tokens; returns the token count
+static int split_tokens(int index, char tokens[4][MAX_LINE_LENGTH]) {
+    int count = sscanf(statements[index].text, "%s %s %s %s", tokens[0], tokens[1], tokens[2], tokens[3]);
+    return (count < 0) ? 0 : count;
+}
+
+// Returns the label operand of a branch or jump, or -1 if it has none
+static int target_label(int index) {
+    if (statements[index].kind != KIND_BRANCH && statements[index].kind != KIND_JUMP) return -1;
+    char tokens[4][MAX_LINE_LENGTH];
+    int count = split_tokens(index, tokens);
+    return (count >= 2) ? find_label(tokens[count - 1]) : -1;
+}
+
+// Returns true if the instruction is an unconditional jump without a link (j, tail, jal x0)
+static bool is_plain_jump(int index) {
+    if (statements[index].kind != KIND_JUMP) return false;
+    char text[MAX_LINE_LENGTH];
+    strcpy(text, statements[index].text);
+    return ((assemble_instruction(text) >> 7) & 0x1F) == 0;
+}
+
+// Replaces the label operand of a branch or jump
+static void retarget(int index, const char *label) {
+    char tokens[4][MAX_LINE_LENGTH];
+    int count = split_tokens(index, tokens);
+    char text[MAX_LINE_LENGTH] = "";
+    for (int t = 0; t < count; t++) {
+        const char *token = (t == count - 1) ? label : tokens[t];
+        if (strlen(text) + strlen(token) + 2 > sizeof(text)) return;  // Leave an overlong line as it is
+        if (t > 0) strcat(text, " ");
+        strcat(text, token);
+    }
+    strcpy(statements[index].text, text);
+}
+
+// Returns true if a token is an immediate equal to zero ("0", "0x0", ...)
+static bool is_zero(const char *token) {
+    char *end;
+    long int value = strtol(token, &end, 0);
+    return end != token && *end == '\0' && value == 0;
+}
+
+/*
+ * Removes the marked instructions, binding their labels to the next instruction that
+ * stays, with their alignment and loop bound if carry is set.
+ */
+static void remove_statements(const bool *removed, bool carry) {
+    int *new_index = malloc((instruction_count + 1) * sizeof(int));
+    if (!new_index) {
+        perror("Error allocating peephole optimizer");
+        exit(1);
+    }
+    int kept = 0, align = 0, loop_bound = 0;
+    for (int i = 0; i < instruction_count; i++) {
+        new_index[i] = kept;
+        if (removed[i]) {
+            if (carry && statements[i].align > align) align = statements[i].align;
+            if (carry && loop_bound == 0) loop_bound = statements[i].loop_bound;
+            continue;
+        }
+        statements[kept] = statements[i];
+        if (align > statements[kept].align) statements[kept].align = align;
+        if (statements[kept].loop_bound == 0) statements[kept].loop_bound = loop_bound;
+        align = loop_bound = 0;
+        kept++;
+    }
+    new_index[instruction_count] = kept;
+    for (int l = 0; l < labelCount; l++) {
+        labelTable[l].statement = new_index[labelTable[l].statement];
+    }
+    instruction_count = kept;
+    free(new_index);
+}
+
+/*
+ * Runs the peephole optimizer over the recorded instructions. Must run right after
+ * the first pass, before scheduling and relaxation.
+ *
+ * @param stats: Receives the number of rewrites of each kind.
+ * @return: The number of instructions removed.
+ */
+int peephole_program(PeepholeStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    int original_count = instruction_count;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        // Thread branches and jumps through chains of unconditional jumps
+        for (int i = 0; i < instruction_count; i++) {
+            int label = target_label(i);
+            if (label < 0) continue;
+            int final = label, hops = 0;
+            while (hops < PEEPHOLE_MAX_CHAIN) {
+                int head = labelTable[final].statement;
+                if (head >= instruction_count || !is_plain_jump(head)) break;
+                int next = target_label(head);
+                if (next < 0 || labelTable[next].statement == head) break;  // "done: j done" ends a chain
+                final = next;
+                hops++;
+            }
+            if (hops == PEEPHOLE_MAX_CHAIN) continue;  // A circle of jumps
+            if (labelTable[final].statement != labelTable[label].statement) {
+                retarget(i, labelTable[final].label);
+                stats->threaded++;
+                changed = true;
+            }
+        }
+
+        // Remove the instructions without effect
+        bool *removed = calloc(instruction_count + 1, sizeof(bool));
+        if (!removed) {
+            perror("Error allocating peephole optimizer");
+            exit(1);
+        }
+        int removals = 0;
+        for (int i = 0; i < instruction_count; i++) {
+            char tokens[4][MAX_LINE_LENGTH];
+            int count = split_tokens(i, tokens);
+            if (count == 3 && strcmp(tokens[0], "mv") == 0) {
+                int rd = get_register_number(tokens[1]);
+                if (rd >= 0 && rd == get_register_number(tokens[2])) {
+                    removed[i] = true;
+                    stats->self_moves++;
+                }
+            } else if (count == 4 && strcmp(tokens[0], "addi") == 0) {
+                int rd = get_register_number(tokens[1]);
+                if (rd > 0 && rd == get_register_number(tokens[2]) && is_zero(tokens[3])) {
+                    removed[i] = true;
+                    stats->zero_adds++;
+                }
+            } else if (statements[i].kind == KIND_BRANCH || is_plain_jump(i)) {
+                int label = target_label(i);
+                if (label >= 0 && labelTable[label].statement == i + 1) {
+                    removed[i] = true;
+                    stats->jumps_to_next++;
+                }
+            }
+            if (removed[i]) removals++;
+        }
+        if (removals > 0) {
+            remove_statements(removed, true);
+            changed = true;
+        }
+        free(removed);
+    }
+    return original_count - instruction_count;
+}
+
+// Marks every label named by an operand of an instruction, inside %pcrel_hi(...) and the like too
+static void mark_operand_labels(int index, bool *taken) {
+    char text[MAX_LINE_LENGTH];
+    strcpy(text, statements[index].text);
+    for (char *token = strtok(text, " \t\n()"); token; token = strtok(NULL, " \t\n()")) {
+        int label = find_label(token);
+        if (label >= 0) taken[label] = true;
+    }
+}
+
+/*
+ * Removes the instructions that cannot be reached from the first one, and their
+ * labels. Must run after the first pass and the peephole optimizer, before the
+ * profile is read and any layout pass.
+ *
+ * @param bytes: Receives the bytes removed (before relaxation).
+ * @param labels: Receives the labels removed.
+ * @return: The number of instructions removed, or -1 if the program was kept as it is.
+ */
+int strip_unreachable(int *bytes, int *labels) {
+    *bytes = *labels = 0;
+    int n = instruction_count;
+    if (n == 0) return 0;
+    bool *reached = calloc(n + 1, sizeof(bool));
+    bool *taken = calloc(labelCount + 1, sizeof(bool));  // Labels reachable code takes the address of
+    int *stack = malloc((n + labelCount + 1) * sizeof(int));
+    if (!reached || !taken || !stack) {
+        perror("Error allocating unreachable-code elimination");
+        exit(1);
+    }
+
+    // Labels named by data (tables of addresses) are address-taken too
+    for (int i = 0; i < n; i++) {
+        if (statements[i].kind == KIND_DATA) mark_operand_labels(i, taken);
+    }
+
+    // Depth-first search over the successors of every reached instruction
+    int top = 0;
+    stack[top++] = 0;
+    reached[0] = true;
+    while (top > 0) {
+        int i = stack[--top];
+        StatementInfo info;
+        describe_statement(i, &info);
+        unsigned int opcode = info.code & 0x7F;
+        int successors[2] = { -1, -1 };
+        if (statements[i].kind == KIND_BRANCH || statements[i].kind == KIND_JUMP) {
+            int label = target_label(i);
+            if (label < 0) {
+                // An offset given as a number: its target is not known before the layout
+                fprintf(stderr, "Unreachable code kept: no label operand at line %d\n", statements[i].line);
+                free(reached);
+                free(taken);
+                free(stack);
+                return -1;
+            }
+            successors[0] = labelTable[label].statement;
+        } else if (!info.is_control) {
+            mark_operand_labels(i, taken);
+        }
+        // Everything but jal x0 and jalr x0 (jumps, returns) continues with the next instruction
+        if (!info.is_control || opcode == 0b1100011 || info.rd != 0) successors[1] = i + 1;
+        for (int s = 0; s < 2; s++) {
+            int next = successors[s];
+            if (next >= 0 && next < n && !reached[next]) {
+                reached[next] = true;
+                stack[top++] = next;
+            }
+        }
+        // Address-taken labels may be the target of any indirect jump or call
+        for (int l = 0; top == 0 && l < labelCount; l++) {
+            int next = labelTable[l].statement;
+            if (taken[l] && next < n && !reached[next]) {
+                reached[next] = true;
+                stack[top++] = next;
+            }
+        }
+    }
+
+    // Remove the unreached instructions and the labels bound to them
+    bool *removed = calloc(n + 1, sizeof(bool));
+    bool *dropped = calloc(labelCount + 1, sizeof(bool));
+    if (!removed || !dropped) {
+        perror("Error allocating unreachable-code elimination");
+        exit(1);
+    }
+    for (int i = 0; i < n; i++) {
+        removed[i] = !reached[i] && statements[i].kind != KIND_DATA;  // Data is never executed
+        if (removed[i]) *bytes += statements[i].size;
+    }
+    for (int l = 0; l < labelCount; l++) {
+        dropped[l] = labelTable[l].statement < n && removed[labelTable[l].statement];
+    }
+    *labels = remove_labels(dropped);
+    remove_statements(removed, false);
+
+    free(reached);
+    free(taken);
+    free(stack);
+    free(removed);
+    free(dropped);
+    return n - instruction_count;
+}
@@ -0,0 +1,174 @@
+/*
+ * RISC-V Assembler Literal Pool
+ *
+ * This file contains the optional literal-pool pass run with --literal-pool. A
+ * constant whose inline form needs more than one instruction (li expanded to
+ * lui+addi) is stored once in a pool and loaded with "lw rd, symbol", that is
+ * auipc+lw. Pools are placed right after an instruction that never falls through
+ * (a jump or a return), the first such point after their users, so no extra jump is
+ * needed and the data stays close to the code using it. A later load of the same
+ * value shares the entry already placed when it lies within POOL_SHARE_RANGE bytes,
+ * otherwise the value goes to the next pool again. auipc+lw reaches +-2 GiB, so every
+ * entry stays in range whatever the relaxation does to the code in between.
+ * Constants still waiting for a pool when the program ends (the last instruction
+ * falls through) are left inline.
+ */
+
+#include "assembler.h"
+
+#define POOL_SHARE_RANGE 1024  // Farthest entry (in bytes) a load shares instead of getting its own
+
+// Structure holding one constant of a pool
+typedef struct {
+    int value;
+    int label;         // Label of the entry once placed, -1 while pending
+    int address;       // Estimated address of the entry (sizes before relaxation)
+} PoolEntry;
+
+// Returns true if execution can continue with the instruction after this one
+static bool falls_through(int index) {
+    StatementInfo info;
+    describe_statement(index, &info);
+    return !info.is_control || (info.code & 0x7F) == 0b1100011 || info.rd != 0;
+}
+
+/*
+ * Moves the large constants of li instructions into literal pools. Must run after
+ * the passes that reorder instructions and before the relaxation.
+ *
+ * @param compress: true if the program is compressed, for the inline size it is compared with.
+ * @param stats: Receives the loads, entries and pools, and the inline and pooled sizes.
+ * @return: The number of li instructions turned into loads.
+ */
+int build_literal_pools(bool compress, PoolStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    int n = instruction_count;
+    PoolEntry *entries = malloc((n + 1) * sizeof(PoolEntry));
+    int *user_entry = malloc((n + 1) * sizeof(int));  // Entry loaded by each instruction, -1 if none
+    int *flush_after = malloc((n + 1) * sizeof(int)); // Entries placed after each instruction: first of them
+    int *flush_count = calloc(n + 1, sizeof(int));
+    if (!entries || !user_entry || !flush_after || !flush_count) {
+        perror("Error allocating literal pool");
+        exit(1);
+    }
+
+    // Assign every large constant to an entry, and every entry to the pool after its first user
+    int entry_count = 0, pending_first = 0, address = 0;
+    for (int i = 0; i < n; i++) {
+        user_entry[i] = -1;
+        Statement *statement = &statements[i];
+        char mnemonic[MAX_LINE_LENGTH], rd[MAX_LINE_LENGTH], value[MAX_LINE_LENGTH];
+        if (statement->kind == KIND_CONSTANT && statement->size == 8 &&
+            sscanf(statement->text, "%s %s %s", mnemonic, rd, value) == 3 && get_register_number(rd) > 0) {
+            int constant = (int)convertToDecimal(value);
+            int found = -1;
+            for (int e = entry_count - 1; e >= 0 && found < 0; e--) {
+                bool pending = (e >= pending_first);
+                if (entries[e].value == constant && (pending || address - entries[e].address <= POOL_SHARE_RANGE)) {
+                    found = e;
+                }
+            }
+            if (found < 0) {
+                found = entry_count++;
+                entries[found].value = constant;
+                entries[found].label = -1;
+                entries[found].address = -1;
+            }
+            user_entry[i] = found;
+        }
+        address += statement->size;
+        if (entry_count > pending_first && !falls_through(i)) {
+            // The pending entries follow this instruction, word-aligned
+            flush_after[i] = pending_first;
+            flush_count[i] = entry_count - pending_first;
+            address = (address + 3) & ~3;
+            for (int e = pending_first; e < entry_count; e++) {
+                entries[e].address = address;
+                address += 4;
+            }
+            pending_first = entry_count;
+        }
+    }
+
+    // Rewrite the users of placed entries; the ones still pending keep their li
+    Statement *moved = malloc((n + entry_count + 1) * sizeof(Statement));
+    int *new_index = malloc((n + 1) * sizeof(int));
+    int *entry_position = malloc((entry_count + 1) * sizeof(int));
+    if (!moved || !new_index || !entry_position) {
+        perror("Error allocating literal pool");
+        exit(1);
+    }
+    int position = 0;
+    for (int i = 0; i < n; i++) {
+        new_index[i] = position;
+        moved[position++] = statements[i];
+        for (int k = 0; k < flush_count[i]; k++) {
+            int e = flush_after[i] + k;
+            Statement *word = &moved[position];
+            unsigned char bytes[4];
+            for (int b = 0; b < 4; b++) bytes[b] = ((unsigned int)entries[e].value >> (8 * b)) & 0xFF;
+            memset(word, 0, sizeof(*word));
+            snprintf(word->text, sizeof(word->text), ".word 0x%08X", (unsigned int)entries[e].value);
+            word->data = add_data(bytes, 4);
+            word->blob = -1;
+            word->size = 4;
+            word->kind = KIND_DATA;
+            word->form = FORM_NORMAL;
+            word->target = -1;
+            word->align = (k == 0) ? 4 : 0;
+            word->line = 0;  // No source line of its own
+            entry_position[e] = position++;
+            stats->entries++;
+            stats->pool_bytes += 4;
+        }
+        if (flush_count[i] > 0) stats->pools++;
+    }
+    new_index[n] = position;
+    for (int l = 0; l < labelCount; l++) labelTable[l].statement = new_index[labelTable[l].statement];
+    for (int e = 0; e < entry_count; e++) {
+        if (e >= pending_first) break;  // Never placed
+        char name[MAX_LINE_LENGTH];
+        int serial = 0;
+        do {
+            snprintf(name, sizeof(name), ".LC%d", e + serial);
+            serial += entry_count;
+        } while (find_label(name) >= 0);
+        add_label(name, entry_position[e]);
+        entries[e].label = labelCount - 1;
+    }
+    for (int i = 0; i < n; i++) {
+        int e = user_entry[i];
+        if (e < 0 || entries[e].label < 0) continue;
+        Statement *statement = &moved[new_index[i]];
+        char mnemonic[MAX_LINE_LENGTH], rd[MAX_LINE_LENGTH];
+        sscanf(statement->text, "%s %s", mnemonic, rd);
+        unsigned int codes[2];
+        int words = materialize_constant(get_register_number(rd), entries[e].value, codes);
+        for (int w = 0; w < words; w++) {
+            stats->inline_bytes += (compress && compress_instruction(codes[w]) != 0) ? 2 : 4;
+        }
+        stats->inline_instructions += words;
+        snprintf(statement->text, sizeof(statement->text), "lw %.*s %.*s", MAX_LINE_LENGTH / 4, rd,
+                 MAX_LINE_LENGTH / 2, labelTable[entries[e].label].label);
+        statement->kind = KIND_OTHER;
+        statement->size = 8;
+        stats->loads++;
+        stats->pool_bytes += 8;  // auipc+lw
+    }
+
+    // Replace the instruction list
+    instruction_count = 0;
+    for (int i = 0; i < position; i++) {
+        add_statement(moved[i].text, moved[i].size, moved[i].kind);
+        statements[i] = moved[i];
+    }
+
+    free(entries);
+    free(user_entry);
+    free(flush_after);
+    free(flush_count);
+    free(moved);
+    free(new_index);
+    free(entry_position);
+    return stats->loads;
+}
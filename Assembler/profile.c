@@ -0,0 +1,796 @@
+/*
+ * RISC-V Assembler Profile-Guided Layout
+ *
+ * This file contains the code layout driven by an execution profile (--profile),
+ * as written by the simulator's --profile option or by any other tool:
+ *   <label> <count>                         instructions executed in the region of the label
+ *   call <caller label> <callee label> <n>  calls from the region of one label to another
+ *   branch <label> <n> <target> <taken> <not taken>
+ *                                           outcomes of the n-th conditional branch after the label
+ * Blank lines and lines starting with '#' are ignored.
+ *
+ * Function ordering packs the hot functions together so they share as few I-cache
+ * lines as possible, in the way of Pettis and Hansen. Functions start at the first
+ * instruction, at every jal rd (rd != x0) target and at every callee of the profile,
+ * and run up to the next function. A function falling through into the next one is
+ * glued to it, so every unit moved ends with a jump or a return. Starting with one
+ * chain per unit, the chains joined by the heaviest call edge are merged first,
+ * in the order that places the caller and the callee closest. The chain of the
+ * program entry stays first, the other hot chains follow by decreasing count and the
+ * functions never executed go to the end in source order. The labels move with their
+ * instructions, so the layout recomputes every branch and jal offset afterwards.
+ *
+ * Block layout (--block-layout) then reorders the basic blocks inside every unit so
+ * the likely successor of each block falls through. Blocks are chained the same way,
+ * along the edges by decreasing count: branch edges count their profiled outcomes,
+ * fall-through and jump edges the times their block runs, found by following the
+ * profiled counts through the blocks without a branch. On equal counts a fall-through
+ * comes first (breaking it would cost a jump), then a branch edge, then a jump, whose
+ * chaining makes the jump unnecessary. A cold block between a hot block and its
+ * target thus moves out of the way. The entry block stays first. A branch followed by
+ * its taken successor is inverted (beq/bne, blt/bge, bltu/bgeu and their
+ * pseudo-instructions), a block followed by neither of its successors gets a "j" to
+ * its fall-through block, and a "j" to the next block is removed. The branch outcomes
+ * must come from a build without --block-layout: a branch is found by its position
+ * after its label, and its counts are swapped when the profiled build had it inverted
+ * by relaxation.
+ */
+
+#include "assembler.h"
+
+// Structure holding one call edge of the profile, or an edge between two units
+typedef struct {
+    int from, to;      // Caller and callee labels (units once mapped)
+    long long count;   // Calls
+} ProfileEdge;
+
+// Structure holding a unit of the function ordering: functions that must stay together
+typedef struct {
+    int first, last;   // First and last instruction
+    int bytes;         // Size in bytes before relaxation
+    long long count;   // Instructions executed in the unit
+    int chain;         // Chain holding the unit
+    int next;          // Next unit of the chain, -1 at its end
+} Unit;
+
+// Structure holding a chain of units being merged
+typedef struct {
+    int head, tail;    // First and last unit
+    int bytes;
+    long long count;
+} Chain;
+
+// Structure holding the outcomes of one conditional branch of the profile
+typedef struct {
+    int region;        // Label starting the region holding the branch
+    int index;         // Position among the conditional branches of the region
+    int target;        // Label reached when taken, -1 if none (an inverted, relaxed branch)
+    long long taken;
+    long long fall;
+} ProfileBranch;
+
+static long long *label_counts = NULL;  // Instructions executed in the region of each label
+static ProfileEdge *calls = NULL;       // Call edges of the profile, by label
+static int call_count = 0;
+static ProfileBranch *branches = NULL;  // Branch outcomes of the profile
+static int branch_count = 0;
+
+/*
+ * Reads an execution profile. Must run after the first pass, when the labels are
+ * known; the entries of unknown labels are counted and reported, then ignored.
+ *
+ * @param file_name: The profile file.
+ * @return: 0 on success, 1 if the file cannot be read or a line is invalid.
+ */
+int load_profile(const char *file_name) {
+    FILE *profile_file = fopen(file_name, "r");
+    if (!profile_file) {
+        perror("Error opening profile");
+        return 1;
+    }
+    free(label_counts);
+    label_counts = calloc(labelCount + 1, sizeof(long long));
+    if (!label_counts) {
+        perror("Error allocating profile");
+        exit(1);
+    }
+
+    char line[3 * MAX_LINE_LENGTH];
+    int line_number = 0, unknown = 0;
+    while (fgets(line, sizeof(line), profile_file)) {
+        line_number++;
+        char first[MAX_LINE_LENGTH], caller[MAX_LINE_LENGTH], callee[MAX_LINE_LENGTH];
+        long long count, fall;
+        int index;
+        if (sscanf(line, "%255s", first) != 1 || first[0] == '#') continue;  // Blank or comment
+        if (strcmp(first, "branch") == 0 &&
+            sscanf(line, "%*s %255s %d %255s %lld %lld", caller, &index, callee, &count, &fall) == 5) {
+            int region = find_label(caller);
+            if (region < 0) {
+                unknown++;
+                continue;
+            }
+            branches = realloc(branches, (branch_count + 1) * sizeof(ProfileBranch));
+            if (!branches) {
+                perror("Error allocating profile");
+                exit(1);
+            }
+            branches[branch_count].region = region;
+            branches[branch_count].index = index;
+            branches[branch_count].target = find_label(callee);  // "label+offset" is not a label
+            branches[branch_count].taken = count;
+            branches[branch_count].fall = fall;
+            branch_count++;
+        } else if (strcmp(first, "call") == 0 && sscanf(line, "%*s %255s %255s %lld", caller, callee, &count) == 3) {
+            int from = find_label(caller), to = find_label(callee);
+            if (from < 0 || to < 0) {
+                unknown++;
+                continue;
+            }
+            calls = realloc(calls, (call_count + 1) * sizeof(ProfileEdge));
+            if (!calls) {
+                perror("Error allocating profile");
+                exit(1);
+            }
+            calls[call_count].from = from;
+            calls[call_count].to = to;
+            calls[call_count].count = count;
+            call_count++;
+        } else if (strcmp(first, "call") != 0 && strcmp(first, "branch") != 0 &&
+                   sscanf(line, "%*s %lld", &count) == 1) {
+            int label = find_label(first);
+            if (label < 0) {
+                unknown++;
+            } else {
+                label_counts[label] += count;
+            }
+        } else {
+            fprintf(stderr, "Invalid profile entry at %s:%d\n", file_name, line_number);
+            fclose(profile_file);
+            return 1;
+        }
+    }
+    fclose(profile_file);
+    if (unknown > 0) fprintf(stderr, "Profile: ignored %d entries of unknown labels\n", unknown);
+    return 0;
+}
+
+// Returns the number of bytes of the instructions from first up to last
+static int range_bytes(int first, int last) {
+    int bytes = 0;
+    for (int i = first; i <= last; i++) bytes += statements[i].size;
+    return bytes;
+}
+
+// Returns the bytes from the start of a chain to the start of one of its units
+static int offset_in_chain(const Unit *units, int chain_head, int unit) {
+    int offset = 0;
+    for (int u = chain_head; u != unit; u = units[u].next) offset += units[u].bytes;
+    return offset;
+}
+
+// Returns the label operand of a branch or jump, or -1 if it has none
+static int operand_label(int index) {
+    char tokens[4][MAX_LINE_LENGTH];
+    int count = sscanf(statements[index].text, "%s %s %s %s", tokens[0], tokens[1], tokens[2], tokens[3]);
+    return (count >= 2) ? find_label(tokens[count - 1]) : -1;
+}
+
+/*
+ * Splits the program into units: functions, glued to the previous one when it falls
+ * through into them. Functions start at the entry, at call targets and at the
+ * callees of the profile.
+ *
+ * @param units: Receives the units (instruction_count entries at most).
+ * @param unit_of: Receives the unit of every instruction.
+ * @param functions: Receives the number of functions.
+ * @param pass: The name of the pass, for the message when the program cannot be split.
+ * @return: The number of units, or -1 if a branch or jump has no label operand.
+ */
+static int find_units(Unit *units, int *unit_of, int *functions, const char *pass) {
+    int n = instruction_count;
+    bool *starts = calloc(n + 1, sizeof(bool));
+    bool *falls = malloc((n + 1) * sizeof(bool));  // Execution can continue with the next instruction
+    if (!starts || !falls) {
+        perror("Error allocating profile-guided layout");
+        exit(1);
+    }
+    starts[0] = true;
+    for (int i = 0; i < n; i++) {
+        StatementInfo info;
+        describe_statement(i, &info);
+        unsigned int opcode = info.code & 0x7F;
+        falls[i] = !info.is_control || opcode == 0b1100011 || info.rd != 0;
+        if (statements[i].kind != KIND_BRANCH && statements[i].kind != KIND_JUMP) continue;
+        int label = operand_label(i);
+        if (label < 0) {
+            // An offset given as a number would no longer reach its target
+            fprintf(stderr, "%s skipped: no label operand at line %d\n", pass, statements[i].line);
+            free(starts);
+            free(falls);
+            return -1;
+        }
+        if (opcode == 0b1101111 && info.rd != 0) starts[labelTable[label].statement] = true;
+    }
+    for (int c = 0; c < call_count; c++) starts[labelTable[calls[c].to].statement] = true;
+    *functions = 0;
+    for (int i = 0; i < n; i++) *functions += starts[i];
+
+    int unit_count = 0;
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || (starts[i] && !falls[i - 1])) {
+            units[unit_count].first = i;
+            units[unit_count].count = 0;
+            unit_count++;
+        }
+        units[unit_count - 1].last = i;
+        unit_of[i] = unit_count - 1;
+    }
+    free(starts);
+    free(falls);
+    return unit_count;
+}
+
+// Orders edges by decreasing count
+static int compare_edges(const void *a, const void *b) {
+    long long left = ((const ProfileEdge *)a)->count, right = ((const ProfileEdge *)b)->count;
+    return (left < right) - (left > right);
+}
+
+/*
+ * Reorders the functions of the program from the loaded profile. Must run before
+ * the scheduler and the relaxation, while every branch and jump still names its label.
+ *
+ * @param stats: Receives the number of functions and units, and the span of the hot code.
+ * @return: 0 on success, 1 if the program cannot be reordered (left unchanged).
+ */
+int order_functions(FunctionOrderStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    int n = instruction_count;
+    if (n == 0 || !label_counts) return 0;
+
+    Unit *units = malloc(n * sizeof(Unit));
+    int *unit_of = malloc(n * sizeof(int));
+    if (!units || !unit_of) {
+        perror("Error allocating function ordering");
+        exit(1);
+    }
+    int unit_count = find_units(units, unit_of, &stats->functions, "Function ordering");
+    if (unit_count < 0) {
+        free(units);
+        free(unit_of);
+        return 1;
+    }
+    for (int l = 0; l < labelCount; l++) {
+        if (labelTable[l].statement < n) units[unit_of[labelTable[l].statement]].count += label_counts[l];
+    }
+    Chain *chains = malloc(unit_count * sizeof(Chain));
+    if (!chains) {
+        perror("Error allocating function ordering");
+        exit(1);
+    }
+    for (int u = 0; u < unit_count; u++) {
+        units[u].bytes = range_bytes(units[u].first, units[u].last);
+        units[u].chain = u;
+        units[u].next = -1;
+        chains[u].head = chains[u].tail = u;
+        chains[u].bytes = units[u].bytes;
+        chains[u].count = units[u].count;
+    }
+
+    // Merge the chains along the call edges, heaviest first
+    ProfileEdge *edges = malloc((call_count + 1) * sizeof(ProfileEdge));
+    if (!edges) {
+        perror("Error allocating function ordering");
+        exit(1);
+    }
+    int edge_count = 0;
+    for (int c = 0; c < call_count; c++) {
+        int caller = labelTable[calls[c].from].statement, callee = labelTable[calls[c].to].statement;
+        if (caller >= n || callee >= n || calls[c].count <= 0) continue;  // Labels past the last instruction
+        int from = unit_of[caller], to = unit_of[callee];
+        if (from == to) continue;
+        edges[edge_count].from = from;
+        edges[edge_count].to = to;
+        edges[edge_count].count = calls[c].count;
+        edge_count++;
+    }
+    qsort(edges, edge_count, sizeof(ProfileEdge), compare_edges);
+    for (int e = 0; e < edge_count; e++) {
+        int a = units[edges[e].from].chain, b = units[edges[e].to].chain;
+        if (a == b) continue;
+        // Distance between caller and callee with a before b, and with b before a
+        int a_first = chains[a].bytes - offset_in_chain(units, chains[a].head, edges[e].from) +
+                      offset_in_chain(units, chains[b].head, edges[e].to);
+        int b_first = chains[b].bytes - offset_in_chain(units, chains[b].head, edges[e].to) +
+                      offset_in_chain(units, chains[a].head, edges[e].from);
+        bool swap = (units[0].chain == b) || (units[0].chain != a && b_first < a_first);
+        int front = swap ? b : a, back = swap ? a : b;
+        units[chains[front].tail].next = chains[back].head;
+        chains[front].tail = chains[back].tail;
+        chains[front].bytes += chains[back].bytes;
+        chains[front].count += chains[back].count;
+        for (int u = chains[back].head; u != -1; u = units[u].next) units[u].chain = front;
+    }
+
+    // Entry chain first, then the hot chains by decreasing count, then the cold units in source order
+    int *order = malloc(unit_count * sizeof(int));
+    if (!order) {
+        perror("Error allocating function ordering");
+        exit(1);
+    }
+    int ordered = 0;
+    order[ordered++] = units[0].chain;
+    for (int u = 0; u < unit_count; u++) {
+        int c = units[u].chain;
+        if (chains[c].head != u || c == units[0].chain || chains[c].count <= 0) continue;
+        int k = ordered++;
+        while (k > 1 && chains[order[k - 1]].count < chains[c].count) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = c;
+    }
+    for (int u = 0; u < unit_count; u++) {
+        int c = units[u].chain;
+        if (chains[c].head == u && c != units[0].chain && chains[c].count <= 0) order[ordered++] = c;
+    }
+
+    // Hot code size, and the span it covered in source order
+    int hot_first = -1, hot_last = -1;
+    for (int u = 0; u < unit_count; u++) {
+        if (units[u].count <= 0) continue;
+        stats->hot++;
+        stats->hot_bytes += units[u].bytes;
+        if (hot_first < 0) hot_first = units[u].first;
+        hot_last = units[u].last;
+    }
+    stats->cold = unit_count - stats->hot;
+    stats->span_before = (hot_first >= 0) ? range_bytes(hot_first, hot_last) : 0;
+
+    // Move the instructions unit by unit and rebind the labels
+    Statement *moved = malloc(n * sizeof(Statement));
+    int *new_index = malloc((n + 1) * sizeof(int));
+    if (!moved || !new_index) {
+        perror("Error allocating function ordering");
+        exit(1);
+    }
+    int position = 0;
+    for (int k = 0; k < ordered; k++) {
+        for (int u = chains[order[k]].head; u != -1; u = units[u].next) {
+            for (int i = units[u].first; i <= units[u].last; i++) {
+                new_index[i] = position;
+                moved[position++] = statements[i];
+            }
+        }
+    }
+    new_index[n] = n;
+    memcpy(statements, moved, n * sizeof(Statement));
+    for (int l = 0; l < labelCount; l++) labelTable[l].statement = new_index[labelTable[l].statement];
+    hot_first = n;
+    hot_last = -1;
+    for (int u = 0; u < unit_count; u++) {
+        if (units[u].count <= 0) continue;
+        if (new_index[units[u].first] < hot_first) hot_first = new_index[units[u].first];
+        if (new_index[units[u].last] > hot_last) hot_last = new_index[units[u].last];
+    }
+    stats->span_after = (hot_last >= 0) ? range_bytes(hot_first, hot_last) : 0;
+
+    free(units);
+    free(unit_of);
+    free(chains);
+    free(edges);
+    free(order);
+    free(moved);
+    free(new_index);
+    return 0;
+}
+
+// Kinds of block endings for the block layout
+#define END_NONE 0    // Return, indirect jump or end of the program: no successor in the unit
+#define END_FALL 1    // Falls through to the next block (any instruction, or a call)
+#define END_BRANCH 2  // Conditional branch: taken and fall-through successors
+#define END_JUMP 3    // Jump to a block of the unit
+
+// Structure holding one basic block of the block layout
+typedef struct {
+    int first, last;   // First and last instruction
+    int end;           // END_NONE ... END_JUMP
+    int taken;         // Block reached by the branch or jump, -1 if outside the unit
+    int fall;          // Next block in source order when execution continues there, -1 if none
+    long long taken_count, fall_count;  // Branch outcomes of the profile
+    bool profiled;     // The profile has outcomes for the branch ending the block
+    int next;          // Next block of the chain, -1 at its end
+    int prev;          // Previous block of the chain, -1 at its start
+} Block;
+
+// Structure holding a candidate edge of the block layout
+typedef struct {
+    int from, to;
+    long long weight;  // Times the edge is followed
+    int rank;          // Order between equal weights: fall-through 0, branch 1, jump 2
+} BlockEdge;
+
+// Returns the representative of the chain holding a block (union-find with path halving)
+static int chain_root(int *parent, int b) {
+    while (parent[b] != b) {
+        parent[b] = parent[parent[b]];
+        b = parent[b];
+    }
+    return b;
+}
+
+// Orders block edges by decreasing weight, then by rank and source order
+static int compare_block_edges(const void *a, const void *b) {
+    const BlockEdge *left = a, *right = b;
+    if (left->weight != right->weight) return (left->weight < right->weight) - (left->weight > right->weight);
+    if (left->rank != right->rank) return left->rank - right->rank;
+    return left->from - right->from;
+}
+
+// Joins the chain ending with block 'from' to the chain starting with block 'to', if both are free
+static void chain_blocks(Block *blocks, int *parent, int entry, int from, int to) {
+    if (from < 0 || to < 0 || to == entry || blocks[from].next >= 0 || blocks[to].prev >= 0) return;
+    int a = chain_root(parent, from), b = chain_root(parent, to);
+    if (a == b) return;  // Would close a circle
+    blocks[from].next = to;
+    blocks[to].prev = from;
+    parent[b] = a;
+}
+
+// Returns a label marking the first instruction of a block, adding one if it has none (or a too long one)
+static int block_label(const Block *block, int *label_of) {
+    if (label_of[block->first] < 0 || strlen(labelTable[label_of[block->first]].label) > MAX_LINE_LENGTH / 2) {
+        static int generated = 0;
+        char name[MAX_LINE_LENGTH];
+        do {
+            snprintf(name, sizeof(name), ".Lbb%d", generated++);
+        } while (find_label(name) >= 0);
+        add_label(name, block->first);
+        label_of[block->first] = labelCount - 1;
+    }
+    return label_of[block->first];
+}
+
+// Rewrites a conditional branch into the opposite condition, to a new label
+static bool invert_branch(Statement *statement, const char *label) {
+    static const char *opposites[][2] = {
+        { "beq", "bne" }, { "blt", "bge" }, { "bltu", "bgeu" },
+        { "bgt", "ble" }, { "bgtu", "bleu" }, { "beqz", "bnez" },
+    };
+    char tokens[4][MAX_LINE_LENGTH];
+    int count = sscanf(statement->text, "%s %s %s %s", tokens[0], tokens[1], tokens[2], tokens[3]);
+    const char *mnemonic = NULL;
+    for (int o = 0; o < (int)(sizeof(opposites) / sizeof(opposites[0])) && !mnemonic; o++) {
+        if (strcmp(tokens[0], opposites[o][0]) == 0) mnemonic = opposites[o][1];
+        if (strcmp(tokens[0], opposites[o][1]) == 0) mnemonic = opposites[o][0];
+    }
+    if (!mnemonic || count < 2) return false;
+    char text[MAX_LINE_LENGTH];
+    int length = snprintf(text, sizeof(text), "%s", mnemonic);
+    for (int t = 1; t < count - 1; t++) length += snprintf(text + length, sizeof(text) - length, " %s", tokens[t]);
+    length += snprintf(text + length, sizeof(text) - length, " %s", label);
+    if (length >= (int)sizeof(text)) return false;
+    strcpy(statement->text, text);
+    return true;
+}
+
+/*
+ * Finds the outcomes of the profile for every conditional branch of the program.
+ *
+ * @param blocks, block_of: The blocks and the block of every instruction.
+ * @param label_of: The first label of every instruction, -1 if none.
+ */
+static void assign_branch_counts(Block *blocks, const int *block_of, const int *label_of) {
+    int n = instruction_count;
+    for (int p = 0; p < branch_count; p++) {
+        ProfileBranch *branch = &branches[p];
+        int first = labelTable[branch->region].statement, seen = 0;
+        for (int i = first; i < n && (i == first || label_of[i] < 0); i++) {
+            StatementInfo info;
+            describe_statement(i, &info);
+            if ((info.code & 0x7F) != 0b1100011) continue;
+            if (seen++ != branch->index) continue;
+            Block *block = &blocks[block_of[i]];
+            if (block->last != i) break;
+            int target = operand_label(i);
+            bool same = branch->target >= 0 && target >= 0 &&
+                        labelTable[branch->target].statement == labelTable[target].statement;
+            block->taken_count += same ? branch->taken : branch->fall;
+            block->fall_count += same ? branch->fall : branch->taken;
+            block->profiled = true;
+            break;
+        }
+    }
+}
+
+/*
+ * Counts the times every block runs from the profiled branch outcomes: a block ending
+ * with a profiled branch runs as often as its outcomes add up to, any other block as
+ * often as the edges into it are followed. Blocks reached only from the entry or
+ * through unprofiled branches count 0. Passes repeat until the counts settle (a cycle
+ * without a profiled branch never exits, so the passes stop after one per block).
+ */
+static void count_block_runs(const Block *blocks, int block_count, long long *runs) {
+    long long *inflow = malloc(block_count * sizeof(long long));
+    if (!inflow) {
+        perror("Error allocating block layout");
+        exit(1);
+    }
+    for (int b = 0; b < block_count; b++) runs[b] = 0;
+    for (int pass = 0; pass < block_count; pass++) {
+        memset(inflow, 0, block_count * sizeof(long long));
+        for (int b = 0; b < block_count; b++) {
+            const Block *block = &blocks[b];
+            if (block->end == END_BRANCH && block->profiled) {
+                if (block->taken >= 0) inflow[block->taken] += block->taken_count;
+                if (block->fall >= 0) inflow[block->fall] += block->fall_count;
+            } else if (block->end == END_FALL && block->fall >= 0) {
+                inflow[block->fall] += runs[b];
+            } else if (block->end == END_JUMP) {
+                inflow[block->taken] += runs[b];
+            }
+        }
+        bool changed = false;
+        for (int b = 0; b < block_count; b++) {
+            const Block *block = &blocks[b];
+            long long count = (block->end == END_BRANCH && block->profiled) ? block->taken_count + block->fall_count
+                                                                            : inflow[b];
+            if (count != runs[b]) changed = true;
+            runs[b] = count;
+        }
+        if (!changed) break;
+    }
+    free(inflow);
+}
+
+/*
+ * Reorders the basic blocks of every function so the likely successor of each block
+ * falls through, from the branch outcomes of the loaded profile. Must run after
+ * order_functions and before the scheduler and the relaxation.
+ *
+ * @param stats: Receives the branches inverted, jumps inserted and removed, and the
+ *               times the profiled branches jump before and after.
+ * @return: 0 on success, 1 if the program cannot be reordered (left unchanged).
+ */
+int order_blocks(BlockLayoutStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    int n = instruction_count;
+    if (n == 0 || !label_counts) return 0;
+
+    Unit *units = malloc(n * sizeof(Unit));
+    int *unit_of = malloc(n * sizeof(int));
+    int *label_of = malloc((n + 1) * sizeof(int));
+    int *block_of = malloc(n * sizeof(int));
+    bool *starts = calloc(n + 1, sizeof(bool));
+    Block *blocks = malloc(n * sizeof(Block));
+    int *parent = malloc(n * sizeof(int));
+    if (!units || !unit_of || !label_of || !block_of || !starts || !blocks || !parent) {
+        perror("Error allocating block layout");
+        exit(1);
+    }
+    int functions;
+    int unit_count = find_units(units, unit_of, &functions, "Block layout");
+    if (unit_count < 0) {
+        free(units);
+        free(unit_of);
+        free(label_of);
+        free(block_of);
+        free(starts);
+        free(blocks);
+        free(parent);
+        return 1;
+    }
+
+    // Blocks start at labels, aligned instructions, units, and after branches and jumps
+    for (int i = 0; i <= n; i++) label_of[i] = -1;
+    for (int l = labelCount - 1; l >= 0; l--) {
+        label_of[labelTable[l].statement] = l;
+        starts[labelTable[l].statement] = true;
+    }
+    StatementInfo *infos = malloc(n * sizeof(StatementInfo));
+    if (!infos) {
+        perror("Error allocating block layout");
+        exit(1);
+    }
+    for (int i = 0; i < n; i++) {
+        describe_statement(i, &infos[i]);
+        if (statements[i].align > 1 || (i > 0 && unit_of[i] != unit_of[i - 1])) starts[i] = true;
+        if (infos[i].is_control) starts[i + 1] = true;
+    }
+    int block_count = 0;
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || starts[i]) {
+            memset(&blocks[block_count], 0, sizeof(Block));
+            blocks[block_count].first = i;
+            blocks[block_count].next = blocks[block_count].prev = -1;
+            parent[block_count] = block_count;
+            block_count++;
+        }
+        blocks[block_count - 1].last = i;
+        block_of[i] = block_count - 1;
+    }
+
+    // Successors inside the unit, from the instruction ending each block
+    for (int b = 0; b < block_count; b++) {
+        Block *block = &blocks[b];
+        StatementInfo *info = &infos[block->last];
+        unsigned int opcode = info->code & 0x7F;
+        int label = (statements[block->last].kind == KIND_BRANCH || statements[block->last].kind == KIND_JUMP)
+                        ? operand_label(block->last)
+                        : -1;
+        int target = (label >= 0) ? labelTable[label].statement : n;
+        bool inside = target < n && unit_of[target] == unit_of[block->last];
+        bool continues = b + 1 < block_count && unit_of[blocks[b + 1].first] == unit_of[block->last];
+        block->taken = inside ? block_of[target] : -1;
+        block->fall = -1;
+        if (!info->is_control || info->rd != 0) {
+            block->end = END_FALL;  // Calls return to the next block
+            block->taken = -1;
+        } else if (opcode == 0b1100011) {
+            block->end = END_BRANCH;
+        } else if (opcode == 0b1101111 && block->taken >= 0 && block->taken != b) {
+            block->end = END_JUMP;
+        } else {
+            block->end = END_NONE;
+        }
+        if ((block->end == END_FALL || block->end == END_BRANCH) && continues) block->fall = b + 1;
+    }
+    assign_branch_counts(blocks, block_of, label_of);
+    // A program running off its end keeps its last unit as it is
+    int frozen = (blocks[block_count - 1].end == END_FALL || blocks[block_count - 1].end == END_BRANCH)
+                     ? unit_count - 1
+                     : -1;
+
+    // Candidate edges, chained in two rounds: the frozen unit as it is, then every edge by weight
+    long long *runs = malloc(block_count * sizeof(long long));
+    BlockEdge *edges = malloc((3 * block_count + 1) * sizeof(BlockEdge));
+    if (!runs || !edges) {
+        perror("Error allocating block layout");
+        exit(1);
+    }
+    count_block_runs(blocks, block_count, runs);
+    for (int round = 0; round < 2; round++) {
+        int edge_count = 0;
+        for (int b = 0; b < block_count; b++) {
+            Block *block = &blocks[b];
+            if (unit_of[block->first] == frozen) {
+                if (round == 0 && b + 1 < block_count) edges[edge_count++] = (BlockEdge){ b, b + 1, 0, 0 };
+            } else if (round == 1 && block->end == END_FALL) {
+                edges[edge_count++] = (BlockEdge){ b, block->fall, runs[b], 0 };
+            } else if (round == 1 && block->end == END_BRANCH) {
+                if (block->taken_count > 0) edges[edge_count++] = (BlockEdge){ b, block->taken, block->taken_count, 1 };
+                edges[edge_count++] = (BlockEdge){ b, block->fall, block->fall_count, 1 };
+            } else if (round == 1 && block->end == END_JUMP) {
+                edges[edge_count++] = (BlockEdge){ b, block->taken, runs[b], 2 };
+            }
+        }
+        if (round == 1) qsort(edges, edge_count, sizeof(BlockEdge), compare_block_edges);
+        for (int e = 0; e < edge_count; e++) {
+            int entry = block_of[units[unit_of[blocks[edges[e].from].first]].first];
+            chain_blocks(blocks, parent, entry, edges[e].from, edges[e].to);
+        }
+    }
+
+    // Lay every unit out: the entry chain, the executed chains by decreasing count, then the others
+    Statement *moved = malloc((2 * n + 1) * sizeof(Statement));
+    int *new_index = malloc((n + 1) * sizeof(int));
+    int *order = malloc(block_count * sizeof(int));
+    long long *heat = calloc(block_count, sizeof(long long));
+    if (!moved || !new_index || !order || !heat) {
+        perror("Error allocating block layout");
+        exit(1);
+    }
+    for (int b = 0; b < block_count; b++) {
+        int root = chain_root(parent, b);
+        if (runs[b] > heat[root]) heat[root] = runs[b];
+    }
+    int position = 0, pending = 0;  // Removed instructions waiting for the next one to bind their labels
+    int *waiting = malloc((n + 1) * sizeof(int));
+    if (!waiting) {
+        perror("Error allocating block layout");
+        exit(1);
+    }
+    int carried_align = 0, carried_bound = 0;
+    int first_block = 0;
+    for (int u = 0; u < unit_count; u++) {
+        int ordered = 0;
+        int last_block = first_block;
+        while (last_block < block_count && unit_of[blocks[last_block].first] == u) last_block++;
+        order[ordered++] = first_block;  // The entry block heads its chain
+        for (int b = first_block + 1; b < last_block; b++) {
+            if (blocks[b].prev >= 0) continue;
+            int k = ordered++;
+            while (k > 1 && heat[chain_root(parent, order[k - 1])] < heat[chain_root(parent, b)]) {
+                order[k] = order[k - 1];
+                k--;
+            }
+            order[k] = b;
+        }
+
+        for (int k = 0; k < ordered; k++) {
+            for (int b = order[k]; b >= 0; b = blocks[b].next) {
+                Block *block = &blocks[b];
+                int next = (blocks[b].next >= 0) ? blocks[b].next : (k + 1 < ordered) ? order[k + 1] : -1;
+                for (int i = block->first; i <= block->last; i++) {
+                    Statement statement = statements[i];
+                    bool drop = false, jump = false;
+                    if (i == block->last && block->end == END_BRANCH && block->fall >= 0 && next != block->fall) {
+                        long long taken = block->taken_count, fall = block->fall_count;
+                        stats->taken_before += taken;
+                        if (next == block->taken &&
+                            invert_branch(&statement, labelTable[block_label(&blocks[block->fall], label_of)].label)) {
+                            stats->inverted++;
+                            stats->taken_after += fall;
+                        } else {
+                            jump = true;
+                            stats->taken_after += taken + fall;
+                        }
+                    } else if (i == block->last && block->end == END_BRANCH) {
+                        stats->taken_before += block->taken_count;
+                        stats->taken_after += block->taken_count;
+                    } else if (i == block->last && block->end == END_FALL && block->fall >= 0 && next != block->fall) {
+                        jump = true;
+                    } else if (i == block->last && block->end == END_JUMP && next == block->taken) {
+                        drop = true;
+                    }
+                    if (drop) {
+                        if (statement.align > carried_align) carried_align = statement.align;
+                        if (carried_bound == 0) carried_bound = statement.loop_bound;
+                        waiting[pending++] = i;
+                        stats->removed++;
+                        continue;
+                    }
+                    if (carried_align > statement.align) statement.align = carried_align;
+                    if (statement.loop_bound == 0) statement.loop_bound = carried_bound;
+                    carried_align = carried_bound = 0;
+                    while (pending > 0) new_index[waiting[--pending]] = position;
+                    new_index[i] = position;
+                    moved[position++] = statement;
+                    if (jump) {
+                        Statement *inserted = &moved[position++];
+                        memset(inserted, 0, sizeof(*inserted));
+                        snprintf(inserted->text, sizeof(inserted->text), "j %.*s", MAX_LINE_LENGTH / 2,
+                                 labelTable[block_label(&blocks[block->fall], label_of)].label);
+                        inserted->size = 4;
+                        inserted->kind = KIND_JUMP;
+                        inserted->form = FORM_NORMAL;
+                        inserted->target = -1;
+                        inserted->data = -1;
+                        inserted->blob = -1;
+                        inserted->line = statement.line;
+                        stats->inserted++;
+                    }
+                }
+            }
+        }
+        first_block = last_block;
+    }
+    while (pending > 0) new_index[waiting[--pending]] = position;
+    new_index[n] = position;
+
+    // Replace the instruction list and rebind the labels, the generated ones included
+    for (int l = 0; l < labelCount; l++) labelTable[l].statement = new_index[labelTable[l].statement];
+    instruction_count = 0;
+    for (int i = 0; i < position; i++) {
+        add_statement(moved[i].text, moved[i].size, moved[i].kind);
+        statements[i] = moved[i];
+    }
+
+    free(units);
+    free(unit_of);
+    free(label_of);
+    free(block_of);
+    free(starts);
+    free(blocks);
+    free(parent);
+    free(infos);
+    free(runs);
+    free(edges);
+    free(moved);
+    free(new_index);
+    free(order);
+    free(heat);
+    free(waiting);
+    return 0;
+}
@@ -0,0 +1,440 @@
+/*
+ * RISC-V Assembler Instruction Scheduler
+ *
+ * This file contains the optional list scheduler run with --schedule. It reorders
+ * the instructions of each straight-line basic block so independent work fills the
+ * cycles between a load (or any long-latency instruction) and the first use of its
+ * result, as an in-order, single-issue pipeline would otherwise stall there.
+ *
+ * A block starts at a label or an aligned instruction and ends before the next one,
+ * at a branch or jump (which stays last), or at an instruction that cannot move
+ * (auipc). Long blocks are scheduled in windows of SCHEDULE_WINDOW instructions.
+ * Within a block the dependencies are:
+ *   - read after write: the reader waits for the latency of the writer,
+ *   - write after read and write after write: the order is kept,
+ *   - memory: loads may pass loads, but no load or store passes a store and no
+ *     store passes a load (addresses are not compared).
+ *
+ * With --fusion the file also pairs instructions for macro-op fusion. The fusion
+ * table lists the pairs the target core fuses, one "first second form" per line:
+ *   - rd:   the second reads and overwrites the result of the first
+ *           (lui rd + addi rd,rd; slli rd + srli rd,rd; add rd + lw rd,0(rd)),
+ *   - rs1:  the second uses the result of the first as its base (auipc + jalr),
+ *   - pair: two loads or stores of the same size to adjacent addresses from the
+ *           same base register (lw + lw load pair).
+ * Within a basic block the second instruction of a pair is moved up next to the
+ * first when it depends on nothing in between, and the scheduler keeps pairs
+ * together. Pairs in any other register form are not fused and not counted.
+ */
+
+#include "assembler.h"
+
+#define SCHEDULE_WINDOW 128  // Largest number of instructions scheduled together
+#define FUSION_SEARCH 16     // Instructions searched for the second of a pair
+#define MAX_FUSION_PAIRS 64  // Entries of the fusion table
+
+#define FUSION_RD 0    // Second reads and overwrites the result of the first
+#define FUSION_RS1 1   // Second uses the result of the first as its base register
+#define FUSION_PAIR 2  // Adjacent accesses from the same base register
+
+int load_latency = 2;  // A load followed directly by a use stalls one cycle
+int alu_latency = 1;   // Other results are available to the next instruction
+
+// Dependency latency between the instructions of the current window, -1 where there is none
+static int dependency[SCHEDULE_WINDOW][SCHEDULE_WINDOW];
+
+// Structure holding one entry of the fusion table
+typedef struct {
+    char first[16];   // Mnemonic of the first instruction
+    char second[16];  // Mnemonic of the second instruction
+    int form;         // FUSION_RD, FUSION_RS1 or FUSION_PAIR
+} FusionPair;
+
+static FusionPair fusion_table[MAX_FUSION_PAIRS];
+static int fusion_count = 0;
+static long long *source_pairs = NULL;  // Pairs of the source, as (first line << 32 | second line)
+static int source_pair_count = 0;
+
+/*
+ * Returns the latency of the dependency of instruction b on the earlier instruction a.
+ *
+ * @return: The cycles b must issue after a, or -1 if b does not depend on a.
+ */
+static int dependency_latency(const StatementInfo *a, const StatementInfo *b) {
+    int latency = -1;
+    if (a->rd != 0 && (b->rs1 == a->rd || b->rs2 == a->rd)) {
+        latency = a->is_load ? load_latency : alu_latency;  // Read after write
+    }
+    if (b->rd != 0 && (b->rd == a->rd || b->rd == a->rs1 || b->rd == a->rs2) && latency < 1) {
+        latency = 1;  // Write after write or write after read: keep the order
+    }
+    if (((a->is_store && (b->is_load || b->is_store)) || (a->is_load && b->is_store)) && latency < 1) {
+        latency = 1;  // Memory order
+    }
+    return latency;
+}
+
+/*
+ * Reads the fusion table of the target core: one "first second form" entry per
+ * line, where form is rd, rs1 or pair; '#' starts a comment.
+ *
+ * @param file_name: The fusion table file.
+ * @return: 0 on success, 1 if the file cannot be read or has an invalid entry.
+ */
+int load_fusion_table(const char *file_name) {
+    FILE *table_file = fopen(file_name, "r");
+    if (!table_file) {
+        perror("Error opening fusion table");
+        return 1;
+    }
+    char line[MAX_LINE_LENGTH];
+    int line_number = 0;
+    fusion_count = 0;
+    while (fgets(line, sizeof(line), table_file)) {
+        line_number++;
+        removeComment(line);
+        char first[MAX_LINE_LENGTH], second[MAX_LINE_LENGTH], form[MAX_LINE_LENGTH];
+        int count = sscanf(line, "%s %s %s", first, second, form);
+        if (count <= 0) continue;
+        FusionPair *pair = &fusion_table[fusion_count];
+        pair->form = (count < 3) ? -1 : (strcmp(form, "rd") == 0) ? FUSION_RD : (strcmp(form, "rs1") == 0) ? FUSION_RS1
+                   : (strcmp(form, "pair") == 0) ? FUSION_PAIR : -1;
+        if (pair->form < 0 || strlen(first) >= sizeof(pair->first) || strlen(second) >= sizeof(pair->second) ||
+            fusion_count == MAX_FUSION_PAIRS) {
+            fprintf(stderr, "Invalid fusion table entry on line %d of %s\n", line_number, file_name);
+            fclose(table_file);
+            return 1;
+        }
+        strcpy(pair->first, first);
+        strcpy(pair->second, second);
+        fusion_count++;
+    }
+    fclose(table_file);
+    return 0;
+}
+
+// Returns the access size in bytes of a load or store, from its funct3
+static int access_size(unsigned int code) {
+    return 1 << (((code >> 12) & 0x7) & 0x3);
+}
+
+// Returns the immediate offset of a load or store
+static int access_offset(const StatementInfo *info) {
+    unsigned int code = info->code;
+    unsigned int imm = info->is_store ? (((code >> 25) << 5) | ((code >> 7) & 0x1F)) : (code >> 20);
+    return (int)(imm << 20) >> 20;
+}
+
+// Returns true if the recorded instructions a and b, in this order, fuse on the target core
+static bool fuses(int a, int b, const StatementInfo *info_a, const StatementInfo *info_b) {
+    char first[MAX_LINE_LENGTH], second[MAX_LINE_LENGTH];
+    if (sscanf(statements[a].text, "%s", first) != 1 || sscanf(statements[b].text, "%s", second) != 1) return false;
+    for (int p = 0; p < fusion_count; p++) {
+        FusionPair *pair = &fusion_table[p];
+        if (strcmp(pair->first, first) != 0 || strcmp(pair->second, second) != 0) continue;
+        switch (pair->form) {
+        case FUSION_RD:
+            if (info_a->rd != 0 && info_b->rs1 == info_a->rd && info_b->rd == info_a->rd) return true;
+            break;
+        case FUSION_RS1:
+            if (info_a->rd != 0 && info_b->rs1 == info_a->rd) return true;
+            break;
+        case FUSION_PAIR:
+            // Same base, the next address, and the first load does not overwrite the base
+            if (info_a->is_load == info_b->is_load && info_a->is_store == info_b->is_store &&
+                info_a->rs1 == info_b->rs1 && (info_a->code & 0x7000) == (info_b->code & 0x7000) &&
+                access_offset(info_b) == access_offset(info_a) + access_size(info_a->code) &&
+                !(info_a->is_load && (info_a->rd == info_a->rs1 || info_a->rd == info_b->rd))) {
+                return true;
+            }
+            break;
+        }
+    }
+    return false;
+}
+
+// Fills starts (blocks begin at labels and aligned instructions) and the descriptions
+static void describe_program(bool *starts, StatementInfo *infos) {
+    for (int i = 0; i < labelCount; i++) {
+        starts[labelTable[i].statement] = true;
+    }
+    for (int i = 0; i < instruction_count; i++) {
+        describe_statement(i, &infos[i]);
+        if (statements[i].align > 1) starts[i] = true;
+    }
+}
+
+// Orders pair keys for fusion_report
+static int compare_keys(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Collects the adjacent fused pairs of the program as (first line << 32 | second line), sorted
+static int collect_pairs(long long **keys) {
+    bool *starts = calloc(instruction_count + 1, sizeof(bool));
+    StatementInfo *infos = malloc((instruction_count + 1) * sizeof(StatementInfo));
+    *keys = malloc((instruction_count + 1) * sizeof(long long));
+    if (!starts || !infos || !*keys) {
+        perror("Error allocating scheduler");
+        exit(1);
+    }
+    describe_program(starts, infos);
+    int count = 0;
+    for (int i = 0; i + 1 < instruction_count; i++) {
+        if (!starts[i + 1] && fuses(i, i + 1, &infos[i], &infos[i + 1])) {
+            (*keys)[count++] = ((long long)statements[i].line << 32) | (unsigned int)statements[i + 1].line;
+            i++;  // An instruction fuses with one neighbour at most
+        }
+    }
+    qsort(*keys, count, sizeof(long long), compare_keys);
+    free(starts);
+    free(infos);
+    return count;
+}
+
+// Records the fused pairs of the source, for fusion_report
+void fusion_snapshot(void) {
+    free(source_pairs);
+    source_pair_count = collect_pairs(&source_pairs);
+}
+
+/*
+ * Moves the second instruction of every fusible pair up next to the first, within
+ * its basic block and when it depends on nothing in between. Must run before
+ * schedule_program, which keeps the pairs together.
+ *
+ * @return: The number of instructions moved.
+ */
+int fuse_program(void) {
+    bool *starts = calloc(instruction_count + 1, sizeof(bool));
+    StatementInfo *infos = malloc((instruction_count + 1) * sizeof(StatementInfo));
+    if (!starts || !infos) {
+        perror("Error allocating scheduler");
+        exit(1);
+    }
+    describe_program(starts, infos);
+    int moved = 0;
+    for (int i = 0; i + 1 < instruction_count; i++) {
+        if (infos[i].is_control || starts[i + 1]) continue;
+        if (fuses(i, i + 1, &infos[i], &infos[i + 1])) {
+            i++;  // Already a pair
+            continue;
+        }
+        for (int j = i + 2; j < instruction_count && j <= i + FUSION_SEARCH && !starts[j]; j++) {
+            if (infos[j - 1].is_control) break;
+            if (infos[j].is_control || infos[j].is_pinned || !fuses(i, j, &infos[i], &infos[j])) continue;
+            // The second may not depend on the instructions it passes, nor break their pair
+            bool independent = !fuses(j - 1, j, &infos[j - 1], &infos[j]) &&
+                               !(j + 1 < instruction_count && !starts[j + 1] && fuses(j, j + 1, &infos[j], &infos[j + 1]));
+            for (int k = i + 1; k < j && independent; k++) {
+                if (dependency_latency(&infos[k], &infos[j]) >= 0) independent = false;
+            }
+            if (!independent) continue;
+            Statement second = statements[j];
+            StatementInfo second_info = infos[j];
+            memmove(&statements[i + 2], &statements[i + 1], (j - i - 1) * sizeof(Statement));
+            memmove(&infos[i + 2], &infos[i + 1], (j - i - 1) * sizeof(StatementInfo));
+            statements[i + 1] = second;
+            infos[i + 1] = second_info;
+            moved++;
+            i++;
+            break;
+        }
+    }
+    free(starts);
+    free(infos);
+    return moved;
+}
+
+/*
+ * Compares the fused pairs of the program with the ones recorded by fusion_snapshot.
+ *
+ * @param created: Receives the number of pairs that were not adjacent in the source.
+ * @param broken: Receives the number of source pairs that are no longer adjacent.
+ * @return: The number of fused pairs in the program.
+ */
+int fusion_report(int *created, int *broken) {
+    long long *pairs;
+    int count = collect_pairs(&pairs);
+    int common = 0;
+    for (int a = 0, b = 0; a < count && b < source_pair_count;) {
+        if (pairs[a] == source_pairs[b]) {
+            common++;
+            a++;
+            b++;
+        } else if (pairs[a] < source_pairs[b]) {
+            a++;
+        } else {
+            b++;
+        }
+    }
+    *created = count - common;
+    *broken = source_pair_count - common;
+    free(pairs);
+    return count;
+}
+
+// Counts the stall cycles of the window's instructions issued in the given order
+static int count_stalls(int count, const int *order) {
+    int issue[SCHEDULE_WINDOW];
+    int time = -1, stalls = 0;
+    for (int k = 0; k < count; k++) {
+        int node = order[k];
+        int earliest = time + 1;
+        for (int j = 0; j < k; j++) {
+            int previous = order[j];
+            if (previous < node && dependency[previous][node] > 0 && issue[previous] + dependency[previous][node] > earliest) {
+                earliest = issue[previous] + dependency[previous][node];
+            }
+        }
+        stalls += earliest - (time + 1);
+        issue[node] = earliest;
+        time = earliest;
+    }
+    return stalls;
+}
+
+/*
+ * Schedules one window: statements start .. start+count-1, the last of which is a
+ * branch or jump that has to stay last when 'terminated' is set.
+ *
+ * @return: true if the window was reordered.
+ */
+static bool schedule_window(int start, int count, bool terminated, const StatementInfo *infos,
+                            int *stalls_before, int *stalls_after) {
+    int order[SCHEDULE_WINDOW], height[SCHEDULE_WINDOW], predecessors[SCHEDULE_WINDOW];
+    int ready_at[SCHEDULE_WINDOW], issue[SCHEDULE_WINDOW];
+    bool scheduled[SCHEDULE_WINDOW] = { false };
+
+    for (int b = 0; b < count; b++) {
+        predecessors[b] = 0;
+        ready_at[b] = 0;
+        for (int a = 0; a < b; a++) {
+            dependency[a][b] = dependency_latency(&infos[start + a], &infos[start + b]);
+            if (dependency[a][b] >= 0) predecessors[b]++;
+        }
+    }
+    // Priority: the longest latency path from the instruction to the end of the window
+    for (int a = count - 1; a >= 0; a--) {
+        height[a] = 0;
+        for (int b = a + 1; b < count; b++) {
+            if (dependency[a][b] >= 0 && dependency[a][b] + height[b] > height[a]) height[a] = dependency[a][b] + height[b];
+        }
+    }
+
+    // A fused pair issues together: the first also waits for the predecessors of the second
+    int movable = terminated ? count - 1 : count;
+    int glued[SCHEDULE_WINDOW], glued_to[SCHEDULE_WINDOW];  // Second of the pair of each first, and back
+    for (int a = 0; a < count; a++) glued[a] = glued_to[a] = -1;
+    for (int a = 0; a + 1 < movable && fusion_count > 0; a++) {
+        if (fuses(start + a, start + a + 1, &infos[start + a], &infos[start + a + 1])) {
+            glued[a] = a + 1;
+            glued_to[a + 1] = a;
+            predecessors[a] += predecessors[a + 1] - (dependency[a][a + 1] >= 0 ? 1 : 0);
+            a++;
+        }
+    }
+
+    // Cycle by cycle, issue the ready instruction that stalls least, then the most critical one
+    int time = -1;
+    for (int k = 0; k < movable; k++) {
+        int best = -1, best_time = 0;
+        bool follows = (k > 0 && glued[order[k - 1]] >= 0);
+        if (follows) {
+            best = glued[order[k - 1]];  // The second of a pair follows the first
+            best_time = (ready_at[best] > time + 1) ? ready_at[best] : time + 1;
+        }
+        for (int a = 0; a < movable && !follows; a++) {
+            if (scheduled[a] || predecessors[a] > 0 || glued_to[a] >= 0) continue;
+            int start_time = (ready_at[a] > time + 1) ? ready_at[a] : time + 1;
+            if (best < 0 || start_time < best_time || (start_time == best_time && height[a] > height[best])) {
+                best = a;
+                best_time = start_time;
+            }
+        }
+        order[k] = best;
+        scheduled[best] = true;
+        issue[best] = best_time;
+        time = best_time;
+        for (int b = best + 1; b < count; b++) {
+            if (dependency[best][b] < 0) continue;
+            predecessors[b]--;
+            if (glued_to[b] >= 0 && glued_to[b] != best) predecessors[glued_to[b]]--;
+            if (issue[best] + dependency[best][b] > ready_at[b]) ready_at[b] = issue[best] + dependency[best][b];
+        }
+    }
+    if (terminated) order[count - 1] = count - 1;
+
+    int original[SCHEDULE_WINDOW];
+    for (int k = 0; k < count; k++) original[k] = k;
+    int before = count_stalls(count, original);
+    int after = count_stalls(count, order);
+    *stalls_before += before;
+    if (after >= before) {
+        *stalls_after += before;  // No gain: keep the source order
+        return false;
+    }
+    *stalls_after += after;
+
+    // Rewrite the window in the new order; the alignment stays with the first position
+    Statement window[SCHEDULE_WINDOW];
+    int align = statements[start].align;
+    for (int k = 0; k < count; k++) window[k] = statements[start + order[k]];
+    for (int k = 0; k < count; k++) {
+        statements[start + k] = window[k];
+        statements[start + k].align = (k == 0) ? align : 0;
+    }
+    return true;
+}
+
+/*
+ * Schedules every basic block of the program under the latency model set by
+ * load_latency and alu_latency. Must run before relax_program, while the
+ * instructions are not yet bound to their final forms.
+ *
+ * @param stalls_before: Receives the stall cycles of the source order (summed over all blocks).
+ * @param stalls_after: Receives the stall cycles after scheduling.
+ * @return: The number of windows that were reordered.
+ */
+int schedule_program(int *stalls_before, int *stalls_after) {
+    bool *starts = calloc(instruction_count + 1, sizeof(bool));
+    StatementInfo *infos = malloc((instruction_count + 1) * sizeof(StatementInfo));
+    if (!starts || !infos) {
+        perror("Error allocating scheduler");
+        exit(1);
+    }
+    // Labels and aligned instructions start a block, as something may jump there
+    for (int i = 0; i < labelCount; i++) {
+        starts[labelTable[i].statement] = true;
+    }
+    for (int i = 0; i < instruction_count; i++) {
+        describe_statement(i, &infos[i]);
+        if (statements[i].align > 1) starts[i] = true;
+    }
+
+    int reordered = 0;
+    *stalls_before = 0;
+    *stalls_after = 0;
+    int i = 0;
+    while (i < instruction_count) {
+        if (infos[i].is_control || infos[i].is_pinned) {
+            i++;
+            continue;
+        }
+        // Collect the movable instructions, plus the branch or jump that ends the block
+        int end = i + 1;
+        while (end < instruction_count && end - i < SCHEDULE_WINDOW - 1 && !starts[end] && !infos[end].is_control &&
+               !infos[end].is_pinned) {
+            end++;
+        }
+        bool terminated = (end < instruction_count && !starts[end] && infos[end].is_control);
+        if (terminated) end++;
+        if (schedule_window(i, end - i, terminated, infos, stalls_before, stalls_after)) reordered++;
+        i = end;
+    }
+
+    free(starts);
+    free(infos);
+    return reordered;
+}
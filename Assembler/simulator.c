@@ -0,0 +1,614 @@
+/*
+ * RISC-V Simulator Implementation
+ *
+ * This file contains the execution core of the RISC-V simulator. It implements a
+ * sparse, page-allocated memory, the loader for the assembler's output files and an
+ * RV32IC interpreter covering every instruction the assembler can emit. Compressed
+ * instructions are expanded to their 32-bit equivalents before execution. Each call to
+ * step() retires one instruction and reports it to the caller, which forwards it to
+ * the analysis modes.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // Needed for shm_open and mmap with -std=c99
+
+#include "simulator.h"
+#include "image_shm.h"
+#include <fcntl.h>     // O_RDONLY for shm_open
+#include <sys/mman.h>  // shm_open and mmap
+#include <sys/stat.h>  // fstat
+#include <unistd.h>    // close
+
+Cpu cpu;                    // State of the simulated hart
+unsigned int program_size;  // Size in bytes of the loaded program image
+Symbol *symbols = NULL;     // Symbol table sorted by address
+int symbol_count = 0;       // Number of entries in the symbol table
+
+// Sparse memory: one pointer per 4 KiB page, pages are allocated when first touched
+static unsigned char *page_table[PAGE_COUNT];
+
+// One-entry page cache used by the fast path of memory_load and memory_store
+static unsigned int cached_page_number = 0xFFFFFFFF;
+static unsigned char *cached_page = NULL;
+
+// Memory-mapped devices, only consulted on the slow path of the memory model
+static Device devices[MAX_DEVICES];
+static int device_count = 0;
+
+/*
+ * Adds a memory-mapped device. Accesses inside [base, base + size) are sent to
+ * its handlers instead of RAM. Pages overlapping a device never enter the page
+ * cache, so every device access takes the slow path while RAM stays on the fast one.
+ *
+ * @param device: The device region and its load/store handlers.
+ */
+void register_device(const Device *device) {
+    if (device_count == MAX_DEVICES) {
+        fprintf(stderr, "Too many memory-mapped devices\n");
+        exit(1);
+    }
+    devices[device_count++] = *device;
+    cached_page_number = 0xFFFFFFFF;  // The cached page may overlap the new device
+}
+
+// Returns the device containing an address, or NULL for RAM
+static const Device *find_device(unsigned int address) {
+    for (int i = 0; i < device_count; i++) {
+        if (address - devices[i].base < devices[i].size) return &devices[i];
+    }
+    return NULL;
+}
+
+// Returns true if any device overlaps the given page
+static bool page_has_device(unsigned int page_number) {
+    unsigned int page_start = page_number << PAGE_SHIFT;
+    for (int i = 0; i < device_count; i++) {
+        if (devices[i].base - page_start < PAGE_SIZE || page_start - devices[i].base < devices[i].size) return true;
+    }
+    return false;
+}
+
+/*
+ * Returns the page holding the given address, allocating a zero-filled page on
+ * first use. This is the slow path of the memory model.
+ *
+ * @param address: Any address inside the page.
+ * @return: Pointer to the first byte of the page.
+ */
+static unsigned char *memory_page(unsigned int address) {
+    unsigned int page_number = address >> PAGE_SHIFT;
+    if (page_table[page_number] == NULL) {
+        page_table[page_number] = calloc(1, PAGE_SIZE);
+        if (page_table[page_number] == NULL) {
+            perror("Error allocating simulator memory");
+            exit(1);
+        }
+    }
+    if (!page_has_device(page_number)) {
+        cached_page_number = page_number;
+        cached_page = page_table[page_number];
+    }
+    return page_table[page_number];
+}
+
+/*
+ * Reads a little-endian value of 1, 2 or 4 bytes from memory.
+ *
+ * @param address: The byte address to read from.
+ * @param size: The number of bytes to read.
+ * @return: The value read, zero-extended to 32 bits.
+ */
+unsigned int memory_load(unsigned int address, unsigned int size) {
+    unsigned int offset = address & (PAGE_SIZE - 1);
+    unsigned int value = 0;
+
+    // Fast path: the access lies entirely inside the most recently used page
+    if ((address >> PAGE_SHIFT) == cached_page_number && offset + size <= PAGE_SIZE) {
+        for (unsigned int i = 0; i < size; i++) {
+            value |= (unsigned int)cached_page[offset + i] << (8 * i);
+        }
+        return value;
+    }
+
+    // Slow path: a device register, or a page lookup (the access may also straddle two pages)
+    const Device *device = find_device(address);
+    if (device) {
+        return device->load(address - device->base, size);
+    }
+    for (unsigned int i = 0; i < size; i++) {
+        unsigned char *page = memory_page(address + i);
+        value |= (unsigned int)page[(address + i) & (PAGE_SIZE - 1)] << (8 * i);
+    }
+    return value;
+}
+
+/*
+ * Writes a little-endian value of 1, 2 or 4 bytes to memory.
+ *
+ * @param address: The byte address to write to.
+ * @param size: The number of bytes to write.
+ * @param value: The value to store (only the low size bytes are used).
+ */
+void memory_store(unsigned int address, unsigned int size, unsigned int value) {
+    unsigned int offset = address & (PAGE_SIZE - 1);
+
+    // Fast path: the access lies entirely inside the most recently used page
+    if ((address >> PAGE_SHIFT) == cached_page_number && offset + size <= PAGE_SIZE) {
+        for (unsigned int i = 0; i < size; i++) {
+            cached_page[offset + i] = (value >> (8 * i)) & 0xFF;
+        }
+        return;
+    }
+
+    // Slow path: a device register, or a page lookup (the access may also straddle two pages)
+    const Device *device = find_device(address);
+    if (device) {
+        device->store(address - device->base, size, value);
+        return;
+    }
+    for (unsigned int i = 0; i < size; i++) {
+        unsigned char *page = memory_page(address + i);
+        page[(address + i) & (PAGE_SIZE - 1)] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+// Appends one symbol to the symbol table
+static void add_symbol(const char *name, unsigned int address) {
+    static int capacity = 0;
+    if (symbol_count == capacity) {
+        capacity = capacity ? 2 * capacity : 64;
+        symbols = realloc(symbols, capacity * sizeof(Symbol));
+        if (!symbols) {
+            perror("Error allocating symbol table");
+            exit(1);
+        }
+    }
+    snprintf(symbols[symbol_count].name, MAX_SYMBOL_LENGTH, "%s", name);
+    symbols[symbol_count].address = address;
+    symbol_count++;
+}
+
+// Orders symbols by address so regions can be found with a binary search
+static int compare_symbols(const void *left, const void *right) {
+    const Symbol *a = left, *b = right;
+    return (a->address > b->address) - (a->address < b->address);
+}
+
+/*
+ * Loads a program from the shared-memory segment written by the assembler with
+ * the -s flag (layout in image_shm.h). The segment is mapped read-only, the
+ * machine code is copied into simulated memory and the symbol table is loaded too.
+ *
+ * @param name: The shared-memory object name (e.g. "/rvimage").
+ * @return: 0 on success, 1 if the segment is missing or invalid.
+ */
+static int load_program_shm(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        perror("Error opening shared memory");
+        return 1;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(ImageHeader)) {
+        fprintf(stderr, "Shared memory %s is too small for an image header\n", name);
+        close(fd);
+        return 1;
+    }
+    size_t size = status.st_size;
+    const unsigned char *segment = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        perror("Error mapping shared memory");
+        return 1;
+    }
+
+    const ImageHeader *header = (const ImageHeader *)segment;
+    if (header->magic != IMAGE_MAGIC || header->version != IMAGE_VERSION || header->total_size > size ||
+        (uint64_t)header->image_offset + header->image_size > size ||
+        (uint64_t)header->symbol_offset + (uint64_t)header->symbol_count * sizeof(ImageSymbol) > size ||
+        (uint64_t)header->string_offset + header->string_size > size) {
+        fprintf(stderr, "Shared memory %s does not hold a valid image\n", name);
+        munmap((void *)segment, size);
+        return 1;
+    }
+
+    const unsigned char *image = segment + header->image_offset;
+    for (uint32_t i = 0; i < header->image_size; i++) {
+        memory_store(header->load_address + i, 1, image[i]);
+    }
+    program_size = header->load_address + header->image_size;
+
+    const ImageSymbol *symbol_table = (const ImageSymbol *)(segment + header->symbol_offset);
+    const char *strings = (const char *)(segment + header->string_offset);
+    for (uint32_t i = 0; i < header->symbol_count; i++) {
+        if (symbol_table[i].name_offset >= header->string_size) continue;
+        add_symbol(strings + symbol_table[i].name_offset, symbol_table[i].address);
+    }
+    qsort(symbols, symbol_count, sizeof(Symbol), compare_symbols);
+
+    munmap((void *)segment, size);
+    return 0;
+}
+
+/*
+ * Loads a program produced by the assembler. Each line holds one instruction
+ * either as "0x" followed by hexadecimal digits (-h output) or as a string of
+ * '0' and '1' characters (-b output). Instructions are placed from address 0.
+ * A name of the form "shm:/name" loads the shared-memory image written with -s.
+ *
+ * @param file_name: The machine code file to load.
+ * @return: 0 on success, 1 if the file cannot be read or contains an invalid line.
+ */
+int load_program(const char *file_name) {
+    if (strncmp(file_name, "shm:", 4) == 0) {
+        return load_program_shm(file_name + 4);
+    }
+
+    FILE *input_file = fopen(file_name, "r");
+    if (!input_file) {
+        perror("Error opening program file");
+        return 1;
+    }
+
+    char line[128];
+    int line_number = 0;
+    program_size = 0;
+    while (fgets(line, sizeof(line), input_file)) {
+        line_number++;
+        char *text = line;
+        while (isspace((unsigned char)*text)) text++;
+        if (*text == '\0') continue;  // Skip blank lines
+
+        // A line holds a 32-bit instruction, or a 16-bit one (4 hex digits or 16 bits) when compressed
+        char *end;
+        unsigned int word, size;
+        if (strncmp(text, "0x", 2) == 0 || strncmp(text, "0X", 2) == 0) {
+            word = strtoul(text, &end, 16);
+            size = (end - text - 2 <= 4) ? 2 : 4;
+        } else {
+            word = strtoul(text, &end, 2);
+            size = (end - text <= 16) ? 2 : 4;
+        }
+        if (end == text || (*end != '\0' && !isspace((unsigned char)*end))) {
+            fprintf(stderr, "Invalid machine code at %s:%d\n", file_name, line_number);
+            fclose(input_file);
+            return 1;
+        }
+        memory_store(program_size, size, word);
+        program_size += size;
+    }
+    fclose(input_file);
+    return 0;
+}
+
+/*
+ * Loads the symbol map written by the assembler (-m option). Each line holds a
+ * byte address followed by a label name. The region of a label extends up to the
+ * next label.
+ *
+ * @param file_name: The symbol map file to load.
+ * @return: 0 on success, 1 if the file cannot be read or contains an invalid line.
+ */
+int load_symbols(const char *file_name) {
+    FILE *map_file = fopen(file_name, "r");
+    if (!map_file) {
+        perror("Error opening symbol map");
+        return 1;
+    }
+
+    char line[MAX_SYMBOL_LENGTH + 32];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), map_file)) {
+        line_number++;
+        char name[MAX_SYMBOL_LENGTH];
+        unsigned int address;
+        if (sscanf(line, "%x %255s", &address, name) != 2) {
+            if (strspn(line, " \t\r\n") == strlen(line)) continue;  // Skip blank lines
+            fprintf(stderr, "Invalid symbol at %s:%d\n", file_name, line_number);
+            fclose(map_file);
+            return 1;
+        }
+        add_symbol(name, address);
+    }
+    fclose(map_file);
+    qsort(symbols, symbol_count, sizeof(Symbol), compare_symbols);
+    return 0;
+}
+
+/*
+ * Finds the label region containing an address: the last symbol whose address is
+ * less than or equal to it.
+ *
+ * @param address: The byte address to look up.
+ * @return: The index of the symbol in the table, or -1 if the address precedes all labels.
+ */
+int find_symbol(unsigned int address) {
+    int low = 0, high = symbol_count - 1, found = -1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        if (symbols[middle].address <= address) {
+            found = middle;
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return found;
+}
+
+/*
+ * Formats an address as "label+offset" if it falls in a label region, otherwise as hex.
+ *
+ * @param address: The byte address to format.
+ * @return: A static buffer that is overwritten by the next call.
+ */
+const char *format_address(unsigned int address) {
+    static char buffer[MAX_SYMBOL_LENGTH + 16];
+    int index = find_symbol(address);
+    if (index < 0) {
+        snprintf(buffer, sizeof(buffer), "0x%08X", address);
+    } else if (symbols[index].address == address) {
+        snprintf(buffer, sizeof(buffer), "%s", symbols[index].name);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%s+%u", symbols[index].name, address - symbols[index].address);
+    }
+    return buffer;
+}
+
+/*
+ * Resets the hart to its initial state: all registers cleared, the stack pointer
+ * set to STACK_TOP and the program counter at address 0.
+ */
+void reset_cpu(void) {
+    memset(&cpu, 0, sizeof(cpu));
+    cpu.regs[2] = STACK_TOP;
+}
+
+// Sign-extends the low 'bits' bits of value to 32 bits
+static int sign_extend(unsigned int value, int bits) {
+    unsigned int mask = 1u << (bits - 1);
+    value &= (1u << bits) - 1;
+    return (int)((value ^ mask) - mask);
+}
+
+// Builders of the 32-bit instruction formats used by the RV32C expansion
+static unsigned int encode_r(unsigned int opcode, unsigned int funct3, unsigned int funct7, unsigned int rd,
+                             unsigned int rs1, unsigned int rs2) {
+    return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static unsigned int encode_i(unsigned int opcode, unsigned int funct3, unsigned int rd, unsigned int rs1, int imm) {
+    return (((unsigned int)imm & 0xFFF) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static unsigned int encode_s(unsigned int funct3, unsigned int rs1, unsigned int rs2, int imm) {
+    return ((((unsigned int)imm >> 5) & 0x7F) << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) |
+           (((unsigned int)imm & 0x1F) << 7) | 0b0100011;
+}
+
+static unsigned int encode_b(unsigned int funct3, unsigned int rs1, int imm) {
+    unsigned int u = (unsigned int)imm;
+    return (((u >> 12) & 0x1) << 31) | (((u >> 5) & 0x3F) << 25) | (rs1 << 15) | (funct3 << 12) |
+           (((u >> 1) & 0xF) << 8) | (((u >> 11) & 0x1) << 7) | 0b1100011;
+}
+
+static unsigned int encode_j(unsigned int rd, int imm) {
+    unsigned int u = (unsigned int)imm;
+    return (((u >> 20) & 0x1) << 31) | (((u >> 1) & 0x3FF) << 21) | (((u >> 11) & 0x1) << 20) |
+           (((u >> 12) & 0xFF) << 12) | (rd << 7) | 0b1101111;
+}
+
+/*
+ * Expands a 16-bit RV32C instruction into the 32-bit instruction it stands for.
+ *
+ * @param c: The 16-bit instruction parcel (low two bits not 0b11).
+ * @return: The equivalent 32-bit instruction, or 0 if the parcel is illegal or unsupported.
+ */
+static unsigned int expand_compressed(unsigned int c) {
+    unsigned int funct3 = (c >> 13) & 0x7;
+    unsigned int rd = (c >> 7) & 0x1F;       // Full register fields (CR/CI formats)
+    unsigned int rs2 = (c >> 2) & 0x1F;
+    unsigned int rd_c = 8 + ((c >> 2) & 0x7);   // Compressed register fields (CIW/CL/CS/CA/CB formats)
+    unsigned int rs1_c = 8 + ((c >> 7) & 0x7);
+    int ci_imm = sign_extend((((c >> 12) & 0x1) << 5) | ((c >> 2) & 0x1F), 6);
+    int offset;
+
+    switch (((c & 0x3) << 3) | funct3) {
+    case 0b00000: {  // c.addi4spn
+        unsigned int imm = (((c >> 11) & 0x3) << 4) | (((c >> 7) & 0xF) << 6) | (((c >> 6) & 0x1) << 2) |
+                           (((c >> 5) & 0x1) << 3);
+        return imm ? encode_i(0b0010011, 0b000, rd_c, 2, imm) : 0;
+    }
+    case 0b00010:    // c.lw
+    case 0b00110: {  // c.sw
+        unsigned int imm = (((c >> 10) & 0x7) << 3) | (((c >> 6) & 0x1) << 2) | (((c >> 5) & 0x1) << 6);
+        return (funct3 == 0b010) ? encode_i(0b0000011, 0b010, rd_c, rs1_c, imm) : encode_s(0b010, rs1_c, rd_c, imm);
+    }
+    case 0b01000:  // c.addi / c.nop
+        return encode_i(0b0010011, 0b000, rd, rd, ci_imm);
+    case 0b01001:  // c.jal
+    case 0b01101:  // c.j
+        offset = sign_extend((((c >> 12) & 0x1) << 11) | (((c >> 11) & 0x1) << 4) | (((c >> 9) & 0x3) << 8) |
+                             (((c >> 8) & 0x1) << 10) | (((c >> 7) & 0x1) << 6) | (((c >> 6) & 0x1) << 7) |
+                             (((c >> 3) & 0x7) << 1) | (((c >> 2) & 0x1) << 5), 12);
+        return encode_j((funct3 == 0b001) ? 1 : 0, offset);
+    case 0b01010:  // c.li
+        return encode_i(0b0010011, 0b000, rd, 0, ci_imm);
+    case 0b01011:
+        if (rd == 2) {  // c.addi16sp
+            int imm = sign_extend((((c >> 12) & 0x1) << 9) | (((c >> 6) & 0x1) << 4) | (((c >> 5) & 0x1) << 6) |
+                                  (((c >> 3) & 0x3) << 7) | (((c >> 2) & 0x1) << 5), 10);
+            return imm ? encode_i(0b0010011, 0b000, 2, 2, imm) : 0;
+        }
+        return ci_imm ? (((unsigned int)ci_imm << 12) | (rd << 7) | 0b0110111) : 0;  // c.lui
+    case 0b01100:
+        switch ((c >> 10) & 0x3) {
+        case 0b00: return (c & 0x1000) ? 0 : encode_r(0b0010011, 0b101, 0b0000000, rs1_c, rs1_c, rs2);  // c.srli
+        case 0b01: return (c & 0x1000) ? 0 : encode_r(0b0010011, 0b101, 0b0100000, rs1_c, rs1_c, rs2);  // c.srai
+        case 0b10: return encode_i(0b0010011, 0b111, rs1_c, rs1_c, ci_imm);                             // c.andi
+        default: {
+            // c.sub / c.xor / c.or / c.and
+            static const unsigned int funct3s[4] = { 0b000, 0b100, 0b110, 0b111 };
+            unsigned int operation = (c >> 5) & 0x3;
+            if (c & 0x1000) return 0;
+            return encode_r(0b0110011, funct3s[operation], operation ? 0 : 0b0100000, rs1_c, rs1_c, rd_c);
+        }
+        }
+    case 0b01110:  // c.beqz
+    case 0b01111:  // c.bnez
+        offset = sign_extend((((c >> 12) & 0x1) << 8) | (((c >> 10) & 0x3) << 3) | (((c >> 5) & 0x3) << 6) |
+                             (((c >> 3) & 0x3) << 1) | (((c >> 2) & 0x1) << 5), 9);
+        return encode_b((funct3 == 0b110) ? 0b000 : 0b001, rs1_c, offset);
+    case 0b10000:  // c.slli
+        return (c & 0x1000) ? 0 : encode_r(0b0010011, 0b001, 0, rd, rd, rs2);
+    case 0b10010: {  // c.lwsp
+        unsigned int imm = (((c >> 12) & 0x1) << 5) | (((c >> 4) & 0x7) << 2) | (((c >> 2) & 0x3) << 6);
+        return rd ? encode_i(0b0000011, 0b010, rd, 2, imm) : 0;
+    }
+    case 0b10100:
+        if (!(c & 0x1000)) {
+            if (rs2 == 0) return rd ? encode_i(0b1100111, 0b000, 0, rd, 0) : 0;  // c.jr
+            return encode_r(0b0110011, 0b000, 0, rd, 0, rs2);                   // c.mv
+        }
+        if (rs2 == 0) return rd ? encode_i(0b1100111, 0b000, 1, rd, 0) : 0;     // c.jalr (c.ebreak unsupported)
+        return encode_r(0b0110011, 0b000, 0, rd, rd, rs2);                      // c.add
+    case 0b10110: {  // c.swsp
+        unsigned int imm = (((c >> 9) & 0xF) << 2) | (((c >> 7) & 0x3) << 6);
+        return encode_s(0b010, 2, rs2, imm);
+    }
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Executes the instruction at cpu.pc and advances the hart.
+ *
+ * @param retired: Filled with the description of the executed instruction.
+ * @return: true if the instruction was executed, false if it is illegal.
+ */
+bool step(Retired *retired) {
+    unsigned int pc = cpu.pc;
+    unsigned int parcel = memory_load(pc, 2);
+    unsigned int length = 4;  // Instruction length in bytes
+    unsigned int instruction;
+    if ((parcel & 0x3) != 0x3) {
+        // Compressed instruction: execute its 32-bit equivalent
+        instruction = expand_compressed(parcel);
+        length = 2;
+        if (instruction == 0) return false;
+    } else {
+        instruction = memory_load(pc, 4);
+    }
+    unsigned int opcode = instruction & 0x7F;
+    unsigned int rd = (instruction >> 7) & 0x1F;
+    unsigned int funct3 = (instruction >> 12) & 0x7;
+    unsigned int rs1 = (instruction >> 15) & 0x1F;
+    unsigned int rs2 = (instruction >> 20) & 0x1F;
+    unsigned int funct7 = instruction >> 25;
+    unsigned int a = cpu.regs[rs1];
+    unsigned int b = cpu.regs[rs2];
+    unsigned int next_pc = pc + length;
+    unsigned int result = 0;
+    bool writes_rd = true;
+    int imm;
+
+    memset(retired, 0, sizeof(*retired));
+    retired->pc = pc;
+    retired->instruction = (length == 2) ? parcel : instruction;
+    retired->decoded = instruction;
+
+    switch (opcode) {
+    case 0b0110011:  // R-type
+        switch (funct3) {
+        case 0b000: result = (funct7 == 0b0100000) ? a - b : a + b; break;
+        case 0b001: result = a << (b & 0x1F); break;
+        case 0b010: result = ((int)a < (int)b); break;
+        case 0b011: result = (a < b); break;
+        case 0b100: result = a ^ b; break;
+        case 0b101: result = (funct7 == 0b0100000) ? (unsigned int)((int)a >> (b & 0x1F)) : a >> (b & 0x1F); break;
+        case 0b110: result = a | b; break;
+        case 0b111: result = a & b; break;
+        }
+        break;
+    case 0b0010011:  // I-type arithmetic
+        imm = sign_extend(instruction >> 20, 12);
+        switch (funct3) {
+        case 0b000: result = a + imm; break;
+        case 0b001: result = a << (imm & 0x1F); break;
+        case 0b010: result = ((int)a < imm); break;
+        case 0b011: result = (a < (unsigned int)imm); break;
+        case 0b100: result = a ^ imm; break;
+        case 0b101: result = (funct7 == 0b0100000) ? (unsigned int)((int)a >> (imm & 0x1F)) : a >> (imm & 0x1F); break;
+        case 0b110: result = a | imm; break;
+        case 0b111: result = a & imm; break;
+        }
+        break;
+    case 0b0000011:  // Loads
+        imm = sign_extend(instruction >> 20, 12);
+        retired->is_load = true;
+        retired->mem_address = a + imm;
+        switch (funct3) {
+        case 0b000: retired->mem_size = 1; result = sign_extend(memory_load(a + imm, 1), 8); break;
+        case 0b001: retired->mem_size = 2; result = sign_extend(memory_load(a + imm, 2), 16); break;
+        case 0b010: retired->mem_size = 4; result = memory_load(a + imm, 4); break;
+        case 0b100: retired->mem_size = 1; result = memory_load(a + imm, 1); break;
+        case 0b101: retired->mem_size = 2; result = memory_load(a + imm, 2); break;
+        default: return false;
+        }
+        break;
+    case 0b0100011:  // Stores
+        imm = sign_extend(((instruction >> 25) << 5) | rd, 12);
+        writes_rd = false;
+        if (funct3 > 0b010) return false;
+        retired->is_store = true;
+        retired->mem_address = a + imm;
+        retired->mem_size = 1u << funct3;
+        memory_store(a + imm, retired->mem_size, b);
+        break;
+    case 0b1100011:  // Branches
+        imm = sign_extend(((instruction >> 31) << 12) | (((instruction >> 7) & 0x1) << 11) |
+                          (((instruction >> 25) & 0x3F) << 5) | (((instruction >> 8) & 0xF) << 1), 13);
+        writes_rd = false;
+        bool taken;
+        switch (funct3) {
+        case 0b000: taken = (a == b); break;
+        case 0b001: taken = (a != b); break;
+        case 0b100: taken = ((int)a < (int)b); break;
+        case 0b101: taken = ((int)a >= (int)b); break;
+        case 0b110: taken = (a < b); break;
+        case 0b111: taken = (a >= b); break;
+        default: return false;
+        }
+        if (taken) next_pc = pc + imm;
+        break;
+    case 0b1101111:  // JAL
+        imm = sign_extend(((instruction >> 31) << 20) | (((instruction >> 12) & 0xFF) << 12) |
+                          (((instruction >> 20) & 0x1) << 11) | (((instruction >> 21) & 0x3FF) << 1), 21);
+        result = pc + length;
+        next_pc = pc + imm;
+        break;
+    case 0b1100111:  // JALR
+        imm = sign_extend(instruction >> 20, 12);
+        result = pc + length;
+        next_pc = (a + imm) & ~1u;
+        break;
+    case 0b0110111:  // LUI
+        result = instruction & 0xFFFFF000;
+        break;
+    case 0b0010111:  // AUIPC
+        result = pc + (instruction & 0xFFFFF000);
+        break;
+    default:
+        return false;
+    }
+
+    if (writes_rd && rd != 0) {
+        cpu.regs[rd] = result;
+        retired->rd = rd;
+        retired->value = result;
+    }
+    retired->next_pc = next_pc;
+    cpu.pc = next_pc;
+    cpu.instret++;
+    return true;
+}
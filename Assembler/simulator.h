@@ -0,0 +1,138 @@
+/*
+ * RISC-V Simulator Header
+ *
+ * This header file defines the constants, structures, and function prototypes used
+ * in the RISC-V simulator. The simulator loads the machine code written by the
+ * assembler (hexadecimal or binary format), executes it on an RV32I model with a
+ * sparse memory, and hands every retired instruction to the optional analysis modes.
+ */
+
+#ifndef SIMULATOR_H  // Include guard to prevent multiple inclusion of this header file
+#define SIMULATOR_H
+
+#include <stdio.h>   // Standard input/output library for file handling
+#include <string.h>  // String manipulation functions
+#include <stdlib.h>  // Standard library for memory management and exit codes
+#include <ctype.h>   // Character type functions
+#include <stdbool.h>
+
+#define PAGE_SHIFT 12                        // Memory is allocated in 4 KiB pages
+#define PAGE_SIZE (1u << PAGE_SHIFT)         // Size of one memory page in bytes
+#define PAGE_COUNT (1u << (32 - PAGE_SHIFT)) // Number of pages in the 32-bit address space
+#define STACK_TOP 0x00100000                 // Initial value of the stack pointer (sp)
+#define MAX_SYMBOL_LENGTH 256                // Maximum length of a label name
+#define MAX_DEVICES 8                        // Maximum number of memory-mapped devices
+
+// Addresses of the memory-mapped devices (same layout as the QEMU virt board)
+#define UART_BASE 0x10000000      // 16550-style UART: transmit register at +0, line status at +5
+#define UART_SIZE 0x100
+#define CLINT_BASE 0x02000000     // Core-local interruptor holding the machine timer
+#define CLINT_SIZE 0x10000
+#define CLINT_MTIMECMP 0x4000     // Offset of the 64-bit mtimecmp register
+#define CLINT_MTIME 0xBFF8        // Offset of the 64-bit mtime register
+
+// Results of comparing a retired instruction with the RTL commit log
+#define COSIM_MATCH 0     // The simulator and the log agree
+#define COSIM_END 1       // The log has no more records
+#define COSIM_MISMATCH 2  // The first divergence was found (or the log is malformed)
+
+// Structure holding the architectural state of the simulated hart
+typedef struct {
+    unsigned int regs[32];          // Integer register file (x0 is kept at zero)
+    unsigned int pc;                // Program counter
+    unsigned long long instret;     // Number of retired instructions
+} Cpu;
+
+// Structure describing one retired instruction, passed to the analysis modes
+typedef struct {
+    unsigned int pc;           // Address of the instruction
+    unsigned int instruction;  // Raw instruction (16 bits for a compressed instruction)
+    unsigned int decoded;      // Equivalent 32-bit instruction word
+    unsigned int next_pc;      // Address of the next instruction to execute
+    unsigned int rd;           // Destination register written (0 if none)
+    unsigned int value;        // Value written to rd
+    bool is_load;              // True for lb/lh/lw/lbu/lhu
+    bool is_store;             // True for sb/sh/sw
+    unsigned int mem_address;  // Effective address of a load or store
+    unsigned int mem_size;     // Access size in bytes of a load or store
+} Retired;
+
+// Structure holding one entry of the symbol map written by the assembler (-m)
+typedef struct {
+    char name[MAX_SYMBOL_LENGTH]; // The label name
+    unsigned int address;         // Byte address of the label
+} Symbol;
+
+// Structure describing a memory-mapped device region and its access handlers
+typedef struct {
+    unsigned int base;  // First address of the region
+    unsigned int size;  // Size of the region in bytes
+    unsigned int (*load)(unsigned int offset, unsigned int size);              // Reads a register
+    void (*store)(unsigned int offset, unsigned int size, unsigned int value); // Writes a register
+} Device;
+
+// External variables shared between the simulator and its analysis modes
+extern Cpu cpu;                   // State of the simulated hart
+extern unsigned int program_size; // Size in bytes of the loaded program image
+extern Symbol *symbols;           // Symbol table sorted by address (NULL if none loaded)
+extern int symbol_count;          // Number of entries in the symbol table
+
+// Memory access functions (little-endian, pages are allocated on first touch)
+unsigned int memory_load(unsigned int address, unsigned int size);
+void memory_store(unsigned int address, unsigned int size, unsigned int value);
+
+// Maps a device into the address space; its accesses bypass RAM
+void register_device(const Device *device);
+
+// Maps the UART (output to uart_output) and the machine timer (devices.c)
+void devices_init(FILE *uart_output, unsigned int timer_divider);
+
+// Loads a program written by the assembler (-h or -b format, or "shm:/name" for -s) at address 0
+int load_program(const char *file_name);
+
+// Loads the symbol map written by the assembler with the -m option
+int load_symbols(const char *file_name);
+
+// Returns the index of the symbol whose region contains address, or -1 if none
+int find_symbol(unsigned int address);
+
+// Formats an address as "label+offset" when a symbol map is loaded, otherwise as hex
+const char *format_address(unsigned int address);
+
+// Resets the hart: clears registers, sets sp and starts execution at address 0
+void reset_cpu(void);
+
+// Executes one instruction and describes it in *retired; returns false on an illegal instruction
+bool step(Retired *retired);
+
+// Stride and prefetch analysis of load/store sites (analysis.c)
+void stride_configure(unsigned int line_size, unsigned int sets, unsigned int ways, unsigned int miss_latency);
+void stride_init(void);
+void stride_record(const Retired *retired);
+void stride_report(FILE *output_file);
+
+// Reuse-distance and working-set profiling of data accesses (analysis.c)
+void reuse_configure(unsigned int line_size, unsigned long long window);
+void reuse_init(void);
+void reuse_record(const Retired *retired);
+void reuse_report(FILE *output_file);
+
+// Roofline placement of the innermost loops (analysis.c)
+void roofline_configure(double ops_per_cycle, double bytes_per_cycle);
+void roofline_init(void);
+void roofline_record(const Retired *retired);
+void roofline_report(FILE *output_file);
+
+// Execution profile of the label regions and the calls between them (analysis.c)
+void profile_init(void);
+void profile_record(const Retired *retired);
+void profile_report(FILE *profile_file);
+
+// Lockstep comparison against an RTL commit log (cosim.c)
+int cosim_open(const char *file_name);
+int cosim_record(const Retired *retired);
+bool cosim_pending(void);
+void cosim_report(FILE *output_file);
+void trace_record(FILE *trace_file, const Retired *retired);
+
+#endif // End of the include guard for SIMULATOR_H
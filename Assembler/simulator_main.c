@@ -0,0 +1,205 @@
+/*
+ * RISC-V Simulator
+ *
+ * This file serves as the main entry point for the RISC-V simulator. It loads the
+ * machine code written by the assembler, runs it until the program counter leaves
+ * the program, an instruction jumps to itself (the usual "done: j done" ending) or
+ * the step limit is reached, and then prints the requested analysis reports.
+ * Usage: ./simulator <program_file> [options]
+ *   program_file may be "shm:/name" to map the shared-memory image written by ./assembler -s.
+ *   -n <steps>            Stop after this many instructions (default 100000000).
+ *   --stride              Report load/store strides and prefetch candidates.
+ *   --line <bytes>        Cache line size of the data cache model (default 64).
+ *   --sets <count>        Number of sets of the data cache model (default 64).
+ *   --ways <count>        Associativity of the data cache model (default 4).
+ *   --miss-latency <cyc>  Cycles needed to service a cache miss (default 20).
+ *   --reuse               Report reuse distances and the working set over time.
+ *   --window <insts>      Working-set window length in instructions (default 100000).
+ *   --roofline            Report arithmetic intensity and roofline bound of each innermost loop.
+ *   --peak-ops <n>        Peak arithmetic instructions per cycle for the roofline (default 1).
+ *   --peak-bw <n>         Peak memory bytes per cycle for the roofline (default 4).
+ *   --symbols <map_file>  Name code regions with the symbol map written by the assembler (-m).
+ *   --profile <file>      Write the instructions retired in every label region, the calls
+ *                         between regions and the branch outcomes, for the assembler's
+ *                         --profile and --block-layout (needs --symbols).
+ *   --cosim <log_file>    Compare every retirement with an RTL commit log and stop at the
+ *                         first divergence (see cosim.c for the log format).
+ *   --trace <log_file>    Write the simulator's own commit log in the same format.
+ *   --uart <file>         Write the output of the UART at 0x10000000 to a file (default stdout).
+ *   --timer-divider <n>   Cycles per tick of the mtime register at 0x0200BFF8 (default 1).
+ */
+
+#include "simulator.h"  // Include the header file that contains function declarations and constants
+
+// Prints the command line usage of the simulator
+static void usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s <program_file> [-n steps] [--stride] [--line bytes] [--sets count] [--ways count] [--miss-latency cycles]\n"
+                    "       [--reuse] [--window instructions] [--roofline] [--peak-ops n] [--peak-bw n] [--symbols map_file]\n"
+                    "       [--profile file] [--cosim log_file] [--trace log_file] [--uart file] [--timer-divider n]\n",
+            program_name);
+}
+
+int main(int argc, char *argv[]) {
+    // Check if the program file is provided
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    unsigned long long max_steps = 100000000ULL;
+    bool stride = false, reuse = false, roofline = false;
+    double ops_per_cycle = 1.0, bytes_per_cycle = 4.0;
+    unsigned int line_size = 64, sets = 64, ways = 4, miss_latency = 20;
+    unsigned long long window = 100000;
+    const char *map_file_name = NULL;
+    const char *profile_file_name = NULL;
+    const char *cosim_file_name = NULL;
+    const char *trace_file_name = NULL;
+    const char *uart_file_name = NULL;
+    unsigned int timer_divider = 1;
+
+    // Parse the options that follow the program file
+    for (int i = 2; i < argc; i++) {
+        bool has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "--stride") == 0) {
+            stride = true;
+        } else if (strcmp(argv[i], "--reuse") == 0) {
+            reuse = true;
+        } else if (strcmp(argv[i], "--window") == 0 && has_value) {
+            window = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--roofline") == 0) {
+            roofline = true;
+        } else if (strcmp(argv[i], "--peak-ops") == 0 && has_value) {
+            ops_per_cycle = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--peak-bw") == 0 && has_value) {
+            bytes_per_cycle = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--cosim") == 0 && has_value) {
+            cosim_file_name = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && has_value) {
+            trace_file_name = argv[++i];
+        } else if (strcmp(argv[i], "--uart") == 0 && has_value) {
+            uart_file_name = argv[++i];
+        } else if (strcmp(argv[i], "--timer-divider") == 0 && has_value) {
+            timer_divider = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--symbols") == 0 && has_value) {
+            map_file_name = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0 && has_value) {
+            profile_file_name = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0 && has_value) {
+            max_steps = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--line") == 0 && has_value) {
+            line_size = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--sets") == 0 && has_value) {
+            sets = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--ways") == 0 && has_value) {
+            ways = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--miss-latency") == 0 && has_value) {
+            miss_latency = strtoul(argv[++i], NULL, 0);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (line_size == 0 || sets == 0 || ways == 0 || window == 0 || ops_per_cycle <= 0 || bytes_per_cycle <= 0 ||
+        timer_divider == 0) {
+        fprintf(stderr, "Cache line size, sets, ways, window, machine peaks and timer divider must be non-zero\n");
+        return 1;
+    }
+    if (profile_file_name && !map_file_name) {
+        fprintf(stderr, "The execution profile needs the symbol map (--symbols)\n");
+        return 1;
+    }
+
+    // Load the program and prepare the hart and the analyses
+    if (load_program(argv[1]) != 0) {
+        return 1;
+    }
+    if (map_file_name && load_symbols(map_file_name) != 0) {
+        return 1;
+    }
+    if (cosim_file_name && cosim_open(cosim_file_name) != 0) {
+        return 1;
+    }
+    FILE *uart_file = stdout;
+    if (uart_file_name) {
+        uart_file = fopen(uart_file_name, "w");
+        if (!uart_file) {
+            perror("Error opening UART output file");
+            return 1;
+        }
+    }
+    devices_init(uart_file, timer_divider);
+    FILE *trace_file = NULL;
+    if (trace_file_name) {
+        trace_file = fopen(trace_file_name, "w");
+        if (!trace_file) {
+            perror("Error opening trace file");
+            return 1;
+        }
+    }
+    reset_cpu();
+    if (stride) {
+        stride_configure(line_size, sets, ways, miss_latency);
+        stride_init();
+    }
+    if (reuse) {
+        reuse_configure(line_size, window);
+        reuse_init();
+    }
+    FILE *profile_file = NULL;
+    if (profile_file_name) {
+        profile_file = fopen(profile_file_name, "w");
+        if (!profile_file) {
+            perror("Error opening profile file");
+            return 1;
+        }
+        profile_init();
+    }
+    if (roofline) {
+        roofline_configure(ops_per_cycle, bytes_per_cycle);
+        roofline_init();
+    }
+
+    // Run until the program ends, loops on itself or reaches the step limit.
+    // In co-simulation the commit log decides when to stop, so a jump to self keeps running.
+    Retired retired;
+    int status = 0;
+    while (cpu.pc < program_size && cpu.instret < max_steps) {
+        if (!step(&retired)) {
+            fprintf(stderr, "Illegal instruction 0x%08X at pc 0x%08X\n", memory_load(cpu.pc, 4), cpu.pc);
+            status = 1;
+            break;
+        }
+        if (cosim_file_name) {
+            int result = cosim_record(&retired);
+            if (result == COSIM_MISMATCH) status = 1;
+            if (result != COSIM_MATCH) break;
+        }
+        if (trace_file) trace_record(trace_file, &retired);
+        if (stride) stride_record(&retired);
+        if (reuse) reuse_record(&retired);
+        if (roofline) roofline_record(&retired);
+        if (profile_file) profile_record(&retired);
+        if (retired.next_pc == retired.pc && !cosim_file_name) break;  // Jump to self: the program is done
+    }
+    if (cosim_file_name && status == 0 && cpu.instret < max_steps && cosim_pending()) {
+        fprintf(stderr, "Simulator stopped at pc 0x%08X but the commit log has more records\n", cpu.pc);
+        status = 1;
+    }
+
+    fflush(uart_file);
+    if (uart_file != stdout) fclose(uart_file);
+
+    printf("Retired %llu instructions, pc = 0x%08X\n", cpu.instret, cpu.pc);
+    if (cosim_file_name) cosim_report(stdout);
+    if (trace_file) fclose(trace_file);
+    if (stride) stride_report(stdout);
+    if (reuse) reuse_report(stdout);
+    if (roofline) roofline_report(stdout);
+    if (profile_file) {
+        profile_report(profile_file);
+        fclose(profile_file);
+    }
+
+    return status;
+}
@@ -40,16 +40,49 @@ for asm_file in asm_files:
     print(f" Starting Test for: '{asm_file}'")
     print("=" * 50)
 
+    # Options of the assembler for this test, given by a "# options: ..." first line
+    asm_path = os.path.join(testing_application_path, asm_file)
+    with open(asm_path) as asm:
+        first_line = asm.readline().strip()
+    options = first_line[len('# options:'):].strip() if first_line.startswith('# options:') else ''
+
+    # A test with a listing_*.dump also checks the annotated listing
+    listing_dump_path = os.path.join(testing_application_path, asm_file.replace('test_', 'listing_').replace('.s', '.dump'))
+    listing_file = os.path.join(output_directory, 'listing_' + asm_file.replace('.s', '.txt'))
+    if os.path.exists(listing_dump_path):
+        options += f" --listing {listing_file}"
+
+    # A test with a messages_*.dump checks what the assembler reports; without a hex_*.dump the run must fail
+    messages_dump_path = os.path.join(testing_application_path, asm_file.replace('test_', 'messages_').replace('.s', '.dump'))
+    messages_file = os.path.join(output_directory, 'messages_' + asm_file.replace('.s', '.txt'))
+    checks_messages = os.path.exists(messages_dump_path)
+
     # Construct the assembler command
-    assembler_command = f"./assembler {os.path.join(testing_application_path, asm_file)} {output_file} -h"
+    assembler_command = f"./assembler {asm_path} {output_file} -h {options}"
     
     # Execute the assembler command
     print(f"Running assembler for: {asm_file}...")
-    try:
-        subprocess.run(assembler_command, shell=True, check=True)
+    run = subprocess.run(assembler_command, shell=True, stderr=subprocess.PIPE if checks_messages else None, text=True)
+    if checks_messages:
+        with open(messages_file, 'w') as messages:
+            messages.write(run.stderr)
+        with open(messages_dump_path) as expected:
+            same_messages = (run.stderr == expected.read())
+        print("Messages Comparison Result:")
+        print("Files are identical" if same_messages else f"Messages differ:\n{run.stderr}")
+        if not os.path.exists(dump_file_path):
+            if same_messages and run.returncode != 0:
+                correct_outputs.append(asm_file)
+            else:
+                incorrect_outputs.append(asm_file)
+            continue
+        if not same_messages:
+            incorrect_outputs.append(asm_file)
+            continue
+    if run.returncode == 0:
         print(f"Successfully generated output file: {output_file}")
-    except subprocess.CalledProcessError as e:
-        print(f"Error running assembler for {asm_file}: {e}")
+    else:
+        print(f"Error running assembler for {asm_file}: exit status {run.returncode}")
         continue
     
     if os.path.exists(dump_file_path):
@@ -68,6 +101,13 @@ for asm_file in asm_files:
         print("Comparison Result:")
         print(result.stdout)
         
+        # The listing, if the test has one, must match as well
+        if os.path.exists(listing_dump_path) and "Files are identical" in result.stdout:
+            result = subprocess.run(f"python3 check.py {listing_file} {listing_dump_path}", shell=True,
+                                    capture_output=True, text=True)
+            print("Listing Comparison Result:")
+            print(result.stdout)
+
         # Check the result for correctness
         if "Files are identical" in result.stdout:  # Modify this based on actual success indicator
             correct_outputs.append(asm_file)